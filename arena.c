@@ -41,6 +41,7 @@ Arena Arena_make(size_t page_size)
 {
 	Arena self = {0};
 	self.first = Page_new(page_size);
+	self.current = self.first;
 	self.page_size = ALIGN(page_size);
 	return self;
 }
@@ -51,11 +52,12 @@ void *Arena_alloc(Arena *self, size_t size)
 	if (size > self->page_size) {
 		return NULL;
 	}
-	Page *p = self->first;
+	Page *p = self->current;
 	while (p) {
 		if (self->page_size - p->taken >= size) {
 			char *mem = p->data + p->taken;
 			p->taken += size;
+			self->current = p;
 			return mem;
 		}
 		if (p->next == NULL) {
@@ -73,6 +75,7 @@ void Arena_reset(Arena *self)
 		p->taken = 0;
 		p = p->next;
 	}
+	self->current = self->first;
 }
 
 void Arena_destroy(Arena self)
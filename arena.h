@@ -5,8 +5,11 @@
 
 typedef struct Page Page;
 
+// NOTE: the pages before the current one are not looked at again
+// until the reset, so an arena that is never reset grows in O(1)
 typedef struct {
 	Page   *first;
+	Page   *current;
 	size_t page_size;
 } Arena;
 
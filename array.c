@@ -0,0 +1,277 @@
+#include "array.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "object.h"
+#include "values.h"
+#include "gc.h"
+#include "eval.h"
+#include "context.h"
+#include "builtin.h"
+#include "simd.h"
+#include "error.h"
+
+
+#define ERROR_PREFIX "evaluation error"
+
+// Arrays: the numbers are stored unboxed in a row, so a bulk operation
+// is a single call of a vector kernel (see simd.c) instead of a call per
+// element and a boxed number per result.
+
+typedef void Binary(double *r, const double *a, const double *b, long n);
+typedef double Reduce(const double *a, long n);
+
+static Object *Array_new(long length, Context *ctx)
+{
+	Object *r = GC_alloc_array(ctx->gc, length);
+	if (!r) {
+		errorf("no memory for an array of %ld numbers", length);
+	}
+	return r;
+}
+
+static Object *Array_arg(Object *arg, Context *ctx)
+{
+	return Builtin_arg(arg, ArrayObject, ctx);
+}
+
+static int Array_length_arg(Object *arg, Context *ctx, long *length)
+{
+	Number num;
+	if (!Builtin_numeric(arg, ctx, &num)) {
+		return 0;
+	}
+	double n = Number_value(num);
+	if (n < 0 || n != (long)n) {
+		char text[NUMBER_TEXT_SIZE];
+		errorf("bad array length %s", Number_format(num, text));
+		return 0;
+	}
+	*length = n;
+	return 1;
+}
+
+// NOTE: the arrays are forced one after another,
+// the first one is kept alive by the arguments
+static int Array_pair(Object **args, Context *ctx, Object **a, Object **b)
+{
+	if (!(*a = Array_arg(args[0], ctx)) || !(*b = Array_arg(args[1], ctx))) {
+		return 0;
+	}
+	if (ArrayObj_length(*a) != ArrayObj_length(*b)) {
+		error("the arrays have different lengths");
+		return 0;
+	}
+	return 1;
+}
+
+static Object *Array_binary(Object **args, Context *ctx, Binary *kernel)
+{
+	Object *a, *b;
+	if (!Array_pair(args, ctx, &a, &b)) {
+		return NULL;
+	}
+	Object *r = Array_new(ArrayObj_length(a), ctx);
+	if (!r) {
+		return NULL;
+	}
+	kernel(ArrayObj_data(r), ArrayObj_data(a), ArrayObj_data(b), ArrayObj_length(a));
+	return r;
+}
+
+static Object *Array_reduce(Object **args, Context *ctx, Reduce *kernel)
+{
+	Object *a = Array_arg(args[0], ctx);
+	if (!a) {
+		return NULL;
+	}
+	if (!ArrayObj_length(a)) {
+		error("the array is empty");
+		return NULL;
+	}
+	return GC_alloc_number(ctx->gc, kernel(ArrayObj_data(a), ArrayObj_length(a)));
+}
+
+Object *Array_fill(Object **args, Context *ctx)
+{
+	long length;
+	double x;
+	if (!Array_length_arg(args[0], ctx, &length) || !Builtin_number(args[1], ctx, &x)) {
+		return NULL;
+	}
+	Object *r = Array_new(length, ctx);
+	if (!r) {
+		return NULL;
+	}
+	for (long i = 0; i < length; i++) {
+		ArrayObj_data(r)[i] = x;
+	}
+	return r;
+}
+
+// The numbers from the first one up to the second one (not included)
+Object *Array_range(Object **args, Context *ctx)
+{
+	double from, to;
+	if (!Builtin_number(args[0], ctx, &from) || !Builtin_number(args[1], ctx, &to)) {
+		return NULL;
+	}
+	if (to - from > ARRAY_MAX_LENGTH) {
+		errorf("no memory for an array of %g numbers", ceil(to - from));
+		return NULL;
+	}
+	long length = from < to ? (long)(to - from) : 0;
+	if (from + length < to) {
+		length += 1;
+	}
+	Object *r = Array_new(length, ctx);
+	if (!r) {
+		return NULL;
+	}
+	for (long i = 0; i < length; i++) {
+		ArrayObj_data(r)[i] = from + i;
+	}
+	return r;
+}
+
+// NOTE: the numbers are collected before the array is allocated,
+// since forcing the list may start a collection
+Object *Array_from_list(Object **args, Context *ctx)
+{
+	long length = 0, size = 0;
+	double *nums = NULL;
+	Object *list = Builtin_arg(args[0], ListObject, ctx);
+	for (; list && !ListObj_empty(list); list = Builtin_arg(ListObj_tail(list), ListObject, ctx)) {
+		if (length == size) {
+			size = size ? size * 2 : 16;
+			nums = reallocarray(nums, size, sizeof(*nums));
+		}
+		if (!Builtin_number(ListObj_head(list), ctx, &nums[length])) {
+			list = NULL;
+			break;
+		}
+		length += 1;
+	}
+	Object *r = NULL;
+	if (list) {
+		r = Array_new(length, ctx);
+	}
+	if (r) {
+		for (long i = 0; i < length; i++) {
+			ArrayObj_data(r)[i] = nums[i];
+		}
+	}
+	free(nums);
+	return r;
+}
+
+// The n-th element of the array (from 1)
+Object *Array_get(Object **args, Context *ctx)
+{
+	Number num;
+	if (!Builtin_numeric(args[0], ctx, &num)) {
+		return NULL;
+	}
+	double n = Number_value(num);
+	Object *a = Array_arg(args[1], ctx);
+	if (!a) {
+		return NULL;
+	}
+	if (n < 1 || n > ArrayObj_length(a) || n != (long)n) {
+		char text[NUMBER_TEXT_SIZE];
+		errorf("no element %s in an array", Number_format(num, text));
+		return NULL;
+	}
+	return GC_alloc_number(ctx->gc, ArrayObj_data(a)[(long)n - 1]);
+}
+
+Object *Array_length(Object **args, Context *ctx)
+{
+	Object *a = Array_arg(args[0], ctx);
+	if (!a) {
+		return NULL;
+	}
+	return GC_alloc_int(ctx->gc, ArrayObj_length(a));
+}
+
+Object *Array_add(Object **args, Context *ctx)
+{
+	return Array_binary(args, ctx, Simd_kernels()->add);
+}
+
+Object *Array_sub(Object **args, Context *ctx)
+{
+	return Array_binary(args, ctx, Simd_kernels()->sub);
+}
+
+Object *Array_mul(Object **args, Context *ctx)
+{
+	return Array_binary(args, ctx, Simd_kernels()->mul);
+}
+
+Object *Array_div(Object **args, Context *ctx)
+{
+	return Array_binary(args, ctx, Simd_kernels()->div);
+}
+
+Object *Array_lt(Object **args, Context *ctx)
+{
+	return Array_binary(args, ctx, Simd_kernels()->lt);
+}
+
+Object *Array_gt(Object **args, Context *ctx)
+{
+	return Array_binary((Object *[]){args[1], args[0]}, ctx, Simd_kernels()->lt);
+}
+
+Object *Array_eq(Object **args, Context *ctx)
+{
+	return Array_binary(args, ctx, Simd_kernels()->eq);
+}
+
+Object *Array_scale(Object **args, Context *ctx)
+{
+	double k;
+	if (!Builtin_number(args[0], ctx, &k)) {
+		return NULL;
+	}
+	Object *a = Array_arg(args[1], ctx);
+	if (!a) {
+		return NULL;
+	}
+	Object *r = Array_new(ArrayObj_length(a), ctx);
+	if (!r) {
+		return NULL;
+	}
+	Simd_kernels()->scale(ArrayObj_data(r), k, ArrayObj_data(a), ArrayObj_length(a));
+	return r;
+}
+
+Object *Array_sum(Object **args, Context *ctx)
+{
+	Object *a = Array_arg(args[0], ctx);
+	if (!a) {
+		return NULL;
+	}
+	return GC_alloc_number(ctx->gc, Simd_kernels()->sum(ArrayObj_data(a), ArrayObj_length(a)));
+}
+
+Object *Array_dot(Object **args, Context *ctx)
+{
+	Object *a, *b;
+	if (!Array_pair(args, ctx, &a, &b)) {
+		return NULL;
+	}
+	return GC_alloc_number(ctx->gc, Simd_kernels()->dot(ArrayObj_data(a), ArrayObj_data(b), ArrayObj_length(a)));
+}
+
+Object *Array_min(Object **args, Context *ctx)
+{
+	return Array_reduce(args, ctx, Simd_kernels()->min);
+}
+
+Object *Array_max(Object **args, Context *ctx)
+{
+	return Array_reduce(args, ctx, Simd_kernels()->max);
+}
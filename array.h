@@ -0,0 +1,26 @@
+#ifndef ARRAY_INCLUDED
+#define ARRAY_INCLUDED
+
+#include "object.h"
+#include "context.h"
+
+// the builtins, see builtin.c
+Object *Array_fill(Object **args, Context *ctx);
+Object *Array_range(Object **args, Context *ctx);
+Object *Array_from_list(Object **args, Context *ctx);
+Object *Array_get(Object **args, Context *ctx);
+Object *Array_length(Object **args, Context *ctx);
+Object *Array_add(Object **args, Context *ctx);
+Object *Array_sub(Object **args, Context *ctx);
+Object *Array_mul(Object **args, Context *ctx);
+Object *Array_div(Object **args, Context *ctx);
+Object *Array_lt(Object **args, Context *ctx);
+Object *Array_gt(Object **args, Context *ctx);
+Object *Array_eq(Object **args, Context *ctx);
+Object *Array_scale(Object **args, Context *ctx);
+Object *Array_sum(Object **args, Context *ctx);
+Object *Array_dot(Object **args, Context *ctx);
+Object *Array_min(Object **args, Context *ctx);
+Object *Array_max(Object **args, Context *ctx);
+
+#endif // ARRAY_INCLUDED
@@ -0,0 +1,188 @@
+#include "builtin.h"
+
+#include "object.h"
+#include "values.h"
+#include "env.h"
+#include "gc.h"
+#include "arena.h"
+#include "types.h"
+#include "eval.h"
+#include "opts.h"
+#include "error.h"
+#include "stream.h"
+#include "list.h"
+#include "array.h"
+#include "map.h"
+#include "vector.h"
+#include "loop.h"
+#include "ffi.h"
+
+#include <string.h>
+
+
+#define ERROR_PREFIX "evaluation error"
+
+// The functions implemented in C, see BuiltinDesc. Only the ones
+// in the compiled list are available to compiled code.
+
+#define TYPE_ARENA_PAGE_SIZE 1024
+
+static const BuiltinDesc builtins[] = {
+	{"from",      "num -> num stream",                       1, Stream_from},
+	{"smap",      "(a -> b) -> a stream -> b stream",        2, Stream_map},
+	{"sfilter",   "(a -> num) -> a stream -> a stream",      2, Stream_filter},
+	{"sdrop",     "num -> a stream -> a stream",             2, Stream_drop},
+	{"shead",     "a stream -> a",                           1, Stream_head},
+	{"stail",     "a stream -> a stream",                    1, Stream_tail},
+	{"snth",      "num -> a stream -> a",                    2, Stream_nth},
+	{"nil",       "a list",                                  0, List_nil},
+	{"lcons",     "a -> a list -> a list",                   2, List_cons},
+	{"head",      "a list -> a",                             1, List_head},
+	{"tail",      "a list -> a list",                        1, List_tail},
+	{"empty",     "a list -> num",                           1, List_empty},
+	{"length",    "a list -> num",                           1, List_length},
+	{"nth",       "num -> a list -> a",                      2, List_nth},
+	{"map",       "(a -> b) -> a list -> b list",            2, List_map},
+	{"filter",    "(a -> num) -> a list -> a list",          2, List_filter},
+	{"foldl",     "(b -> a -> b) -> b -> a list -> b",       3, List_foldl},
+	{"foldr",     "(a -> b -> b) -> b -> a list -> b",       3, List_foldr},
+	{"range",     "num -> num -> num list",                  2, List_range},
+	{"array",     "num -> num -> num array",                 2, Array_fill},
+	{"arange",    "num -> num -> num array",                 2, Array_range},
+	{"alist",     "num list -> num array",                   1, Array_from_list},
+	{"aget",      "num -> num array -> num",                 2, Array_get},
+	{"alength",   "num array -> num",                        1, Array_length},
+	{"aadd",      "num array -> num array -> num array",     2, Array_add},
+	{"asub",      "num array -> num array -> num array",     2, Array_sub},
+	{"amul",      "num array -> num array -> num array",     2, Array_mul},
+	{"adiv",      "num array -> num array -> num array",     2, Array_div},
+	{"alt",       "num array -> num array -> num array",     2, Array_lt},
+	{"agt",       "num array -> num array -> num array",     2, Array_gt},
+	{"aeq",       "num array -> num array -> num array",     2, Array_eq},
+	{"ascale",    "num -> num array -> num array",           2, Array_scale},
+	{"asum",      "num array -> num",                        1, Array_sum},
+	{"adot",      "num array -> num array -> num",           2, Array_dot},
+	{"amin",      "num array -> num",                        1, Array_min},
+	{"amax",      "num array -> num",                        1, Array_max},
+	{"mempty",    "a map",                                   0, Map_empty},
+	{"insert",    "num -> a -> a map -> a map",              3, Map_insert},
+	{"lookup",    "num -> a map -> a",                       2, Map_lookup},
+	{"member",    "num -> a map -> num",                     2, Map_member},
+	{"remove",    "num -> a map -> a map",                   2, Map_remove},
+	{"size",      "a map -> num",                            1, Map_size},
+	{"vempty",    "a vector",                                0, Vector_empty},
+	{"vpush",     "a -> a vector -> a vector",               2, Vector_push},
+	{"vget",      "num -> a vector -> a",                    2, Vector_get},
+	{"vset",      "num -> a -> a vector -> a vector",        3, Vector_set},
+	{"vlength",   "a vector -> num",                         1, Vector_length},
+	{"vconcat",   "a vector -> a vector -> a vector",        2, Vector_concat},
+	{"vslice",    "num -> num -> a vector -> a vector",      3, Vector_slice},
+	{"vlist",     "a list -> a vector",                      1, Vector_from_list},
+	{"iterate",   "num -> (a -> a) -> a -> a",               3, Loop_iterate},
+	{"sumrange",  "num -> num -> (num -> num) -> num",       3, Loop_sumrange},
+	{"foldrange", "num -> num -> (a -> num -> a) -> a -> a", 4, Loop_foldrange},
+};
+
+static const char *compiled[] = {"iterate", "sumrange", "foldrange"};
+
+const char *Builtin_params[BUILTIN_MAX_ARGS] = {"0", "1", "2", "3"};
+
+static void Builtin_bind(Context *ctx, TypeEnv **tenv, const BuiltinDesc *desc, Arena *a)
+{
+	Object *builtin = GC_alloc_builtin(ctx->gc, desc, 0, NULL);
+	if (!desc->arity) {
+		// a constant, e.g. 'nil' or 'mempty'
+		builtin = desc->fn(NULL, ctx);
+	}
+	Env_add(EnvObj_env(ctx->root), desc->name, builtin);
+	TypeEnv_push(tenv, desc->name, Type_parse(desc->type, a), 1);
+}
+
+// NOTE: the C functions from ffi.c are builtins too
+void Builtin_define(Context *ctx, TypeEnv **tenv)
+{
+	Arena a = Arena_make(TYPE_ARENA_PAGE_SIZE);
+	for (size_t i = 0; i < sizeof(builtins)/sizeof(*builtins); i++) {
+		Builtin_bind(ctx, tenv, &builtins[i], &a);
+	}
+	for (int i = 0; Ffi_native(i); i++) {
+		Builtin_bind(ctx, tenv, Ffi_native(i), &a);
+	}
+	Arena_destroy(a);
+}
+
+// NOTE: the compiled list is followed by the C functions from ffi.c
+const BuiltinDesc *Builtin_compiled(int index)
+{
+	int count = sizeof(compiled)/sizeof(*compiled);
+	if (index >= count) {
+		return Ffi_native(index - count);
+	}
+	for (size_t i = 0; i < sizeof(builtins)/sizeof(*builtins); i++) {
+		if (!strcmp(builtins[i].name, compiled[index])) {
+			return &builtins[i];
+		}
+	}
+	return NULL;
+}
+
+void Builtin_declare_compiled(TypeEnv **tenv)
+{
+	Arena a = Arena_make(TYPE_ARENA_PAGE_SIZE);
+	for (int i = 0; Builtin_compiled(i); i++) {
+		TypeEnv_push(tenv, Builtin_compiled(i)->name, Type_parse(Builtin_compiled(i)->type, &a), 1);
+	}
+	Arena_destroy(a);
+}
+
+// NOTE: the stack of the compiled code is suspended during the call,
+// so it's still scanned if the builtin calls compiled code back
+Object *Builtin_call_comp(GC *gc, int index, Object *env, void *rsp, void *rbp)
+{
+	const BuiltinDesc *desc = Builtin_compiled(index);
+	Object *args[BUILTIN_MAX_ARGS];
+	for (int i = 0; i < desc->arity; i++) {
+		args[i] = Env_get(EnvObj_env(env), Builtin_params[i]);
+		args[i]->owned = 0;
+	}
+	Segment segment;
+	GC_suspend_comp(gc, &segment, rsp, rbp);
+	Context ctx = {gc, NULL, NULL};
+	Object *result = desc->fn(args, &ctx);
+	GC_resume_comp(gc);
+	return result;
+}
+
+// NOTE: the integers are converted, the typed mode still has to check the tag
+int Builtin_number(Object *arg, Context *ctx, double *num)
+{
+	Number number;
+	if (!Builtin_numeric(arg, ctx, &number)) {
+		return 0;
+	}
+	*num = Number_value(number);
+	return 1;
+}
+
+int Builtin_numeric(Object *arg, Context *ctx, Number *num)
+{
+	arg = eval_force(arg, ctx);
+	if (!arg) {
+		return 0;
+	}
+	if (!Number_unbox(arg, num)) {
+		error("type mismatch");
+		return 0;
+	}
+	return 1;
+}
+
+Object *Builtin_arg(Object *arg, ObjectType type, Context *ctx)
+{
+	arg = eval_force(arg, ctx);
+	if (arg && !typed && arg->type != type) {
+		error("type mismatch");
+		return NULL;
+	}
+	return arg;
+}
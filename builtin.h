@@ -0,0 +1,27 @@
+#ifndef BUILTIN_INCLUDED
+#define BUILTIN_INCLUDED
+
+#include "object.h"
+#include "context.h"
+#include "types.h"
+#include "gc.h"
+#include "values.h"
+
+// NOTE: binds the builtins in the global env and their types in the type env
+void Builtin_define(Context *ctx, TypeEnv **tenv);
+
+// The builtins that are available to compiled code: the i-th one (NULL
+// past the last one), their types and the call of the i-th one with the
+// arguments bound to Builtin_params in the env, see compile_builtins
+const BuiltinDesc *Builtin_compiled(int index);
+void              Builtin_declare_compiled(TypeEnv **tenv);
+Object            *Builtin_call_comp(GC *gc, int index, Object *env, void *rsp, void *rbp);
+extern const char *Builtin_params[];
+
+// NOTE: the helpers for the builtins, they force the argument and
+// check its type in the untyped mode, an error is reported on failure
+int    Builtin_number(Object *arg, Context *ctx, double *num);
+int    Builtin_numeric(Object *arg, Context *ctx, Number *num);
+Object *Builtin_arg(Object *arg, ObjectType type, Context *ctx);
+
+#endif // BUILTIN_INCLUDED
@@ -0,0 +1,77 @@
+#include "callback.h"
+
+#include <stdlib.h>
+
+#include "values.h"
+#include "env.h"
+
+
+const void *Callback_force_text = NULL;
+
+// Runs the compiled code at the text with the env and the value
+// registers set and returns the value it returns. The callee-saved
+// registers are saved for the C caller, the frame looks like the frame
+// of main (see compile_begin), so the stack of the compiled code starts
+// at %rbp and a failure "returns" to callback_fail.
+Object *Callback_enter(Object *env, const void *text, Object *val);
+
+__asm__(
+	".text\n"
+	".global Callback_enter\n"
+	"Callback_enter:\n"
+	"	push %rbx\n"
+	"	push %r12\n"
+	"	push %r13\n"
+	"	push %r14\n"
+	"	push %r15\n"
+	"	lea callback_fail(%rip), %rax\n"
+	"	push %rax\n"
+	"	push %rbp\n"
+	"	mov %rsp, %rbp\n"
+	"	mov %rdi, %r13\n"
+	"	mov %rdx, %r12\n"
+	"	lea callback_ret(%rip), %r14\n"
+	"	jmp *%rsi\n"
+	"callback_ret:\n"
+	"	mov %r12, %rax\n"
+	"	pop %rbp\n"
+	"	add $8, %rsp\n"
+	"	pop %r15\n"
+	"	pop %r14\n"
+	"	pop %r13\n"
+	"	pop %r12\n"
+	"	pop %rbx\n"
+	"	ret\n"
+	// NOTE: the failure code has dropped the GC already
+	"callback_fail:\n"
+	"	and $-16, %rsp\n"
+	"	mov $1, %edi\n"
+	"	call exit\n"
+);
+
+Object *Callback_force(Object *thunk)
+{
+	if (CompThunkObj_value(thunk)) {
+		return CompThunkObj_value(thunk);
+	}
+	return Callback_enter(NULL, Callback_force_text, thunk);
+}
+
+// A call with all of the arguments binds them in one env and runs the
+// innermost body, as a saturated call of compiled code does (see
+// compile_application), otherwise the arguments are passed one by one.
+Object *Callback_apply(GC *gc, Object *fn, int count, Object **args)
+{
+	const CompFnDesc *desc = CompFnObj_desc(fn);
+	if (count == desc->arity) {
+		Object *env = GC_alloc_env(gc, CompFnObj_env(fn));
+		for (int i = 0; i < count; i++) {
+			Env_add(EnvObj_env(env), desc->params[i], args[i]);
+		}
+		return Callback_enter(env, desc->body, NULL);
+	}
+	for (int i = 0; i < count; i++) {
+		fn = Callback_enter(CompFnObj_env(fn), CompFnObj_text(fn), args[i]);
+	}
+	return fn;
+}
@@ -0,0 +1,18 @@
+#ifndef CALLBACK_INCLUDED
+#define CALLBACK_INCLUDED
+
+#include "object.h"
+#include "gc.h"
+
+// Calls of compiled code from C, for the builtins that are called by
+// compiled code (see Builtin_call_comp). NOTE: a failure of the compiled
+// code exits the program, as the failure of the main code does.
+
+// the force subroutine of the compiled program, it's set by its main
+extern const void *Callback_force_text;
+
+Object *Callback_force(Object *thunk);
+// NOTE: count must not exceed the arity of the function
+Object *Callback_apply(GC *gc, Object *fn, int count, Object **args);
+
+#endif // CALLBACK_INCLUDED
@@ -1,6 +1,8 @@
 #include "codegen.h"
 
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "node.h"
 #include "object.h"
@@ -9,6 +11,10 @@
 #include "error.h"
 #include "gc.h"
 #include "opts.h"
+#include "memo.h"
+#include "builtin.h"
+#include "ffi.h"
+#include "worklist.h"
 
 
 // TODO: only do type assertions where necessary
@@ -22,6 +28,9 @@
 #define REG_LINK "%r14"
 #define REG_TMP  "%r15"
 
+// the most arguments of a call that are bound at once
+#define MAX_CALL_ARGS 16
+
 typedef enum {
 	LinkNext,
 	LinkReturn
@@ -34,32 +43,123 @@ static int generate_id(void)
 	return id;
 }
 
+// NOTE: thunks can show up in the strict mode too, because of '~x'
 static int forceable(const Node *expr)
 {
-	if (!lazy)
-		return 0;
+	static Worklist(const Node*) nodes = WORKLIST_EMPTY;
+	nodes.size = 0;
+	Worklist_push(&nodes, expr);
+	while (!Worklist_empty(&nodes)) {
+		expr = Worklist_pop(&nodes);
+		switch (expr->type) {
+			case IdNode:
+				return 1;
+			case ApplNode:
+				return 1;
+			case IfNode:
+				Worklist_push(&nodes, IfNode_false(expr));
+				Worklist_push(&nodes, IfNode_true(expr));
+				break;
+			case AndNode:
+			case OrNode:
+				// NOTE: the left operand is forced before it's tested
+				Worklist_push(&nodes, PairNode_right(expr));
+				break;
+			case GuardNode:
+				Worklist_push(&nodes, GuardNode_original(expr));
+				Worklist_push(&nodes, GuardNode_inlined(expr));
+				break;
+			// NOTE: the operations always allocate a new number
+			case ExptNode:
+			case ProdNode:
+			case SumNode:
+			case CmpNode:
+			case NumAddNode:
+			case NumSubNode:
+			case NumMulNode:
+			case NumDivNode:
+			case NumModNode:
+			case NumPowNode:
+			case NumGtNode:
+			case NumLtNode:
+			case NumEqNode:
+			case LetNode:
+			case NumberNode:
+			case FnNode:
+		}
+	}
+	return 0;
+}
+
+// The value of an arithmetic operation is always a new number
+// NOTE: the comparisons result in the static numbers, see compile_pair
+static int fresh(const Node *expr)
+{
 	switch (expr->type) {
-		case IdNode:
-			return 1;
-		case ApplNode:
-			return 1;
-		case IfNode:
-			return forceable(IfNode_true(expr)) || forceable(IfNode_false(expr));
 		case ExptNode:
 		case ProdNode:
 		case SumNode:
-		case CmpNode:
-		case AndNode:
-		case OrNode:
-			return forceable(PairNode_left(expr)) || forceable(PairNode_right(expr));
-		case LetNode:
-		case NumberNode:
-		case FnNode:
+		case NumAddNode:
+		case NumSubNode:
+		case NumMulNode:
+		case NumDivNode:
+		case NumModNode:
+		case NumPowNode:
+			return 1;
+		default:
+			return 0;
 	}
-	return 0;
 }
 
-static void compile_dispatch(const Node *expr, Linkage l);
+// The code generator doesn't recurse in C either: the code of a node
+// is emitted in steps by a task and the code of its children by the
+// tasks pushed between the steps, so the nesting is only limited by the heap
+typedef enum {
+	NodeTask, // the node with the linkage, see compile_dispatch
+	FnTask,   // one of the nested functions, see compile_fn
+	MemoTask, // the body of a memoized function, see compile_memo_body
+} TaskKind;
+
+typedef struct {
+	TaskKind   kind;
+	const Node *expr;
+	Linkage    link;
+	int        step;    // the steps that are done, owned by the task
+	int        id;
+	int        chain;   // FnTask and MemoTask
+	int        index;   // the parameter (FnTask) or the argument (ApplNode)
+	int        memo;    // FnTask
+	const Node *callee; // ApplNode, see compile_spine
+	const Node **args;
+	int        *thunks;
+	int        count;
+	int        native;
+} Task;
+
+static Worklist(Task) tasks = WORKLIST_EMPTY;
+
+// NOTE: the task that pushes another one returns right away, the pointer
+// to it is invalidated
+static void compile_push(TaskKind kind, const Node *expr, Linkage l, int chain, int index, int memo)
+{
+	Worklist_push(&tasks, kind, expr, l, 0, 0, chain, index, memo, NULL, NULL, NULL, 0, -1);
+}
+
+static void compile_child(const Node *expr, Linkage l)
+{
+	compile_push(NodeTask, expr, l, 0, 0, 0);
+}
+
+// NOTE: only the top of the tree, the comments of a deep tree
+// would take quadratic space
+#define COMMENT_DEPTH 8
+
+static void compile_comment(const Node *expr)
+{
+	printf("// ");
+	Node_print_shallow(expr, COMMENT_DEPTH);
+	putchar('\n');
+}
 
 static void compile_gc_call(void)
 {
@@ -88,28 +188,60 @@ static void compile_ret(void)
 	printf("	jmp *%s\n", REG_LINK);
 }
 
+// Pop the finished task. NOTE: AndNode, OrNode, IfNode, ApplNode
+// and GuardNode must handle linkage themselves
+static void compile_finish(Task *task)
+{
+	int ret = task->kind == NodeTask && task->link == LinkReturn;
+	switch (task->expr->type) {
+		case AndNode:
+		case OrNode:
+		case IfNode:
+		case ApplNode:
+		case GuardNode:
+			ret = 0;
+			break;
+		default:
+			break;
+	}
+	Worklist_drop(&tasks);
+	if (ret) {
+		compile_ret();
+	}
+}
+
+// NOTE: chains of thunks are forced iteratively: the thunks under
+// evaluation are pushed on the stack above the return address and
+// are all updated once a non-thunk value is reached. Thunks under
+// evaluation are blackholed, so forcing them again is a failure.
 static void compile_force_sub(void)
 {
 	printf("force:\n");
 	printf("	cmpl $%d, (%s)\n", CompthunkObject, REG_VAL);
 	printf("	jne force_ret\n");
+	compile_stack_push(PTR_ADDR, REG_LINK);
+	printf("force_loop:\n");
+	printf("	cmpl $%d, (%s)\n", CompthunkObject, REG_VAL);
+	printf("	jne force_update\n");
 	printf("	cmpq $0, %d(%s)\n", ObjFldOff(CompThunk, value), REG_VAL);
 	printf("	jne force_get_value\n");
-	compile_stack_push(PTR_ADDR, REG_LINK);
+	printf("	cmpq $0, %d(%s)\n", ObjFldOff(CompThunk, env), REG_VAL);
+	printf("	je failure\n");
 	compile_stack_push(PTR_OBJ, REG_VAL);
-	printf("	lea force_recurse(%%rip), %s\n", REG_LINK);
 	printf("	mov %d(%s), %s\n", ObjFldOff(CompThunk, env), REG_VAL, REG_ENV);
+	printf("	movq $0, %d(%s)\n", ObjFldOff(CompThunk, env), REG_VAL);
+	printf("	lea force_loop(%%rip), %s\n", REG_LINK);
 	printf("	jmp *%d(%s)\n", ObjFldOff(CompThunk, text), REG_VAL);
-	printf("force_recurse:\n");
-	printf("	lea force_computed(%%rip), %s\n", REG_LINK);
-	printf("	jmp force\n");
-	printf("force_computed:\n");
-	compile_stack_pop(REG_TMP);
-	compile_stack_pop(REG_LINK);
-	printf("	movq %s, %d(%s)\n", REG_VAL, ObjFldOff(CompThunk, value), REG_TMP);
-	printf("	jmp force_ret\n");
 	printf("force_get_value:\n");
 	printf("	mov %d(%s), %s\n", ObjFldOff(CompThunk, value), REG_VAL, REG_VAL);
+	printf("force_update:\n");
+	printf("	cmpq $%d, (%%rsp)\n", PTR_OBJ);
+	printf("	jne force_done\n");
+	compile_stack_pop(REG_TMP);
+	printf("	movq %s, %d(%s)\n", REG_VAL, ObjFldOff(CompThunk, value), REG_TMP);
+	printf("	jmp force_update\n");
+	printf("force_done:\n");
+	compile_stack_pop(REG_LINK);
 	printf("force_ret:\n");
 	printf("	jmp *%s\n", REG_LINK);
 }
@@ -133,19 +265,46 @@ static void compile_type_assertion(ObjectType type)
 	printf("	jne failure\n");
 }
 
-static void compile_num(const Node *expr)
+// NOTE: an integer or a double, IntObject follows NumObject
+static void compile_number_assertion(void)
 {
-	int id = generate_id();
+	printf("	movl (%s), %%eax\n", REG_VAL);
+	printf("	subl $%d, %%eax\n", NumObject);
+	printf("	cmpl $1, %%eax\n");
+	printf("	ja failure\n");
+}
+
+// A number that is not allocated: the object is in the data section, so
+// the GC doesn't free it (it's not in the list of the objects) and nothing
+// changes it. The label is the address of the object.
+// NOTE: the value is right before the object in both Num and Int
+static void compile_static_num(const char *label, Number num)
+{
+	// NOTE: the bits are emitted as they are, the folded constants
+	// need all of the precision (and may be infinite)
+	unsigned long bits = num.i;
+	if (!num.exact) {
+		memcpy(&bits, &num.d, sizeof(bits));
+	}
 	printf(".data\n");
-	printf("v%d: .double %lf\n", id, NumNode_value(expr));
+	printf("	.balign 8\n");
+	printf("	.quad 0x%lx\n", bits);
+	printf("%s:\n", label);
+	printf("	.long %d\n", num.exact ? IntObject : NumObject);
+	printf("	.zero %ld\n", sizeof(Object) - sizeof(ObjectType));
 	printf(".text\n");
-	printf("	mov gc(%%rip), %%rdi\n");
-	printf("	movsd v%d(%%rip), %%xmm0\n", id);
-	printf("	call GC_alloc_number\n");
-	printf("	mov %%rax, %s\n", REG_VAL);
 }
 
-static void compile_id(const Node *expr)
+static void compile_num(const Node *expr)
+{
+	char label[32];
+	snprintf(label, sizeof(label), "v%d", generate_id());
+	compile_static_num(label, NumNode_value(expr));
+	printf("	lea %s(%%rip), %s\n", label, REG_VAL);
+}
+
+// NOTE: the value (or NULL) is left in %rax
+static void compile_lookup(const Node *expr)
 {
 	int id = generate_id();
 	printf(".data\n");
@@ -154,36 +313,170 @@ static void compile_id(const Node *expr)
 	printf("	lea %d(%s), %%rdi\n", ObjValOff(Env), REG_ENV);
 	printf("	lea i%d(%%rip), %%rsi\n", id);
 	printf("	call Env_get\n");
+}
+
+// NOTE: an operand of a binary operation doesn't escape, so it's
+// still owned by its binding (see GC_clear_env)
+static void compile_operand(const Node *expr)
+{
+	compile_lookup(expr);
 	printf("	cmpq $0, %%rax\n");
 	printf("	je failure\n");
 	printf("	mov %%rax, %s\n", REG_VAL);
 }
 
-static void compile_if(const Node *expr, Linkage l)
+static void compile_id(const Node *expr)
+{
+	compile_operand(expr);
+	printf("	movl $0, %ld(%s)\n", offsetof(Object, owned), REG_VAL);
+}
+
+static void compile_if(Task *task)
 {
-	int id = generate_id();
-	compile_dispatch(IfNode_cond(expr), LinkNext);
-	if (forceable(IfNode_cond(expr))) {
-		compile_force_call();
+	const Node *expr = task->expr;
+	int id = task->id;
+	switch (task->step++) {
+		case 0:
+			task->id = generate_id();
+			return compile_child(IfNode_cond(expr), LinkNext);
+		case 1:
+			if (forceable(IfNode_cond(expr))) {
+				compile_force_call();
+			}
+			if (!typed) {
+				compile_number_assertion();
+			}
+			printf("	cmpq $0, %d(%s)\n", ObjFldOff(Num, num), REG_VAL);
+			printf("	je false_branch%d\n", id);
+			printf("true_branch%d:\n", id);
+			return compile_child(IfNode_true(expr), task->link);
+		case 2:
+			printf("	jmp if_end%d\n", id);
+			printf("false_branch%d:\n", id);
+			return compile_child(IfNode_false(expr), task->link);
+		default:
+			printf("if_end%d:\n", id);
+			return compile_finish(task);
 	}
-	if (!typed) {
-		compile_type_assertion(NumObject);
+}
+
+// NOTE: the call of a memoized function is not a tail call, so a function
+// that makes any call in a tail position is not memoized, the loops (and the
+// mutual recursion of such functions) would run out of stack
+static int compile_memoizable(const Node *fn)
+{
+	static Worklist(const Node*) tails = WORKLIST_EMPTY;
+	if (FnNode_arity(fn) > MEMO_MAX_ARGS) {
+		return 0;
+	}
+	for (; fn->type == FnNode; fn = FnNode_body(fn));
+	tails.size = 0;
+	Worklist_push(&tails, fn);
+	while (!Worklist_empty(&tails)) {
+		const Node *expr = Worklist_pop(&tails);
+		switch (expr->type) {
+			case ApplNode:
+				return 0;
+			case IfNode:
+				Worklist_push(&tails, IfNode_true(expr));
+				Worklist_push(&tails, IfNode_false(expr));
+				break;
+			case AndNode:
+			case OrNode:
+				Worklist_push(&tails, PairNode_right(expr));
+				break;
+			case GuardNode:
+				Worklist_push(&tails, GuardNode_inlined(expr));
+				Worklist_push(&tails, GuardNode_original(expr));
+				break;
+			default:
+				break;
+		}
+	}
+	return 1;
+}
+
+// The body of a memoized global function (see memo.c), the arguments
+// are looked up in the env of the call. NOTE: the call is not a tail call.
+static void compile_memo_body(Task *task)
+{
+	int chain = task->chain;
+	if (task->step++) {
+		compile_stack_pop(REG_ENV);
+		printf("	lea d%d(%%rip), %%rdi\n", chain);
+		printf("	mov %s, %%rsi\n", REG_ENV);
+		printf("	mov %s, %%rdx\n", REG_VAL);
+		printf("	call Memo_put_comp\n");
+		compile_ret();
+		return compile_finish(task);
 	}
-	printf("	cmpq $0, %d(%s)\n", ObjFldOff(Num, num), REG_VAL);
-	printf("	je false_branch%d\n", id);
-	printf("true_branch%d:\n", id);
-	compile_dispatch(IfNode_true(expr), l);
-	printf("	jmp if_end%d\n", id);
-	printf("false_branch%d:\n", id);
-	compile_dispatch(IfNode_false(expr), l);
-	printf("if_end%d:\n", id);
+	printf("	mov gc(%%rip), %%rdi\n");
+	printf("	lea d%d(%%rip), %%rsi\n", chain);
+	printf("	mov %s, %%rdx\n", REG_ENV);
+	printf("	call Memo_get_comp\n");
+	printf("	cmpq $0, %%rax\n");
+	printf("	je memo_miss%d\n", chain);
+	printf("	mov %%rax, %s\n", REG_VAL);
+	compile_ret();
+	printf("memo_miss%d:\n", chain);
+	compile_stack_push(PTR_OBJ, REG_ENV);
+	return compile_child(task->expr, LinkNext);
 }
 
-static void compile_fn(const Node *expr)
+// NOTE: nested functions share the list of their parameters and the entry
+// of the innermost body, so a call with all of the arguments can bind them
+// in one env and jump over the closures of the inner functions, see
+// compile_application. The chain is the id of the outermost function.
+static void compile_fn(Task *task)
 {
+	const Node *expr = task->expr;
+	if (task->step++) {
+		if (FnNode_body(expr)->type == FnNode) {
+			compile_ret();
+		}
+		printf("fn_end%d:\n", task->id);
+		printf("	mov gc(%%rip), %%rdi\n");
+		printf("	mov %s, %%rsi\n", REG_ENV);
+		printf("	lea fn%d(%%rip), %%rdx\n", task->id);
+		printf("	lea d%d(%%rip), %%rcx\n", task->id);
+		printf("	call GC_alloc_compfn\n");
+		printf("	mov %%rax, %s\n", REG_VAL);
+		return compile_finish(task);
+	}
 	int id = generate_id();
+	int chain = task->chain;
+	int index = task->index;
+	task->id = id;
+	if (!chain) {
+		chain = id;
+		task->chain = chain;
+		printf(".data\n");
+		int i = 0;
+		for (const Node *fn = expr; fn->type == FnNode; fn = FnNode_body(fn)) {
+			printf("	a%d_%d: .asciz \"%s\"\n", chain, i, FnNode_param_value(fn));
+			i += 1;
+		}
+		printf("	.balign 8\n");
+		printf("p%d:\n", chain);
+		for (int j = 0; j < i; j++) {
+			printf("	.quad a%d_%d\n", chain, j);
+		}
+		printf(".text\n");
+	}
+	int saturated = 0;
+	int i = 0;
+	for (const Node *fn = expr; fn->type == FnNode && i < MAX_CALL_ARGS; fn = FnNode_body(fn)) {
+		if ((lazy || FnNode_lazy(fn)) && !FnNode_saturated(fn)) {
+			saturated |= 1 << i;
+		}
+		i += 1;
+	}
 	printf(".data\n");
-	printf("	a%d: .asciz \"%s\"\n", id, FnNode_param_value(expr));
+	printf("	.balign 8\n");
+	printf("d%d:\n", id);
+	printf("	.long %d, %d, %d, 0\n",
+		FnNode_arity(expr), (lazy || FnNode_lazy(expr)) && !FnNode_strict(expr), saturated);
+	printf("	.quad body%d, p%d+%d\n", chain, chain, 8*index);
 	printf(".text\n");
 	printf("	jmp fn_end%d\n", id);
 	printf("fn%d:\n", id);
@@ -192,119 +485,433 @@ static void compile_fn(const Node *expr)
 	printf("	call GC_alloc_env\n");
 	printf("	mov %%rax, %s\n", REG_ENV);
 	printf("	lea %d(%%rax), %%rdi\n", ObjValOff(Env));
-	printf("	lea a%d(%%rip), %%rsi\n", id);
+	printf("	lea a%d_%d(%%rip), %%rsi\n", chain, index);
 	printf("	mov %s, %%rdx\n", REG_VAL);
 	printf("	call Env_add\n");
+	if (FnNode_body(expr)->type == FnNode) {
+		compile_gc_call();
+		compile_stack_push(PTR_ADDR, REG_LINK);
+		compile_comment(FnNode_body(expr));
+		return compile_push(FnTask, FnNode_body(expr), LinkNext, chain, index + 1, task->memo);
+	}
+	printf("body%d:\n", chain);
 	compile_gc_call();
 	compile_stack_push(PTR_ADDR, REG_LINK);
-	compile_dispatch(FnNode_body(expr), LinkReturn);
-	printf("fn_end%d:\n", id);
-	printf("	mov gc(%%rip), %%rdi\n");
-	printf("	mov %s, %%rsi\n", REG_ENV);
-	printf("	lea fn%d(%%rip), %%rdx\n", id);
-	printf("	call GC_alloc_compfn\n");
-	printf("	mov %%rax, %s\n", REG_VAL);
+	if (task->memo) {
+		return compile_push(MemoTask, FnNode_body(expr), LinkNext, chain, 0, 0);
+	}
+	return compile_child(FnNode_body(expr), LinkReturn);
+}
+
+// The code of an argument of a call as a thunk (numbers are computed
+// in place), it's shared by all the ways to make the call. The body
+// of the thunk is compiled after this.
+static void compile_arg_code(int id)
+{
+	printf("	jmp thunk_end%d\n", id);
+	printf("thunk%d:\n", id);
+	compile_gc_call();
+	printf("thunk_body%d:\n", id);
+	compile_stack_push(PTR_ADDR, REG_LINK);
+}
+
+// Sets ZF if the argument is not passed by need: the bit of the field
+// of the descriptor of the function at the offset from the stack top
+static void compile_lazy_test(int fnoff, int field, int bit)
+{
+	printf("	mov %d(%%rsp), %s\n", fnoff, REG_TMP);
+	printf("	mov %d(%s), %s\n", ObjFldOff(CompFn, desc), REG_TMP, REG_TMP);
+	printf("	testl $%d, %d(%s)\n", bit, field, REG_TMP);
 }
 
-static void compile_application(const Node *expr, Linkage l)
+// Compute an argument of a call with the code from compile_arg_code.
+// The argument is passed by need only if the function asks for it (see
+// CompFnDesc), otherwise the thunk code is called right away.
+// Cheap arguments are always evaluated and variables are passed as they are.
+// If the argument is going to be bound right away (owned), the number
+// computed by a binary operation is only referenced by the env of the call.
+static void compile_arg(const Node *arg, int thunk, int fnoff, int field, int bit, int owned)
 {
 	int id = generate_id();
-	compile_dispatch(PairNode_left(expr), LinkNext);
-	if (forceable(PairNode_left(expr))) {
-		compile_force_call();
-	}
-	if (!typed) {
-		compile_type_assertion(CompfnObject);
+	if (arg->type == NumberNode) {
+		compile_num(arg);
+		return;
 	}
-	compile_stack_push(PTR_OBJ, REG_VAL);
-	if (lazy) {
-		printf("	jmp thunk_end%d\n", id);
-		printf("thunk%d:\n", id);
-		compile_stack_push(PTR_ADDR, REG_LINK);
-		compile_gc_call();
-		compile_dispatch(PairNode_right(expr), LinkReturn);
-		printf("thunk_end%d:\n", id);
-		printf("	mov gc(%%rip), %%rdi\n");
-		printf("	mov %s, %%rsi\n", REG_ENV);
-		printf("	lea thunk%d(%%rip), %%rdx\n", id);
-		printf("	call GC_alloc_compthunk\n");
+	if (arg->type == IdNode) {
+		compile_lookup(arg);
 		printf("	mov %%rax, %s\n", REG_VAL);
-	} else {
-		compile_dispatch(PairNode_right(expr), LinkNext);
+		printf("	cmpq $0, %%rax\n");
+		printf("	je arg_unbound%d\n", id);
+		printf("	movl $0, %ld(%s)\n", offsetof(Object, owned), REG_VAL);
+		printf("	jmp arg_end%d\n", id);
+		printf("arg_unbound%d:\n", id);
+		// an unbound variable is an error only if it's forced
+		compile_lazy_test(fnoff, field, bit);
+		printf("	je failure\n");
+		printf("	jmp thunk_alloc%d\n", id);
+	} else if (arg->type != FnNode) {
+		compile_lazy_test(fnoff, field, bit);
+		printf("	jne thunk_alloc%d\n", id);
 	}
-	compile_stack_pop(REG_TMP);
-	if (l == LinkNext) {
+	if (arg->type != IdNode) {
 		compile_stack_push(PTR_OBJ, REG_ENV);
+		printf("	lea thunk_ret%d(%%rip), %s\n", id, REG_LINK);
+		printf("	jmp thunk_body%d\n", thunk);
+		printf("thunk_ret%d:\n", id);
+		compile_stack_pop(REG_ENV);
+		if (owned && fresh(arg)) {
+			printf("	movl $1, %ld(%s)\n", offsetof(Object, owned), REG_VAL);
+		}
+		printf("	jmp arg_end%d\n", id);
 	}
-	printf("	mov %d(%s), %s\n", ObjFldOff(CompFn, env), REG_TMP, REG_ENV);
+	printf("thunk_alloc%d:\n", id);
+	printf("	mov gc(%%rip), %%rdi\n");
+	printf("	mov %s, %%rsi\n", REG_ENV);
+	printf("	lea thunk%d(%%rip), %%rdx\n", thunk);
+	printf("	call GC_alloc_compthunk\n");
+	printf("	mov %%rax, %s\n", REG_VAL);
+	printf("arg_end%d:\n", id);
+}
+
+// Jump to the code at the field of the object in REG_TMP (after
+// the env is set), the env is restored after the return
+static void compile_call(int id, const char *text, Linkage l)
+{
 	if (l == LinkNext) {
 		printf("	lea after_call%d(%%rip), %s\n", id, REG_LINK);
-		printf("	jmp *%d(%s)\n", ObjFldOff(CompFn, text), REG_TMP);
+		printf("	jmp *%s\n", text);
 		printf("after_call%d:\n", id);
 		compile_stack_pop(REG_ENV);
 	} else {
 		compile_stack_pop(REG_LINK);
-		printf("	jmp *%d(%s)\n", ObjFldOff(CompFn, text), REG_TMP);
+		printf("	jmp *%s\n", text);
+	}
+}
+
+// A call of a C function from ffi.c with all of its arguments calls it
+// right away while the name is bound to the builtin (the object is saved
+// in native<index> by main), the arguments are computed first since the
+// function is strict. Otherwise the call is made as any other call.
+// NOTE: the arguments are compiled between the start and the end
+static void compile_native_start(const Task *task)
+{
+	compile_lookup(task->callee);
+	printf("	cmp native%d(%%rip), %%rax\n", task->native);
+	printf("	jne generic%d\n", task->id);
+}
+
+static void compile_native_arg(const Node *arg)
+{
+	if (forceable(arg)) {
+		compile_force_call();
+	}
+	if (!typed) {
+		compile_number_assertion();
+	}
+	compile_stack_push(PTR_OBJ, REG_VAL);
+}
+
+static void compile_native_end(const Task *task)
+{
+	const BuiltinDesc *desc = Ffi_native(task->native);
+	int id = task->id;
+	for (int i = desc->arity - 1; i >= 0; i--) {
+		compile_stack_pop(REG_TMP);
+		printf("	movq %d(%s), %%xmm%d\n", ObjFldOff(Num, num), REG_TMP, i);
+		printf("	cmpl $%d, (%s)\n", IntObject, REG_TMP);
+		printf("	jne native_arg%d_%d\n", id, i);
+		printf("	cvtsi2sdq %d(%s), %%xmm%d\n", ObjFldOff(Int, num), REG_TMP, i);
+		printf("native_arg%d_%d:\n", id, i);
+	}
+	printf("	call %s\n", desc->name);
+	printf("	mov gc(%%rip), %%rdi\n");
+	printf("	call GC_alloc_number\n");
+	printf("	mov %%rax, %s\n", REG_VAL);
+	if (task->link == LinkReturn) {
+		compile_ret();
+	} else {
+		printf("	jmp call_end%d\n", id);
+	}
+	printf("generic%d:\n", id);
+}
+
+// The function and the arguments of the application spine ('f x y z')
+static void compile_spine(Task *task)
+{
+	task->id = generate_id();
+	const Node *fn = task->expr;
+	int count = 0;
+	for (; fn->type == ApplNode; fn = PairNode_left(fn)) {
+		count += 1;
+	}
+	task->callee = fn;
+	task->count = count;
+	task->args = malloc(count * sizeof(*task->args));
+	task->thunks = malloc(count * sizeof(*task->thunks));
+	const Node *expr = task->expr;
+	for (int i = count - 1; i >= 0; i--) {
+		task->args[i] = PairNode_right(expr);
+		expr = PairNode_left(expr);
+	}
+	int native = fn->type == IdNode ? Ffi_find(IdNode_value(fn)) : -1;
+	if (native >= 0 && Ffi_native(native)->arity == count) {
+		task->native = native;
+	}
+}
+
+// The call itself, once the function and the code of the arguments are compiled
+static void compile_call_spine(const Task *task)
+{
+	Linkage l = task->link;
+	int id = task->id;
+	int tail = l == LinkReturn && ApplNode_tail(task->expr);
+	int count = task->count;
+	const Node **args = task->args;
+	const int *thunks = task->thunks;
+	compile_stack_push(PTR_OBJ, REG_VAL);
+	if ((count > 1 || tail) && count <= MAX_CALL_ARGS) {
+		printf("	mov %d(%s), %s\n", ObjFldOff(CompFn, desc), REG_VAL, REG_TMP);
+		printf("	cmpl $%d, %ld(%s)\n", count, offsetof(CompFnDesc, arity), REG_TMP);
+		printf("	jne curried%d\n", id);
+		for (int i = 0; i < count; i++) {
+			compile_arg(args[i], thunks[i], 8 + 16*i, offsetof(CompFnDesc, saturated), 1 << i, 1);
+			compile_stack_push(PTR_OBJ, REG_VAL);
+		}
+		printf("	mov gc(%%rip), %%rdi\n");
+		printf("	mov %d(%%rsp), %%rsi\n", 8 + 16*count);
+		printf("	mov %%rsp, %%rdx\n");
+		printf("	mov $%d, %%ecx\n", count);
+		if (tail) {
+			printf("	mov %s, %%r8\n", REG_ENV);
+			printf("	call GC_alloc_tailenv\n");
+		} else {
+			printf("	call GC_alloc_callenv\n");
+		}
+		printf("	add $%d, %%rsp\n", 16*count);
+		compile_stack_pop(REG_TMP);
+		if (l == LinkNext) {
+			compile_stack_push(PTR_OBJ, REG_ENV);
+		}
+		printf("	mov %%rax, %s\n", REG_ENV);
+		printf("	mov %d(%s), %s\n", ObjFldOff(CompFn, desc), REG_TMP, REG_TMP);
+		printf("	mov %ld(%s), %s\n", offsetof(CompFnDesc, body), REG_TMP, REG_TMP);
+		compile_call(generate_id(), REG_TMP, l);
+		if (l == LinkNext) {
+			printf("	jmp call_end%d\n", id);
+		}
+		printf("curried%d:\n", id);
+	}
+	for (int i = 0; i < count; i++) {
+		Linkage link = i == count - 1 ? l : LinkNext;
+		compile_arg(args[i], thunks[i], 8, offsetof(CompFnDesc, lazy), 1, 0);
+		compile_stack_pop(REG_TMP);
+		if (link == LinkNext) {
+			compile_stack_push(PTR_OBJ, REG_ENV);
+		}
+		printf("	mov %d(%s), %s\n", ObjFldOff(CompFn, env), REG_TMP, REG_ENV);
+		printf("	mov %d(%s), %s\n", ObjFldOff(CompFn, text), REG_TMP, REG_TMP);
+		compile_call(generate_id(), REG_TMP, link);
+		if (i < count - 1) {
+			compile_force_call();
+			if (!typed) {
+				compile_type_assertion(CompfnObject);
+			}
+			compile_stack_push(PTR_OBJ, REG_VAL);
+		}
+	}
+	printf("call_end%d:\n", id);
+}
+
+// If the function takes exactly as many arguments as there are in the
+// application spine ('f x y z'), they are all bound in one env and the
+// innermost body is called right away. Otherwise the function is
+// applied to the arguments one by one. A tail call binds the arguments
+// in the env of the caller if it can (see GC_alloc_tailenv), so a tail
+// recursive function runs as a loop that doesn't allocate envs.
+// NOTE: the steps are the start, the arguments of the native call,
+// the function and the code of the arguments
+static void compile_application(Task *task)
+{
+	switch (task->step) {
+		case 0:
+			compile_spine(task);
+			if (task->native >= 0) {
+				compile_native_start(task);
+				task->step = 1;
+				return compile_child(task->args[0], LinkNext);
+			}
+			task->step = 2;
+			return compile_child(task->callee, LinkNext);
+		case 1:
+			compile_native_arg(task->args[task->index]);
+			task->index += 1;
+			if (task->index < Ffi_native(task->native)->arity) {
+				return compile_child(task->args[task->index], LinkNext);
+			}
+			compile_native_end(task);
+			task->step = 2;
+			return compile_child(task->callee, LinkNext);
+		case 2:
+			if (forceable(task->callee)) {
+				compile_force_call();
+			}
+			if (!typed) {
+				compile_type_assertion(CompfnObject);
+			}
+			task->index = 0;
+			break;
+		case 3:
+			printf("thunk_end%d:\n", task->thunks[task->index]);
+			task->index += 1;
+			break;
 	}
+	for (; task->index < task->count; task->index++) {
+		const Node *arg = task->args[task->index];
+		int id = generate_id();
+		task->thunks[task->index] = id;
+		if (arg->type != NumberNode) {
+			compile_arg_code(id);
+			task->step = 3;
+			return compile_child(arg, LinkReturn);
+		}
+	}
+	compile_call_spine(task);
+	free(task->args);
+	free(task->thunks);
+	return compile_finish(task);
 }
 
-static void compile_let(const Node *expr)
+// NOTE: in the lazy mode nothing forces the value, so it's bound by need
+// (as a thunk) unless it's trivial, see eval.c
+static void compile_let(Task *task)
 {
+	const Node *expr = task->expr;
+	const Node *value = LetNode_value(expr);
+	int thunk = lazy && value->type != NumberNode && value->type != FnNode && value->type != IdNode;
+	if (task->step++) {
+		if (thunk) {
+			printf("thunk_end%d:\n", task->index);
+			printf("	mov gc(%%rip), %%rdi\n");
+			printf("	mov %s, %%rsi\n", REG_ENV);
+			printf("	lea thunk%d(%%rip), %%rdx\n", task->index);
+			printf("	call GC_alloc_compthunk\n");
+			printf("	mov %%rax, %s\n", REG_VAL);
+		}
+		if (memoize) {
+			printf("	call Memo_flush\n");
+		}
+		printf("	lea %d(%s), %%rdi\n", ObjValOff(Env), REG_ENV);
+		printf("	lea i%d(%%rip), %%rsi\n", task->id);
+		printf("	mov %s, %%rdx\n", REG_VAL);
+		printf("	call Env_add\n");
+		return compile_finish(task);
+	}
 	int id = generate_id();
+	task->id = id;
 	printf(".data\n");
 	printf("i%d: .asciz \"%s\"\n", id, LetNode_name_value(expr));
 	printf(".text\n");
-	compile_dispatch(LetNode_value(expr), LinkNext);
-	printf("	lea %d(%s), %%rdi\n", ObjValOff(Env), REG_ENV);
-	printf("	lea i%d(%%rip), %%rsi\n", id);
-	printf("	mov %s, %%rdx\n", REG_VAL);
-	printf("	call Env_add\n");
+	if (memoize && value->type == FnNode && compile_memoizable(value)) {
+		// the closure is global, so it can be memoized
+		compile_comment(value);
+		return compile_push(FnTask, value, LinkNext, 0, 0, 1);
+	}
+	if (thunk) {
+		task->index = generate_id();
+		compile_arg_code(task->index);
+		return compile_child(value, LinkReturn);
+	}
+	return compile_child(value, LinkNext);
 }
 
+// NOTE: the unordered comparisons (NAN) are false
 static void compile_cmp_pair(int op)
 {
-	int id = generate_id();
-	printf("	comisd %%xmm1, %%xmm0\n");
-	printf("	jp cmp_false%d\n", id); /* NAN */
 	switch (op) {
 		case '>':
-			printf("	jbe cmp_false%d\n", id);
+			printf("	comisd %%xmm1, %%xmm0\n");
+			printf("	seta %%al\n");
 			break;
 		case '<':
-			printf("	jae cmp_false%d\n", id);
+			printf("	comisd %%xmm0, %%xmm1\n");
+			printf("	seta %%al\n");
 			break;
 		case '=':
-			printf("	jne cmp_false%d\n", id);
+			printf("	comisd %%xmm1, %%xmm0\n");
+			printf("	sete %%al\n");
+			printf("	setnp %%cl\n");
+			printf("	and %%cl, %%al\n");
 			break;
 	}
-	printf("	movq true(%%rip), %%xmm0\n");
-	printf("	jmp cmp_end%d\n", id);
-	printf("cmp_false%d:\n", id);
-	printf("	movq false(%%rip), %%xmm0\n");
-	printf("cmp_end%d:\n", id);
+	printf("	movzbq %%al, %%rsi\n");
 }
 
-static void compile_pair(const Node *expr)
+// The operation on two integers in %rax and %rcx, the result is left
+// in %rax. Anything that overflows (or has no exact result) jumps to the
+// slow path. Returns 0 if the result is a double in %xmm0.
+static int compile_int_pair(int op, int id)
 {
-	int op = PairNode_op(expr);
-	compile_dispatch(PairNode_left(expr), LinkNext);
-	if (forceable(PairNode_left(expr))) {
-		compile_force_call();
-	}
-	if (!typed) {
-		compile_type_assertion(NumObject);
-	}
-	compile_stack_push(PTR_OBJ, REG_VAL);
-	compile_dispatch(PairNode_right(expr), LinkNext);
-	if (forceable(PairNode_right(expr))) {
-		compile_force_call();
-	}
-	if (!typed) {
-		compile_type_assertion(NumObject);
+	switch (op) {
+		case '^':
+			// the power by squaring, the exponent can't be negative
+			printf("	cmp $0, %%rcx\n");
+			printf("	jl pair_slow%d\n", id);
+			printf("	mov $1, %%rdx\n");
+			printf("	test %%rcx, %%rcx\n");
+			printf("	jz pow_end%d\n", id);
+			printf("pow_loop%d:\n", id);
+			printf("	test $1, %%rcx\n");
+			printf("	jz pow_square%d\n", id);
+			printf("	imul %%rax, %%rdx\n");
+			printf("	jo pair_slow%d\n", id);
+			printf("pow_square%d:\n", id);
+			printf("	shr %%rcx\n");
+			printf("	jz pow_end%d\n", id);
+			printf("	imul %%rax, %%rax\n");
+			printf("	jo pair_slow%d\n", id);
+			printf("	jmp pow_loop%d\n", id);
+			printf("pow_end%d:\n", id);
+			printf("	mov %%rdx, %%rax\n");
+			return 1;
+		case '*':
+			printf("	imul %%rcx, %%rax\n");
+			printf("	jo pair_slow%d\n", id);
+			return 1;
+		case '/':
+			printf("	cvtsi2sdq %%rax, %%xmm0\n");
+			printf("	cvtsi2sdq %%rcx, %%xmm1\n");
+			printf("	divsd %%xmm1, %%xmm0\n");
+			return 0;
+		case '%':
+			// NOTE: the division by -1 may overflow
+			printf("	lea 1(%%rcx), %%rdx\n");
+			printf("	cmp $1, %%rdx\n");
+			printf("	jbe pair_slow%d\n", id);
+			printf("	cqo\n");
+			printf("	idiv %%rcx\n");
+			printf("	mov %%rdx, %%rax\n");
+			return 1;
+		case '+':
+			printf("	add %%rcx, %%rax\n");
+			printf("	jo pair_slow%d\n", id);
+			return 1;
+		case '-':
+			printf("	sub %%rcx, %%rax\n");
+			printf("	jo pair_slow%d\n", id);
+			return 1;
+		case '>':
+		case '<':
+		case '=':
+			printf("	cmp %%rcx, %%rax\n");
+			printf("	set%s %%al\n", op == '>' ? "g" : op == '<' ? "l" : "e");
+			printf("	movzbq %%al, %%rax\n");
+			return 1;
 	}
-	compile_stack_pop(REG_TMP);
-	printf("	movq %d(%s), %%xmm0\n", ObjFldOff(Num, num), REG_TMP);
-	printf("	movq %d(%s), %%xmm1\n", ObjFldOff(Num, num), REG_VAL);
+	return 1;
+}
+
+static void compile_float_pair(int op)
+{
 	switch (op) {
 		case '^':
 			printf("	call pow\n");
@@ -324,99 +931,235 @@ static void compile_pair(const Node *expr)
 		case '-':
 			printf("	subsd %%xmm1, %%xmm0\n");
 			break;
-		case '>':
-		case '<':
-		case '=':
-			compile_cmp_pair(op);
-			break;
-		default:
-			errorf("unknown binary operation: '%c'", op);
-			return;
 	}
-	printf("	mov gc(%%rip), %%rdi\n");
-	printf("	call GC_alloc_number\n");
-	printf("	mov %%rax, %s\n", REG_VAL);
 }
 
-static void compile_and(const Node *expr, Linkage l)
+// Two integers or two doubles are handled inline, anything else (the mixed
+// operands, the overflows and the type errors) goes through GC_alloc_op.
+// NOTE: the tags are checked in the typed mode as well, since both
+// of the representations have the same type.
+static void compile_pair(Task *task)
 {
-	int id = generate_id();
-	compile_dispatch(PairNode_left(expr), LinkNext);
-	if (forceable(PairNode_left(expr))) {
+	const Node *expr = task->expr;
+	int op = PairNode_op(expr);
+	int id = task->id;
+	switch (task->step++) {
+		case 0:
+			id = task->id = generate_id();
+			if (!strchr("^*/%+-><=", op)) {
+				errorf("unknown binary operation: '%c'", op);
+				return compile_finish(task);
+			}
+			if (PairNode_left(expr)->type != IdNode) {
+				return compile_child(PairNode_left(expr), LinkNext);
+			}
+			compile_operand(PairNode_left(expr));
+			task->step++;
+			// fallthrough
+		case 1:
+			if (forceable(PairNode_left(expr))) {
+				compile_force_call();
+			}
+			compile_stack_push(PTR_OBJ, REG_VAL);
+			if (PairNode_right(expr)->type != IdNode) {
+				return compile_child(PairNode_right(expr), LinkNext);
+			}
+			compile_operand(PairNode_right(expr));
+	}
+	if (forceable(PairNode_right(expr))) {
 		compile_force_call();
 	}
-	if (!typed) {
-		compile_type_assertion(NumObject);
+	compile_stack_pop(REG_TMP);
+	printf("	cmpl $%d, (%s)\n", IntObject, REG_TMP);
+	printf("	jne pair_float%d\n", id);
+	printf("	cmpl $%d, (%s)\n", IntObject, REG_VAL);
+	printf("	jne pair_slow%d\n", id);
+	printf("	mov %d(%s), %%rax\n", ObjFldOff(Int, num), REG_TMP);
+	printf("	mov %d(%s), %%rcx\n", ObjFldOff(Int, num), REG_VAL);
+	if (compile_int_pair(op, id)) {
+		printf("	mov %%rax, %%rsi\n");
+		printf("	jmp pair_int%d\n", id);
+	} else {
+		printf("	jmp pair_double%d\n", id);
+	}
+	printf("pair_float%d:\n", id);
+	printf("	cmpl $%d, (%s)\n", NumObject, REG_TMP);
+	printf("	jne pair_slow%d\n", id);
+	printf("	cmpl $%d, (%s)\n", NumObject, REG_VAL);
+	printf("	jne pair_slow%d\n", id);
+	printf("	movq %d(%s), %%xmm0\n", ObjFldOff(Num, num), REG_TMP);
+	printf("	movq %d(%s), %%xmm1\n", ObjFldOff(Num, num), REG_VAL);
+	if (strchr("><=", op)) {
+		compile_cmp_pair(op);
+	} else {
+		compile_float_pair(op);
+		printf("pair_double%d:\n", id);
+		printf("	mov gc(%%rip), %%rdi\n");
+		printf("	call GC_alloc_number\n");
+		printf("	jmp pair_end%d\n", id);
+	}
+	printf("pair_int%d:\n", id);
+	if (strchr("><=", op)) {
+		// the results of the comparisons are not allocated, see compile_begin
+		printf("	lea false_num(%%rip), %%rax\n");
+		printf("	lea true_num(%%rip), %%rcx\n");
+		printf("	test %%rsi, %%rsi\n");
+		printf("	cmovne %%rcx, %%rax\n");
+	} else {
+		printf("	mov gc(%%rip), %%rdi\n");
+		printf("	call GC_alloc_int\n");
+	}
+	printf("	jmp pair_end%d\n", id);
+	printf("pair_slow%d:\n", id);
+	printf("	mov gc(%%rip), %%rdi\n");
+	printf("	mov $%d, %%esi\n", op);
+	printf("	mov %s, %%rdx\n", REG_TMP);
+	printf("	mov %s, %%rcx\n", REG_VAL);
+	printf("	call GC_alloc_op\n");
+	printf("	cmpq $0, %%rax\n");
+	printf("	je failure\n");
+	printf("pair_end%d:\n", id);
+	printf("	mov %%rax, %s\n", REG_VAL);
+	return compile_finish(task);
+}
+
+static void compile_and(Task *task)
+{
+	const Node *expr = task->expr;
+	int id = task->id;
+	switch (task->step++) {
+		case 0:
+			task->id = generate_id();
+			return compile_child(PairNode_left(expr), LinkNext);
+		case 1:
+			if (forceable(PairNode_left(expr))) {
+				compile_force_call();
+			}
+			if (!typed) {
+				compile_number_assertion();
+			}
+			printf("	cmpq $0, %d(%s)\n", ObjFldOff(Num, num), REG_VAL);
+			printf("	je and_false%d\n", id);
+			return compile_child(PairNode_right(expr), task->link);
 	}
-	printf("	cmpq $0, %d(%s)\n", ObjFldOff(Num, num), REG_VAL);
-	printf("	je and_false%d\n", id);
-	compile_dispatch(PairNode_right(expr), l);
 	printf("and_false%d:\n", id);
-	if (l == LinkReturn) {
+	if (task->link == LinkReturn) {
 		compile_ret();
 	}
+	return compile_finish(task);
 }
 
-static void compile_or(const Node *expr, Linkage l)
+static void compile_or(Task *task)
 {
-	int id = generate_id();
-	compile_dispatch(PairNode_left(expr), LinkNext);
-	if (forceable(PairNode_left(expr))) {
-		compile_force_call();
+	const Node *expr = task->expr;
+	int id = task->id;
+	switch (task->step++) {
+		case 0:
+			task->id = generate_id();
+			return compile_child(PairNode_left(expr), LinkNext);
+		case 1:
+			if (forceable(PairNode_left(expr))) {
+				compile_force_call();
+			}
+			if (!typed) {
+				compile_number_assertion();
+			}
+			printf("	cmpq $0, %d(%s)\n", ObjFldOff(Num, num), REG_VAL);
+			printf("	jne or_true%d\n", id); // ????
+			return compile_child(PairNode_right(expr), task->link);
 	}
-	if (!typed) {
-		compile_type_assertion(NumObject);
-	}
-	printf("	cmpq $0, %d(%s)\n", ObjFldOff(Num, num), REG_VAL);
-	printf("	jne or_true%d\n", id); // ????
-	compile_dispatch(PairNode_right(expr), l);
 	printf("or_true%d:\n", id);
-	if (l == LinkReturn) {
+	if (task->link == LinkReturn) {
 		compile_ret();
 	}
+	return compile_finish(task);
 }
 
-static void compile_dispatch(const Node *expr, Linkage l)
+// The inlined code is used while the global env has the same version
+static void compile_guard(Task *task)
 {
-	printf("// "); Node_println(expr);
+	const Node *expr = task->expr;
+	int id = task->id;
+	switch (task->step++) {
+		case 0:
+			task->id = generate_id();
+			printf("	mov env(%%rip), %s\n", REG_TMP);
+			printf("	cmpl $%u, %d(%s)\n", GuardNode_version(expr), ObjFldOff(Env, version), REG_TMP);
+			printf("	jne guard_fail%d\n", task->id);
+			return compile_child(GuardNode_inlined(expr), task->link);
+		case 1:
+			printf("	jmp guard_end%d\n", id);
+			printf("guard_fail%d:\n", id);
+			return compile_child(GuardNode_original(expr), task->link);
+	}
+	printf("guard_end%d:\n", id);
+	return compile_finish(task);
+}
+
+static void compile_dispatch(Task *task)
+{
+	const Node *expr = task->expr;
+	if (task->step == 0) {
+		compile_comment(expr);
+	}
 	switch (expr->type) {
 		case NumberNode:
 			compile_num(expr);
-			break;
+			return compile_finish(task);
 		case FnNode:
-			compile_fn(expr);
-			break;
+			if (task->step++) {
+				return compile_finish(task);
+			}
+			return compile_push(FnTask, expr, LinkNext, 0, 0, 0);
 		case IdNode:
 			compile_id(expr);
-			break;
+			return compile_finish(task);
 		case ExptNode:
 		case ProdNode:
 		case SumNode:
 		case CmpNode:
-			compile_pair(expr);
-			break;
+		case NumAddNode:
+		case NumSubNode:
+		case NumMulNode:
+		case NumDivNode:
+		case NumModNode:
+		case NumPowNode:
+		case NumGtNode:
+		case NumLtNode:
+		case NumEqNode:
+			return compile_pair(task);
 		case AndNode:
-			return compile_and(expr, l);
+			return compile_and(task);
 		case OrNode:
-			return compile_or(expr, l);
+			return compile_or(task);
 		case IfNode:
-			return compile_if(expr, l);
+			return compile_if(task);
 		case ApplNode:
-			return compile_application(expr, l);
+			return compile_application(task);
+		case GuardNode:
+			return compile_guard(task);
 		case LetNode:
-			compile_let(expr);
-			break;
-	}
-	// NOTE: AndNode, OrNode, IfNode and ApplNode
-	// must handle linkage themselves
-	if (l == LinkReturn) {
-		compile_ret();
+			return compile_let(task);
 	}
 }
 
 void compile(const Node *expr)
 {
-	compile_dispatch(expr, LinkNext);
+	compile_child(expr, LinkNext);
+	while (!Worklist_empty(&tasks)) {
+		Task *task = Worklist_top(&tasks);
+		switch (task->kind) {
+			case NodeTask:
+				compile_dispatch(task);
+				break;
+			case FnTask:
+				compile_fn(task);
+				break;
+			case MemoTask:
+				compile_memo_body(task);
+				break;
+		}
+	}
 	if (forceable(expr)) {
 		compile_force_call();
 	}
@@ -427,16 +1170,96 @@ void compile(const Node *expr)
 	compile_gc_call();
 }
 
+// The builtins that compiled code can call (see Builtin_compiled) are
+// compiled functions with nested functions for all of the parameters.
+// Their body calls the builtin with Builtin_call_comp and returns its result.
+static void compile_builtin(int index, const BuiltinDesc *desc)
+{
+	printf(".data\n");
+	printf("builtin%d: .asciz \"%s\"\n", index, desc->name);
+	printf("	.balign 8\n");
+	for (int i = 0; i < desc->arity; i++) {
+		int rest = desc->arity - i;
+		printf("bd%d_%d:\n", index, i);
+		printf("	.long %d, %d, %d, 0\n", rest, lazy, lazy ? (1 << rest) - 1 : 0);
+		printf("	.quad builtin_body%d, Builtin_params+%d\n", index, 8*i);
+	}
+	printf(".text\n");
+	for (int i = 0; i < desc->arity; i++) {
+		printf("bfn%d_%d:\n", index, i);
+		printf("	mov gc(%%rip), %%rdi\n");
+		printf("	mov %s, %%rsi\n", REG_ENV);
+		printf("	call GC_alloc_env\n");
+		printf("	mov %%rax, %s\n", REG_ENV);
+		printf("	lea %d(%%rax), %%rdi\n", ObjValOff(Env));
+		printf("	mov Builtin_params+%d(%%rip), %%rsi\n", 8*i);
+		printf("	mov %s, %%rdx\n", REG_VAL);
+		printf("	call Env_add\n");
+		if (i < desc->arity - 1) {
+			printf("	mov gc(%%rip), %%rdi\n");
+			printf("	mov %s, %%rsi\n", REG_ENV);
+			printf("	lea bfn%d_%d(%%rip), %%rdx\n", index, i + 1);
+			printf("	lea bd%d_%d(%%rip), %%rcx\n", index, i + 1);
+			printf("	call GC_alloc_compfn\n");
+			printf("	mov %%rax, %s\n", REG_VAL);
+			printf("	jmp *%s\n", REG_LINK);
+		}
+	}
+	printf("builtin_body%d:\n", index);
+	compile_gc_call();
+	compile_stack_push(PTR_ADDR, REG_LINK);
+	compile_stack_push(PTR_OBJ, REG_ENV);
+	printf("	mov gc(%%rip), %%rdi\n");
+	printf("	mov $%d, %%esi\n", index);
+	printf("	mov %s, %%rdx\n", REG_ENV);
+	printf("	mov %%rsp, %%rcx\n");
+	printf("	mov %%rbp, %%r8\n");
+	printf("	call Builtin_call_comp\n");
+	printf("	cmpq $0, %%rax\n");
+	printf("	je failure\n");
+	printf("	mov %%rax, %s\n", REG_VAL);
+	compile_stack_pop(REG_ENV);
+	compile_ret();
+}
+
+static void compile_bind_builtin(int index)
+{
+	printf("	mov gc(%%rip), %%rdi\n");
+	printf("	mov %s, %%rsi\n", REG_ENV);
+	printf("	lea bfn%d_0(%%rip), %%rdx\n", index);
+	printf("	lea bd%d_0(%%rip), %%rcx\n", index);
+	printf("	call GC_alloc_compfn\n");
+	printf("	mov %%rax, %s\n", REG_VAL);
+	printf("	lea %d(%s), %%rdi\n", ObjValOff(Env), REG_ENV);
+	printf("	lea builtin%d(%%rip), %%rsi\n", index);
+	printf("	mov %s, %%rdx\n", REG_VAL);
+	printf("	call Env_add\n");
+	int native = Ffi_find(Builtin_compiled(index)->name);
+	if (native >= 0) {
+		// NOTE: protected, so the address can't be reused by another object
+		printf("	mov %s, native%d(%%rip)\n", REG_VAL, native);
+		printf("	mov gc(%%rip), %%rdi\n");
+		printf("	mov %s, %%rsi\n", REG_VAL);
+		printf("	call GC_protect\n");
+	}
+}
+
 void compile_begin(void)
 {
 	printf(".global main\n");
 	printf(".data\n");
 	printf("gc: .quad 0\n");
 	printf("env: .quad 0\n");
-	printf("true:  .double 1.0\n");
-	printf("false: .double 0.0\n");
+	for (int i = 0; Ffi_native(i); i++) {
+		printf("native%d: .quad 0\n", i);
+	}
 	printf(".text\n");
+	compile_static_num("false_num", Number_int(0));
+	compile_static_num("true_num", Number_int(1));
 	compile_force_sub();
+	for (int i = 0; Builtin_compiled(i); i++) {
+		compile_builtin(i, Builtin_compiled(i));
+	}
 	printf("main:\n");
 	printf("	push %%rbp\n");
 	printf("	mov %%rsp, %%rbp\n");
@@ -447,10 +1270,23 @@ void compile_begin(void)
 	printf("	call GC_alloc_env\n");
 	printf("	mov %%rax, env(%%rip)\n");
 	printf("	mov env(%%rip), %s\n", REG_ENV);
+	printf("	lea force(%%rip), %%rax\n");
+	printf("	mov %%rax, Callback_force_text(%%rip)\n");
+	for (int i = 0; Builtin_compiled(i); i++) {
+		compile_bind_builtin(i);
+	}
 }
 
 void compile_end(void)
 {
+	Worklist_destroy(&tasks);
+	if (debug && memoize) {
+		printf("	call Memo_print_stats\n");
+	}
+	if (debug) {
+		printf("	mov gc(%%rip), %%rdi\n");
+		printf("	call GC_print_stats\n");
+	}
 	printf("	mov gc(%%rip), %%rdi\n");
 	printf("	mov $0, %%rsi\n");
 	printf("	mov $0, %%rdx\n");
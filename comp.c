@@ -6,26 +6,44 @@
 #include "infer.h"
 #include "types.h"
 #include "arena.h"
+#include "strict.h"
 #include "codegen.h"
 #include "opts.h"
+#include "opt.h"
+#include "builtin.h"
 
 
 #define TMP_ARENA_PAGE_SIZE 4096
 
 // TODO: proper error handling
 
+// NOTE: returns whether a global is redefined
+static int run(Node *ast)
+{
+	strictness(ast);
+	Node_mark_tail_calls(ast);
+	compile(ast);
+	if ((inlining || optimization) && ast->type == LetNode) {
+		return optimize_define(LetNode_name_value(ast), LetNode_value(ast));
+	}
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	if (!parse_args(argc, argv)) {
 		return 1;
 	}
-	Scanner scanner = Scanner_make(stdin);
+	Scanner scanner = Scanner_make(input);
 	Arena tmp = Arena_make(TMP_ARENA_PAGE_SIZE);
 	TypeEnv *tenv = TYPEENV_EMPTY;
+	Builtin_declare_compiled(&tenv);
+	// the version the global env will have at runtime, see GuardNode
+	unsigned version = 0;
 	compile_begin();
 	while (!Scanner_eof(scanner)) {
 		Arena_reset(&tmp);
-		Node *ast = parse(&scanner, &tmp);
+		Node *ast = parse(&scanner);
 		if (!ast) {
 			continue;
 		}
@@ -35,7 +53,14 @@ int main(int argc, char **argv)
 				break;
 			}
 		}
-		compile(ast);
+		ast = optimize(ast, version, &tmp);
+		for (Node *let; (let = optimize_lifted(version));) {
+			version += run(let);
+		}
+		version += run(ast);
+	}
+	if (debug && (inlining || optimization)) {
+		optimize_print_stats();
 	}
 	compile_end();
 	Scanner_destroy(scanner);
@@ -5,15 +5,15 @@
 #include "gc.h"
 #include "types.h"
 
-typedef struct {
+typedef struct Context Context;
+
+struct Context {
 	GC      *gc;
 	Object  *root;
 	Object  *stack;
-} Context;
+};
 
 #define Context_stack(ctx) (StackObj_stack((ctx)->stack))
-#define Context_stack_push(ctx, v) (Stack_push(Context_stack(ctx), (v)))
-#define Context_stack_pop(ctx) (Stack_pop(Context_stack(ctx)))
 
 Context Context_make(void);
 void    Context_destroy(Context self);
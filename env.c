@@ -8,17 +8,24 @@
 
 
 struct Binding {
-	Object  *obj;
-	char    *key;
-	Binding *next;
+	Object     *obj;
+	const char *key;
+	Binding    *next;
 };
 
 #define INITIAL_TABLE_SIZE 512
+// function call environments usually hold just a couple of bindings
+#define FRAME_TABLE_SIZE 8
 
-static Binding *Binding_new(const char *key, Object *obj)
+static Binding *Binding_new(Env *env, const char *key, Object *obj)
 {
-	Binding *entry = malloc(sizeof(*entry));
-	entry->key = strdup(key);
+	Binding *entry = env->unused;
+	if (entry) {
+		env->unused = entry->next;
+	} else {
+		entry = malloc(sizeof(*entry));
+	}
+	entry->key = key;
 	entry->obj = obj;
 	entry->next = NULL;
 	return entry;
@@ -26,7 +33,6 @@ static Binding *Binding_new(const char *key, Object *obj)
 
 static void Binding_drop(Binding *self)
 {
-	free(self->key);
 	free(self);
 }
 
@@ -42,14 +48,17 @@ static unsigned long dbj2_hash(const char *str)
 Env *Env_new(Object *prev)
 {
 	Env *self = malloc(sizeof(*self));
-	self->entries = calloc(INITIAL_TABLE_SIZE, sizeof(Binding));
-	self->size = INITIAL_TABLE_SIZE;
+	self->size = prev ? FRAME_TABLE_SIZE : INITIAL_TABLE_SIZE;
+	self->entries = calloc(self->size, sizeof(Binding));
+	self->unused = NULL;
 	self->taken = 0;
+	self->version = 0;
+	self->captured = 0;
 	self->prev = prev;
 	return self;
 }
 
-void Env_drop(Env *self)
+static void Env_drop_bindings(Env *self)
 {
 	for (int i = 0; i < self->size; i++) {
 		Binding *head = self->entries[i];
@@ -58,11 +67,40 @@ void Env_drop(Env *self)
 			Binding_drop(head);
 			head = next;
 		}
+		self->entries[i] = NULL;
+	}
+}
+
+void Env_drop(Env *self)
+{
+	Env_drop_bindings(self);
+	while (self->unused) {
+		Binding *next = self->unused->next;
+		Binding_drop(self->unused);
+		self->unused = next;
 	}
 	free(self->entries);
 	free(self);
 }
 
+// Make the env empty, so it can be reused for another call (see GC_alloc_tailenv)
+// NOTE: the bindings are kept for the next call
+void Env_clear(Env *self)
+{
+	for (int i = 0; i < self->size; i++) {
+		Binding *head = self->entries[i];
+		while (head) {
+			Binding *next = head->next;
+			head->next = self->unused;
+			self->unused = head;
+			head = next;
+		}
+		self->entries[i] = NULL;
+	}
+	self->taken = 0;
+	self->captured = 0;
+}
+
 static void Env_resize(Env *self, int new_size)
 {
 	Binding **old_entries = self->entries;
@@ -101,8 +139,9 @@ void Env_add(Env *self, const char *key, Object *obj)
 	Binding **indirect = find_entry(self, key);
 	if (*indirect) {
 		(*indirect)->obj = obj;
+		self->version += 1;
 	} else {
-		*indirect = Binding_new(key, obj);
+		*indirect = Binding_new(self, key, obj);
 		self->taken += 1;
 	}
 	if (self->taken > self->size / 2) {
@@ -8,19 +8,26 @@ typedef struct Binding Binding;
 typedef struct Env Env;
 
 struct Env {
-	Binding **entries;
-	int     size;
-	int     taken;
-	Object  *prev;
-	Object  handle;
+	Binding  **entries;
+	Binding  *unused;  // the bindings of a cleared env, reused by Env_add
+	int      size;
+	int      taken;
+	unsigned version;  // incremented when a binding is overwritten, see GuardNode
+	int      captured; // referenced by a closure, a thunk or another env
+	Object   *prev;
+	Object   handle;
 };
 
 #define EnvObj_env(objptr) (ObjToVal(objptr, Env))
 #define EnvObj_prev(objptr) (ObjToVal(objptr, Env)->prev)
+#define EnvObj_version(objptr) (ObjToVal(objptr, Env)->version)
+#define EnvObj_captured(objptr) (ObjToVal(objptr, Env)->captured)
 
 // NOTE: Env_add overwrites the existing value!
+// NOTE: keys are not copied, they must outlive the env (they usually come from the AST)
 Env     *Env_new(Object *prev);
 void    Env_drop(Env *self);
+void    Env_clear(Env *self);
 void    Env_add(Env *self, const char *key, Object *obj);
 Object  *Env_remove(Env *self, const char *key);
 Object  *Env_get(const Env *self, const char *key);
@@ -10,26 +10,45 @@
 #include "env.h"
 #include "stack.h"
 #include "context.h"
+#include "memo.h"
+#include "opt.h"
 #include "error.h"
+#include "callback.h"
 
 
 #define ERROR_PREFIX "evaluation error"
 
-static Object *eval_dispatch(const Node *expr, Context *ctx, Object *env);
-static Object *actual_value(const Node *expr, Context *ctx, Object *env);
+// The evaluator is a CEK-style machine. The control is either an expression
+// that is evaluated in an environment or a value that is returned to the
+// topmost frame of the continuation stack (ctx->stack). The machine never
+// recurses in C, so the evaluation depth is only limited by the heap.
 
-static inline Object *eval_expect(const Node *expr, Context *ctx, Object *env, ObjectType type)
-{
-	Object *obj = actual_value(expr, ctx, env);
-	if (!obj) {
-		return NULL;
-	}
-	if (obj->type != type) {
-		error("type mismatch");
-		return NULL;
-	}
-	return obj;
-}
+// NOTE: the order matters, see FRAME_FORCES and FRAME_NUMERIC
+typedef enum {
+	ApplArgFrame,   // bind the value and the rest of the arguments of a call
+	TailArgFrame,   // the same for a tail call, see eval_recycle
+	BuiltinArgFrame, // bind the value and the rest of the arguments of a builtin
+	LetFrame,       // bind the value in the global environment
+	MemoFrame,      // remember the result of a call, see eval_memo
+	SpecFrame,      // specialize a partial application, see eval_specialize
+	ForceFrame,     // just force the value
+	UpdateFrame,    // store the value into the blackholed thunk stored in the frame
+	ApplFnFrame,    // call the value with the arguments of the application spine
+	PairLeftFrame,  // evaluate the right operand of a binary operation
+	PairRightFrame, // apply the binary operation
+	AndFrame,
+	OrFrame,
+	NumFrame,       // check that the value is a number
+	IfFrame,
+} FrameKind;
+
+// frames that need a value that is not a thunk
+#define FRAME_FORCES(frame) ((frame)->kind >= ForceFrame)
+// frames that need a number
+#define FRAME_NUMERIC(frame) ((frame)->kind >= PairLeftFrame)
+// NOTE: in the typed mode the inference has already checked the types
+// of all of the values, so only the thunks need to be checked for
+#define CHECKED (!typed)
 
 static Object *eval_lookup(const Node *expr, Object *env)
 {
@@ -38,191 +57,721 @@ static Object *eval_lookup(const Node *expr, Object *env)
 		errorf("unbound variable: %s", IdNode_value(expr));
 		return NULL;
 	}
+	// NOTE: the value may be stored anywhere now, see GC_clear_env
+	value->owned = 0;
 	return value;
 }
 
-static Object *eval_pair(const Node *expr, Context *ctx, Object *env)
+static int eval_op(int op, Number left, Number right, Number *result)
 {
-	int op = PairNode_op(expr);
-	Context_stack_push(ctx, env);
-	Object *leftv = eval_expect(PairNode_left(expr), ctx, env, NumObject);
-	Context_stack_pop(ctx);
-	if (!leftv) {
-		return NULL;
+	if (!Number_op(op, left, right, result)) {
+		errorf("unknown binary operation: '%c'", op);
+		return 0;
 	}
-	Context_stack_push(ctx, leftv);
-	Object *rightv = eval_expect(PairNode_right(expr), ctx, env, NumObject);
-	Context_stack_pop(ctx);
-	if (!rightv) {
-		return NULL;
-	}
-	switch (op) {
-		case '^':
-			return GC_alloc_number(ctx->gc, pow(NumObj_num(leftv), NumObj_num(rightv)));
-		case '*':
-			return GC_alloc_number(ctx->gc, NumObj_num(leftv) * NumObj_num(rightv));
-		case '/':
-			return GC_alloc_number(ctx->gc, NumObj_num(leftv) / NumObj_num(rightv));
-		case '%':
-			return GC_alloc_number(ctx->gc, fmod(NumObj_num(leftv), NumObj_num(rightv)));
-		case '+':
-			return GC_alloc_number(ctx->gc, NumObj_num(leftv) + NumObj_num(rightv));
-		case '-':
-			return GC_alloc_number(ctx->gc, NumObj_num(leftv) - NumObj_num(rightv));
-		case '>':
-			return GC_alloc_number(ctx->gc, NumObj_num(leftv) > NumObj_num(rightv));
-		case '<':
-			return GC_alloc_number(ctx->gc, NumObj_num(leftv) < NumObj_num(rightv));
-		case '=':
-			return GC_alloc_number(ctx->gc, NumObj_num(leftv) == NumObj_num(rightv));
-		default:
-			errorf("unknown binary operation: '%c'", op);
-			return NULL;
+	return 1;
+}
+
+// The common operations on two integers or two doubles are done right
+// here, the rest (and the overflows) by Number_op. NOTE: a quickened
+// node keeps its operation, see PairNode_quicken
+static Number eval_quick_op(const Node *expr, Number left, Number right)
+{
+	long r;
+	if (left.exact && right.exact) {
+		switch (expr->type) {
+			case NumAddNode:
+				if (!__builtin_add_overflow(left.i, right.i, &r)) {
+					return Number_int(r);
+				}
+				break;
+			case NumSubNode:
+				if (!__builtin_sub_overflow(left.i, right.i, &r)) {
+					return Number_int(r);
+				}
+				break;
+			case NumMulNode:
+				if (!__builtin_mul_overflow(left.i, right.i, &r)) {
+					return Number_int(r);
+				}
+				break;
+			case NumGtNode: return Number_int(left.i > right.i);
+			case NumLtNode: return Number_int(left.i < right.i);
+			case NumEqNode: return Number_int(left.i == right.i);
+			default:        break;
+		}
+	} else if (!left.exact && !right.exact) {
+		switch (expr->type) {
+			case NumAddNode: return Number_double(left.d + right.d);
+			case NumSubNode: return Number_double(left.d - right.d);
+			case NumMulNode: return Number_double(left.d * right.d);
+			case NumDivNode: return Number_double(left.d / right.d);
+			case NumGtNode:  return Number_int(left.d > right.d);
+			case NumLtNode:  return Number_int(left.d < right.d);
+			case NumEqNode:  return Number_int(left.d == right.d);
+			default:         break;
+		}
 	}
+	Number result = Number_double(NAN);
+	Number_op(PairNode_op(expr), left, right, &result);
+	return result;
 }
 
-static Object *eval_or(const Node *expr, Context *ctx, Object *env)
+// Get the value of a trivial operand of a quickened node without going
+// through the machine. Anything unusual is left to the generic path.
+static int eval_leaf(const Node *expr, Object *env, Number *result)
 {
-	Context_stack_push(ctx, env);
-	Object *leftv = eval_expect(PairNode_left(expr), ctx, env, NumObject);
-	Context_stack_pop(ctx);
-	if (!leftv) {
-		return NULL;
+	if (expr->type == NumberNode) {
+		*result = NumNode_value(expr);
+		return 1;
 	}
-	if (NumObj_num(leftv)) {
-		return leftv;
+	if (expr->type != IdNode) {
+		return 0;
 	}
-	Object *rightv = eval_expect(PairNode_right(expr), ctx, env, NumObject);
-	if (!rightv) {
-		return NULL;
+	Object *obj = Env_get(EnvObj_env(env), IdNode_value(expr));
+	if (obj && obj->type == ThunkObject) {
+		obj = ThunkObj_value(obj);
 	}
-	return rightv;
+	return obj && Number_unbox(obj, result);
 }
 
-static Object *eval_and(const Node *expr, Context *ctx, Object *env)
+// The argument is passed by need if either the whole program is lazy or the
+// parameter is marked as lazy, unless the function forces it anyway.
+// A call that binds all of the parameters of the nested functions
+// runs the innermost body right away, so more of them are forced.
+static int eval_by_need(const Node *fn, int count)
 {
-	Context_stack_push(ctx, env);
-	Object *leftv = eval_expect(PairNode_left(expr), ctx, env, NumObject);
-	Context_stack_pop(ctx);
-	if (!leftv) {
-		return NULL;
+	int strict = count == FnNode_arity(fn) ? FnNode_saturated(fn) : FnNode_strict(fn);
+	return (lazy || FnNode_lazy(fn)) && !strict;
+}
+
+// The application node that is n nodes down the spine
+static const Node *eval_spine(const Node *expr, int n)
+{
+	for (; n > 0; n--) {
+		expr = PairNode_left(expr);
 	}
-	if (!NumObj_num(leftv)) {
-		return leftv;
+	return expr;
+}
+
+// Get the argument of a call by need without allocating a thunk when
+// it's not necessary. Returns NULL if the argument is cheap enough
+// to be evaluated right away.
+static Object *eval_lazy_arg(const Node *arg, Object *env, Context *ctx)
+{
+	switch (arg->type) {
+		case NumberNode:
+		case FnNode:
+			return NULL;
+		case IdNode: {
+			// a variable is already either a value or a thunk,
+			// if it's unbound the error is reported only when it's forced
+			Object *value = Env_get(EnvObj_env(env), IdNode_value(arg));
+			if (value) {
+				value->owned = 0;
+				return value;
+			}
+			break;
+		}
+		default:
+			break;
 	}
-	Object *rightv = eval_expect(PairNode_right(expr), ctx, env, NumObject);
-	if (!rightv) {
-		return NULL;
+	return GC_alloc_thunk(ctx->gc, env, arg);
+}
+
+// The arguments of a call of a global function that is memoized,
+// they are looked up in the env of the call by the parameter names
+static int eval_memo_args(const Node *fn, Object *env, Number *args)
+{
+	for (int i = 0; fn->type == FnNode; fn = FnNode_body(fn)) {
+		if (!Memo_arg(env, FnNode_param_value(fn), &args[i])) {
+			return 0;
+		}
+		i += 1;
 	}
-	return rightv;
+	return 1;
 }
 
-static Object *eval_let(const Node *expr, Context *ctx, Object *env)
+static int eval_memo_get(const Node *fn, Object *env, Number *result)
 {
-	Object *value = eval_dispatch(LetNode_value(expr), ctx, env);
-	if (!value) {
-		return NULL;
+	Number args[MEMO_MAX_ARGS];
+	return eval_memo_args(fn, env, args) && Memo_get(fn, FnNode_arity(fn), args, result);
+}
+
+static void eval_memo_put(const Node *fn, Object *env, Object *value)
+{
+	Number args[MEMO_MAX_ARGS];
+	Number result;
+	if (Number_unbox(value, &result) && eval_memo_args(fn, env, args)) {
+		Memo_put(fn, FnNode_arity(fn), args, result);
 	}
-	Env_add(EnvObj_env(env), LetNode_name_value(expr), value);
-	return NULL;
 }
 
-static Node *eval_if(Context *ctx, Object **env, const Node *expr)
+// The closure of a partial application of the function to numbers
+// with the numbers substituted (NULL if some argument is not a number)
+static Object *eval_specialize(const Node *fn, int count, Object *env, Context *ctx)
 {
-	Context_stack_push(ctx, *env);
-	Object *condv = eval_expect(IfNode_cond(expr), ctx, *env, NumObject);
-	Context_stack_pop(ctx);
-	if (!condv) {
+	Number args[SPECIALIZE_MAX_ARGS];
+	const Node *param = fn;
+	for (int i = 0; i < count; i++) {
+		if (!Memo_arg(env, FnNode_param_value(param), &args[i])) {
+			return NULL;
+		}
+		param = FnNode_body(param);
+	}
+	int global = EnvObj_prev(env) == ctx->root;
+	const Node *spec = optimize_specialize(fn, count, args, global, EnvObj_version(ctx->root));
+	if (!spec) {
 		return NULL;
 	}
-	if (NumObj_num(condv)) {
-		return IfNode_true(expr);
-	} else {
-		return IfNode_false(expr);
+	return GC_alloc_fn(ctx->gc, EnvObj_prev(env), spec);
+}
+
+// The env of a call, the spare one is reused if there is one
+static Object *eval_call_env(Stack *stack, Object *prev, Context *ctx)
+{
+	Object *env = stack->spare;
+	if (!env) {
+		return GC_alloc_env(ctx->gc, prev);
 	}
+	stack->spare = NULL;
+	EnvObj_prev(env) = prev;
+	return env;
 }
 
-static const Node *eval_application(Context *ctx, Object **env, const Node *expr)
+// Once the arguments of a tail call are bound, the env of the caller is dead,
+// unless it's captured by an object or a memoized call is going to look up
+// its arguments (see MemoFrame). Then it's kept to be reused by the next call,
+// so a tail recursive loop doesn't allocate envs.
+static void eval_recycle(Stack *stack, int base, Object *env, Context *ctx)
 {
-	Context_stack_push(ctx, *env);
-	Object *fnv = eval_expect(PairNode_left(expr), ctx, *env, FnObject);
-	Context_stack_pop(ctx);
-	if (!fnv) {
-		return NULL;
+	if (EnvObj_captured(env) || stack->spare) {
+		return;
 	}
-	Object *argv = NULL;
-	if (lazy) {
-		argv = GC_alloc_thunk(ctx->gc, *env, PairNode_right(expr));
-	} else {
-		Context_stack_push(ctx, fnv);
-		argv = eval_dispatch(PairNode_right(expr), ctx, *env);
-		Context_stack_pop(ctx);
-		if (!argv) {
-			return NULL;
+	for (int i = stack->size - 1; i >= base && stack->frames[i].kind == MemoFrame; i--) {
+		if (stack->frames[i].env == env) {
+			return;
 		}
 	}
-	*env = GC_alloc_env(ctx->gc, FnObj_env(fnv));
-	Env_add(EnvObj_env(*env), FnObj_arg(fnv), argv);
-	return FnObj_body(fnv);
+	GC_clear_env(ctx->gc, env);
+	EnvObj_prev(env) = NULL;
+	stack->spare = env;
 }
 
-static Object *eval_dispatch(const Node *expr, Context *ctx, Object *env)
+#define push_frame(kind, expr, env) ({\
+	Frame *frame = Stack_push(stack, (kind), (expr), (env));\
+	if (!frame) {\
+		error("stack overflow");\
+		goto fail;\
+	}\
+	frame;\
+})
+
+// NOTE: if the expression is NULL, the value is returned right away (to be forced)
+static Object *eval_machine(const Node *expr, Object *env, Object *val, Context *ctx, int force)
 {
-	for (;;) {
-		GC_collect(ctx->gc, env, ctx->stack);
-		switch (expr->type) {
-			case NumberNode:
-				return GC_alloc_number(ctx->gc, NumNode_value(expr));
-			case FnNode:
-				return GC_alloc_fn(ctx->gc, env, FnNode_body(expr), FnNode_param_value(expr));
-			case IdNode:
-				return eval_lookup(expr, env);
-			case ExptNode:
-			case ProdNode:
-			case SumNode:
-			case CmpNode:
-				return eval_pair(expr, ctx, env);
-			case AndNode:
-				return eval_and(expr, ctx, env);
-			case OrNode:
-				return eval_or(expr, ctx, env);
-			case IfNode:
-				expr = eval_if(ctx, &env, expr);
-				break;
-			case ApplNode:
-				expr = eval_application(ctx, &env, expr);
-				break;
-			case LetNode:
-				return eval_let(expr, ctx, env);
+	Stack *stack = Context_stack(ctx);
+	int base = stack->size;
+	Frame *frame = NULL;
+	// the returned value is either an object or an unboxed number
+	Number num = Number_int(0);
+	int boxed = 1;
+	Number left, right;
+	if (force) {
+		push_frame(ForceFrame, NULL, NULL);
+	}
+	if (!expr) {
+		goto ret;
+	}
+eval:
+	if (!GC_collect(ctx->gc, env, ctx->stack)) {
+		error("heap exhausted");
+		goto fail;
+	}
+	switch (expr->type) {
+		case NumberNode:
+			num = NumNode_value(expr);
+			boxed = 0;
+			goto ret;
+		case FnNode:
+			val = GC_alloc_fn(ctx->gc, env, expr);
+			boxed = 1;
+			goto ret;
+		case IdNode:
+			val = eval_lookup(expr, env);
+			if (!val) {
+				goto fail;
+			}
+			boxed = 1;
+			goto ret;
+		case ExptNode:
+		case ProdNode:
+		case SumNode:
+		case CmpNode:
+			push_frame(PairLeftFrame, expr, env);
+			expr = PairNode_left(expr);
+			goto eval;
+		case NumAddNode:
+		case NumSubNode:
+		case NumMulNode:
+		case NumDivNode:
+		case NumModNode:
+		case NumPowNode:
+		case NumGtNode:
+		case NumLtNode:
+		case NumEqNode:
+			if (!eval_leaf(PairNode_left(expr), env, &left)) {
+				push_frame(PairLeftFrame, expr, env);
+				expr = PairNode_left(expr);
+				goto eval;
+			}
+			if (!eval_leaf(PairNode_right(expr), env, &right)) {
+				push_frame(PairRightFrame, expr, env)->num = left;
+				expr = PairNode_right(expr);
+				goto eval;
+			}
+			num = eval_quick_op(expr, left, right);
+			boxed = 0;
+			goto ret;
+		case AndNode:
+			push_frame(AndFrame, expr, env);
+			expr = PairNode_left(expr);
+			goto eval;
+		case OrNode:
+			push_frame(OrFrame, expr, env);
+			expr = PairNode_left(expr);
+			goto eval;
+		case IfNode:
+			// a quickened condition on trivial operands doesn't need a frame
+			if (
+				PairNode_quick(IfNode_cond(expr)) &&
+				eval_leaf(PairNode_left(IfNode_cond(expr)), env, &left) &&
+				eval_leaf(PairNode_right(IfNode_cond(expr)), env, &right)
+			) {
+				num = eval_quick_op(IfNode_cond(expr), left, right);
+				expr = Number_true(num) ? IfNode_true(expr) : IfNode_false(expr);
+				goto eval;
+			}
+			push_frame(IfFrame, expr, env);
+			expr = IfNode_cond(expr);
+			goto eval;
+		case ApplNode: {
+			// 'f x y z' is evaluated as a single call, see ApplFnFrame
+			Frame *spine = push_frame(ApplFnFrame, expr, env);
+			for (; expr->type == ApplNode; expr = PairNode_left(expr)) {
+				spine->count += 1;
+			}
+			goto eval;
+		}
+		case LetNode:
+			push_frame(LetFrame, expr, env);
+			expr = LetNode_value(expr);
+			if (lazy && expr->type != NumberNode && expr->type != FnNode && expr->type != IdNode) {
+				// NOTE: nothing forces the value, so it's bound by need, the strict
+				// arguments (see eval_by_need) are only evaluated when it's forced
+				val = GC_alloc_thunk(ctx->gc, env, expr);
+				boxed = 1;
+				goto ret;
+			}
+			goto eval;
+		case GuardNode:
+			if (EnvObj_version(ctx->root) == GuardNode_version(expr)) {
+				expr = GuardNode_inlined(expr);
+			} else {
+				expr = GuardNode_original(expr);
+			}
+			goto eval;
+	}
+ret:
+	if (stack->size == base) {
+		if (!boxed) {
+			val = GC_alloc_boxed(ctx->gc, num);
+		}
+		return val;
+	}
+	frame = Stack_top(stack);
+	if (FRAME_FORCES(frame) && boxed && val->type == ThunkObject) {
+		if (ThunkObj_value(val)) {
+			val = ThunkObj_value(val);
+		} else if (!ThunkObj_env(val)) {
+			error("infinite loop");
+			goto fail;
+		} else if (!ThunkObj_body(val)) {
+			// a suspended builtin, the frame keeps it alive during the call
+			Object *builtin = ThunkObj_env(val);
+			push_frame(UpdateFrame, NULL, builtin)->value = val;
+			ThunkObj_blackhole(val);
+			val = BuiltinObj_desc(builtin)->fn(BuiltinObj_args(builtin), ctx);
+			if (!val) {
+				goto fail;
+			}
+			goto ret;
+		} else {
+			expr = ThunkObj_body(val);
+			env = ThunkObj_env(val);
+			push_frame(UpdateFrame, NULL, env)->value = val;
+			// the thunk stays a blackhole until its Update frame is reached,
+			// so forcing it from its own body is an error rather than a loop
+			ThunkObj_blackhole(val);
+			goto eval;
+		}
+	}
+	if (FRAME_NUMERIC(frame)) {
+		// NOTE: the typed mode still has to tell the integers from the doubles
+		if (boxed && !Number_unbox(val, &num)) {
+			if (frame->kind <= PairRightFrame && PairNode_quick(frame->expr)) {
+				// the guard failed, go back to the generic node
+				PairNode_deopt((Node *)frame->expr);
+			}
+			error("type mismatch");
+			goto fail;
 		}
-		if (!expr) {
+	} else if (!boxed) {
+		val = GC_alloc_boxed(ctx->gc, num);
+		// an argument is only referenced by the env of the call
+		val->owned = frame->kind <= TailArgFrame;
+		boxed = 1;
+	}
+	switch ((FrameKind)frame->kind) {
+		case ForceFrame:
+			Stack_pop(stack);
+			goto ret;
+		case UpdateFrame:
+			ThunkObj_set_value(frame->value, val);
+			Stack_pop(stack);
+			goto ret;
+		case PairLeftFrame:
+			expr = frame->expr;
+			env = frame->env;
+			if (PairNode_quick(expr) && eval_leaf(PairNode_right(expr), env, &right)) {
+				Stack_pop(stack);
+				num = eval_quick_op(expr, num, right);
+				boxed = 0;
+				goto ret;
+			}
+			frame->kind = PairRightFrame;
+			frame->num = num;
+			expr = PairNode_right(expr);
+			goto eval;
+		case PairRightFrame:
+			expr = frame->expr;
+			left = frame->num;
+			Stack_pop(stack);
+			if (PairNode_quick(expr)) {
+				num = eval_quick_op(expr, left, num);
+			} else {
+				if (!eval_op(PairNode_op(expr), left, num, &num)) {
+					goto fail;
+				}
+				// both operands turned out to be numbers, so from now on
+				// the node is evaluated by the specialized code
+				PairNode_quicken((Node *)expr);
+			}
+			boxed = 0;
+			goto ret;
+		case AndFrame:
+		case OrFrame:
+			if (frame->kind == AndFrame ? !Number_true(num) : Number_true(num)) {
+				Stack_pop(stack);
+				goto ret;
+			}
+			frame->kind = NumFrame;
+			expr = PairNode_right(frame->expr);
+			env = frame->env;
+			goto eval;
+		case NumFrame:
+			Stack_pop(stack);
+			goto ret;
+		case IfFrame:
+			expr = Number_true(num) ? IfNode_true(frame->expr) : IfNode_false(frame->expr);
+			env = frame->env;
+			Stack_pop(stack);
+			goto eval;
+		case ApplFnFrame: {
+			if (val->type == BuiltinObject) {
+				// the arguments are added to a copy of the builtin
+				const BuiltinDesc *desc = BuiltinObj_desc(val);
+				int count = desc->arity - BuiltinObj_count(val);
+				count = frame->count < count ? frame->count : count;
+				const Node *appl = eval_spine(frame->expr, frame->count - count);
+				Object *caller = frame->env;
+				if (frame->count == count) {
+					Stack_pop(stack);
+				} else {
+					frame->count -= count;
+				}
+				Object *partial = GC_alloc_builtin(ctx->gc, desc, BuiltinObj_count(val), BuiltinObj_args(val));
+				frame = push_frame(BuiltinArgFrame, appl, caller);
+				frame->value = partial;
+				frame->count = count;
+				goto bind_builtin;
+			}
+			if (CHECKED && val->type != FnObject) {
+				error("type mismatch");
+				goto fail;
+			}
+			// bind as many arguments as there are nested functions in one env,
+			// a partial application results in a closure of the inner function
+			// and the rest of the arguments are applied to the result later
+			const Node *fn = FnObj_node(val);
+			int count = frame->count < FnNode_arity(fn) ? frame->count : FnNode_arity(fn);
+			const Node *appl = eval_spine(frame->expr, frame->count - count);
+			Object *caller = frame->env;
+			// NOTE: the env of the caller is still needed by the rest of the arguments
+			int tail = ApplNode_tail(frame->expr) && frame->count == count;
+			if (frame->count == count) {
+				Stack_pop(stack);
+			} else {
+				frame->count -= count;
+			}
+			// NOTE: a tail call is not memoized (its result is the one of the
+			// caller), so that the loops keep recycling their envs
+			if (
+				memoize && !tail && FnObj_env(val) == ctx->root &&
+				count == FnNode_arity(fn) && count <= MEMO_MAX_ARGS
+			) {
+				// the cache is looked up once the arguments are bound
+				push_frame(MemoFrame, fn, NULL);
+			}
+			if (optimization && count < FnNode_arity(fn) && count <= SPECIALIZE_MAX_ARGS) {
+				push_frame(SpecFrame, fn, NULL)->count = count;
+			}
+			frame = push_frame(tail ? TailArgFrame : ApplArgFrame, appl, caller);
+			frame->value = eval_call_env(stack, FnObj_env(val), ctx);
+			frame->callee = fn;
+			frame->count = count;
+			goto bind;
+		}
+		case ApplArgFrame:
+		case TailArgFrame:
+			Env_add(EnvObj_env(frame->value), FnNode_param_value(frame->callee), val);
+			frame->callee = FnNode_body(frame->callee);
+			frame->count -= 1;
+			goto bind;
+		case BuiltinArgFrame:
+			BuiltinObj_args(frame->value)[BuiltinObj_count(frame->value)] = val;
+			BuiltinObj_count(frame->value) += 1;
+			frame->count -= 1;
+			goto bind_builtin;
+		case MemoFrame:
+			if (frame->env) {
+				eval_memo_put(frame->expr, frame->env, val);
+			}
+			Stack_pop(stack);
+			goto ret;
+		case SpecFrame:
+			Stack_pop(stack);
+			goto ret;
+		case LetFrame:
+			if (memoize) {
+				// the globals the cached results depend on may change
+				Memo_flush();
+			}
+			Env_add(EnvObj_env(frame->env), LetNode_name_value(frame->expr), val);
+			stack->size = base;
 			return NULL;
+	}
+bind:
+	// the frame holds the env of the call, the next function to bind the
+	// parameter of, and the application node of the last argument
+	frame = Stack_top(stack);
+	for (; frame->count; frame->count -= 1) {
+		const Node *fn = frame->callee;
+		const Node *arg = PairNode_right(eval_spine(frame->expr, frame->count - 1));
+		Object *argv = NULL;
+		if (eval_by_need(fn, frame->count)) {
+			argv = eval_lazy_arg(arg, frame->env, ctx);
+		}
+		if (!argv) {
+			expr = arg;
+			env = frame->env;
+			goto eval;
+		}
+		Env_add(EnvObj_env(frame->value), FnNode_param_value(fn), argv);
+		frame->callee = FnNode_body(fn);
+	}
+	// either the innermost body or the closure of a partial application
+	expr = frame->callee;
+	env = frame->value;
+	Stack_pop(stack);
+	if (frame->kind == TailArgFrame) {
+		eval_recycle(stack, base, frame->env, ctx);
+	}
+	if (stack->size > base && Stack_top(stack)->kind == MemoFrame && !Stack_top(stack)->env) {
+		if (eval_memo_get(Stack_top(stack)->expr, env, &num)) {
+			Stack_pop(stack);
+			boxed = 0;
+			goto ret;
 		}
+		Stack_top(stack)->env = env;
 	}
+	if (stack->size > base && Stack_top(stack)->kind == SpecFrame) {
+		frame = Stack_top(stack);
+		val = eval_specialize(frame->expr, frame->count, env, ctx);
+		Stack_pop(stack);
+		if (val) {
+			boxed = 1;
+			goto ret;
+		}
+	}
+	goto eval;
+bind_builtin:
+	// the same for a builtin, it's called once it has all of its arguments
+	frame = Stack_top(stack);
+	for (; frame->count; frame->count -= 1) {
+		const Node *arg = PairNode_right(eval_spine(frame->expr, frame->count - 1));
+		Object *argv = NULL;
+		if (lazy) {
+			argv = eval_lazy_arg(arg, frame->env, ctx);
+		}
+		if (!argv) {
+			expr = arg;
+			env = frame->env;
+			goto eval;
+		}
+		BuiltinObj_args(frame->value)[BuiltinObj_count(frame->value)] = argv;
+		BuiltinObj_count(frame->value) += 1;
+	}
+	val = frame->value;
+	if (BuiltinObj_count(val) == BuiltinObj_desc(val)->arity) {
+		// NOTE: the frame keeps the arguments alive during the call
+		val = BuiltinObj_desc(val)->fn(BuiltinObj_args(val), ctx);
+		if (!val) {
+			goto fail;
+		}
+	}
+	Stack_pop(stack);
+	boxed = 1;
+	goto ret;
+fail:
+	// the thunks under evaluation are unevaluated again, so forcing them
+	// later (e.g. once the missing globals are defined) starts over
+	for (; stack->size > base; Stack_pop(stack)) {
+		frame = Stack_top(stack);
+		if (frame->kind == UpdateFrame) {
+			ThunkObj_env(frame->value) = frame->env;
+		}
+	}
+	return NULL;
 }
 
-static Object *actual_value(const Node *expr, Context *ctx, Object *env)
+// NOTE: the builtins call back into the evaluator on the C stack,
+// so the depth of the nested evaluations is limited
+#define MAX_NESTING 4096
+
+static int nesting = 0;
+
+static Object *eval_nested(const Node *expr, Object *env, Object *val, Context *ctx)
 {
-	Object *result = eval_dispatch(expr, ctx, env);
-	if (!result || result->type != ThunkObject) {
-		return result;
-	}
-	if (ThunkObj_value(result)) {
-		return ThunkObj_value(result);
+	if (nesting == MAX_NESTING) {
+		error("stack overflow");
+		return NULL;
 	}
-	Context_stack_push(ctx, result);
-	Object *value = actual_value(ThunkObj_body(result), ctx, ThunkObj_env(result));
-	Context_stack_pop(ctx);
-	ThunkObj_set_value(result, value);
-	return value;
+	nesting += 1;
+	val = eval_machine(expr, env, val, ctx, 1);
+	nesting -= 1;
+	return val;
 }
 
 Object *eval(const Node *expr, Context *ctx)
 {
 	Stack_clear(Context_stack(ctx));
-	if (lazy) {
-		return actual_value(expr, ctx, ctx->root);
-	} else {
-		return eval_dispatch(expr, ctx, ctx->root);
+	GC_unprotect(ctx->gc, ctx->gc->nroots);
+	// NOTE: thunks can show up in the strict mode too, because of '~x'
+	return eval_machine(expr, ctx->root, NULL, ctx, 1);
+}
+
+Object *eval_force(Object *obj, Context *ctx)
+{
+	if (obj->type == CompthunkObject) {
+		return Callback_force(obj);
+	}
+	if (obj->type != ThunkObject) {
+		return obj;
+	}
+	if (ThunkObj_value(obj)) {
+		return ThunkObj_value(obj);
+	}
+	return eval_nested(NULL, NULL, obj, ctx);
+}
+
+// NOTE: the builtin is kept alive by a frame during the call
+static Object *eval_apply_builtin(Object *fn, int count, Object **args, Context *ctx)
+{
+	Stack *stack = Context_stack(ctx);
+	const BuiltinDesc *desc = BuiltinObj_desc(fn);
+	Object *partial = GC_alloc_builtin(ctx->gc, desc, BuiltinObj_count(fn), BuiltinObj_args(fn));
+	for (int i = 0; i < count; i++) {
+		BuiltinObj_args(partial)[BuiltinObj_count(partial)] = args[i];
+		BuiltinObj_count(partial) += 1;
+	}
+	if (BuiltinObj_count(partial) < desc->arity) {
+		return partial;
+	}
+	Frame *frame = Stack_push(stack, BuiltinArgFrame, NULL, NULL);
+	if (!frame) {
+		error("stack overflow");
+		return NULL;
+	}
+	frame->value = partial;
+	Object *result = desc->fn(BuiltinObj_args(partial), ctx);
+	Stack_pop(stack);
+	return result;
+}
+
+// The env of the call is dead once the body is evaluated unless
+// it's captured, so it's reused by the next call (see eval_recycle)
+static Object *eval_apply_fn(Object *fn, int count, Object **args, Context *ctx)
+{
+	Stack *stack = Context_stack(ctx);
+	const Node *node = FnObj_node(fn);
+	Object *env = eval_call_env(stack, FnObj_env(fn), ctx);
+	for (int i = 0; i < count; i++) {
+		Env_add(EnvObj_env(env), FnNode_param_value(node), args[i]);
+		node = FnNode_body(node);
+	}
+	if (node->type == FnNode) {
+		return GC_alloc_fn(ctx->gc, env, node);
+	}
+	Object *result = eval_nested(node, env, NULL, ctx);
+	if (!EnvObj_captured(env) && !stack->spare) {
+		GC_clear_env(ctx->gc, env);
+		EnvObj_prev(env) = NULL;
+		stack->spare = env;
+	}
+	return result;
+}
+
+// NOTE: the arguments must be kept alive by the caller
+Object *eval_apply(Object *fn, int count, Object **args, Context *ctx)
+{
+	while (count) {
+		fn = eval_force(fn, ctx);
+		if (!fn) {
+			return NULL;
+		}
+		int n = count;
+		if (fn->type == BuiltinObject) {
+			int rest = BuiltinObj_desc(fn)->arity - BuiltinObj_count(fn);
+			n = n < rest ? n : rest;
+			fn = eval_apply_builtin(fn, n, args, ctx);
+		} else if (fn->type == CompfnObject) {
+			// the builtins are called by compiled code, see Builtin_call_comp
+			int arity = CompFnObj_desc(fn)->arity;
+			n = n < arity ? n : arity;
+			fn = Callback_apply(ctx->gc, fn, n, args);
+		} else if (!CHECKED || fn->type == FnObject) {
+			int arity = FnNode_arity(FnObj_node(fn));
+			n = n < arity ? n : arity;
+			fn = eval_apply_fn(fn, n, args, ctx);
+		} else {
+			error("type mismatch");
+			return NULL;
+		}
+		if (!fn) {
+			return NULL;
+		}
+		args += n;
+		count -= n;
 	}
+	return eval_force(fn, ctx);
 }
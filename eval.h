@@ -5,6 +5,10 @@
 #include "object.h"
 #include "context.h"
 
+// NOTE: eval_force and eval_apply are for the builtins, eval_apply
+// calls the function with the arguments and forces the result
 Object *eval(const Node *expr, Context *ctx);
+Object *eval_force(Object *obj, Context *ctx);
+Object *eval_apply(Object *fn, int count, Object **args, Context *ctx);
 
 #endif // EVAL_INCLUDED
@@ -0,0 +1,65 @@
+#include "ffi.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "object.h"
+#include "gc.h"
+#include "context.h"
+#include "builtin.h"
+
+
+// The builtins of the functions: the arguments are forced and checked
+// as numbers, the result is boxed. The compiled code calls the functions
+// directly when it can, see compile_native.
+
+#define FFI_WRAPPER_1(name)\
+static Object *Ffi_##name(Object **args, Context *ctx)\
+{\
+	double x;\
+	if (!Builtin_number(args[0], ctx, &x)) {\
+		return NULL;\
+	}\
+	return GC_alloc_number(ctx->gc, name(x));\
+}
+
+#define FFI_WRAPPER_2(name)\
+static Object *Ffi_##name(Object **args, Context *ctx)\
+{\
+	double x, y;\
+	if (!Builtin_number(args[0], ctx, &x) || !Builtin_number(args[1], ctx, &y)) {\
+		return NULL;\
+	}\
+	return GC_alloc_number(ctx->gc, name(x, y));\
+}
+
+#define FFI_WRAPPER(name, arity) FFI_WRAPPER_##arity(name)
+
+FFI_FUNCTIONS(FFI_WRAPPER)
+
+#define FFI_TYPE_1 "num -> float"
+#define FFI_TYPE_2 "num -> num -> float"
+
+#define FFI_DESC(name, arity) {#name, FFI_TYPE_##arity, arity, Ffi_##name},
+
+static const BuiltinDesc natives[] = {
+	FFI_FUNCTIONS(FFI_DESC)
+};
+
+const BuiltinDesc *Ffi_native(int index)
+{
+	if (index >= (int)(sizeof(natives)/sizeof(*natives))) {
+		return NULL;
+	}
+	return &natives[index];
+}
+
+int Ffi_find(const char *name)
+{
+	for (size_t i = 0; i < sizeof(natives)/sizeof(*natives); i++) {
+		if (!strcmp(natives[i].name, name)) {
+			return i;
+		}
+	}
+	return -1;
+}
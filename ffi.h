@@ -0,0 +1,40 @@
+#ifndef FFI_INCLUDED
+#define FFI_INCLUDED
+
+#include "values.h"
+
+// The C functions of doubles that are bound as builtins with their
+// own names: X(name, arity) for each one, the arity is 1 or 2.
+// NOTE: to add a function, declare it in ffi.c and add it here
+#define FFI_FUNCTIONS(X)\
+	X(sqrt, 1)\
+	X(cbrt, 1)\
+	X(exp, 1)\
+	X(log, 1)\
+	X(log2, 1)\
+	X(log10, 1)\
+	X(sin, 1)\
+	X(cos, 1)\
+	X(tan, 1)\
+	X(asin, 1)\
+	X(acos, 1)\
+	X(atan, 1)\
+	X(sinh, 1)\
+	X(cosh, 1)\
+	X(tanh, 1)\
+	X(floor, 1)\
+	X(ceil, 1)\
+	X(round, 1)\
+	X(trunc, 1)\
+	X(fabs, 1)\
+	X(atan2, 2)\
+	X(hypot, 2)\
+	X(fmin, 2)\
+	X(fmax, 2)
+
+// the i-th function (NULL past the last one) and the index
+// of the function with the name (-1 if there is none)
+const BuiltinDesc *Ffi_native(int index);
+int               Ffi_find(const char *name);
+
+#endif // FFI_INCLUDED
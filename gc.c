@@ -1,5 +1,6 @@
 #include "gc.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "node.h"
@@ -16,23 +17,50 @@ GC *GC_new(void)
 	self->last = NULL;
 	self->curr = 0;
 	self->count = 0;
+	self->bytes = 0;
 	self->thres = GC_INITIAL_THRESHOLD;
+	self->pending = NULL;
+	self->npending = 0;
+	self->cpending = 0;
+	self->roots = NULL;
+	self->nroots = 0;
+	self->croots = 0;
+	self->segments = NULL;
+	self->nspare = 0;
+	for (int i = 0; i < GC_OBJECT_TYPES; i++) {
+		self->allocated[i] = 0;
+	}
 	return self;
 }
 
 void GC_drop(GC *self)
 {
+	free(self->pending);
+	free(self->roots);
 	free(self);
 }
 
+// NOTE: objects are traced from an explicit worklist, so
+// arbitrarily long chains of thunks and envs don't overflow the C stack
 static void GC_mark(GC *self, Object *obj)
 {
 	if (obj->mark == self->curr) {
 		return;
 	}
 	obj->mark = self->curr;
+	if (self->npending == self->cpending) {
+		self->cpending = self->cpending ? self->cpending * 2 : GC_INITIAL_THRESHOLD;
+		self->pending = reallocarray(self->pending, self->cpending, sizeof(*self->pending));
+	}
+	self->pending[self->npending] = obj;
+	self->npending += 1;
+}
+
+static void GC_trace(GC *self, Object *obj)
+{
 	switch (obj->type) {
 		case NumObject:
+		case IntObject:
 			return;
 		case FnObject:
 			return GC_mark(self, FnObj_env(obj));
@@ -41,28 +69,87 @@ static void GC_mark(GC *self, Object *obj)
 		case ThunkObject:
 			if (ThunkObj_value(obj)) {
 				return GC_mark(self, ThunkObj_value(obj));
-			} else {
+			} else if (ThunkObj_env(obj)) {
 				return GC_mark(self, ThunkObj_env(obj));
 			}
+			return;
 		case CompthunkObject:
 			if (CompThunkObj_value(obj)) {
 				return GC_mark(self, CompThunkObj_value(obj));
-			} else {
+			} else if (CompThunkObj_env(obj)) {
 				return GC_mark(self, CompThunkObj_env(obj));
 			}
+			return;
 		case EnvObject:
 			if (EnvObj_prev(obj)) {
 				GC_mark(self, EnvObj_prev(obj));
 			}
 			return Env_for_each(EnvObj_env(obj), (void (*)(void *, Object*))GC_mark, self);
+		case BuiltinObject:
+			for (int i = 0; i < BuiltinObj_count(obj); i++) {
+				GC_mark(self, BuiltinObj_args(obj)[i]);
+			}
+			return;
+		case StreamObject:
+			if (StreamObj_src(obj)) {
+				GC_mark(self, StreamObj_src(obj));
+			}
+			if (StreamObj_fn(obj)) {
+				GC_mark(self, StreamObj_fn(obj));
+			}
+			if (StreamObj_head(obj)) {
+				GC_mark(self, StreamObj_head(obj));
+			}
+			return;
+		case ArrayObject:
+			return;
+		case MapObject:
+			for (int i = 0; i < MapObj_count(obj); i++) {
+				GC_mark(self, MapObj_slots(obj)[i].value);
+			}
+			return;
+		case VectorObject:
+			GC_mark(self, VectorObj_root(obj));
+			return GC_mark(self, VectorObj_tail(obj));
+		case VecnodeObject:
+			for (int i = 0; i < VECTOR_WIDTH && VecnodeObj_slots(obj)[i]; i++) {
+				GC_mark(self, VecnodeObj_slots(obj)[i]);
+			}
+			return;
+		case ListObject:
+			if (ListObj_head(obj)) {
+				GC_mark(self, ListObj_head(obj));
+			}
+			if (ListObj_tail(obj)) {
+				GC_mark(self, ListObj_tail(obj));
+			}
+			return;
 		case StackObject:
 			return Stack_for_each(StackObj_stack(obj), (void (*)(void *, Object*))GC_mark, self);
 	}
 }
 
+static void GC_mark_roots(GC *self)
+{
+	for (int i = 0; i < self->nroots; i++) {
+		GC_mark(self, self->roots[i]);
+	}
+}
+
+static void GC_trace_pending(GC *self)
+{
+	while (self->npending) {
+		self->npending -= 1;
+		GC_trace(self, self->pending[self->npending]);
+	}
+}
+
 static void GC_append_object(GC *self, Object *obj)
 {
 	self->count += 1;
+	if (obj->type == ArrayObject) {
+		self->bytes += ArrayObj_length(obj) * sizeof(double);
+	}
 	obj->next = NULL;
 	if (!self->first) {
 		self->first = obj;
@@ -78,6 +165,7 @@ static void GC_reset(GC *self)
 	self->first = NULL;
 	self->last = NULL;
 	self->count = 0;
+	self->bytes = 0;
 }
 
 static void GC_free_object(Object *obj)
@@ -85,6 +173,8 @@ static void GC_free_object(Object *obj)
 	switch (obj->type) {
 		case NumObject:
 			return free(ObjToVal(obj, Num));
+		case IntObject:
+			return free(ObjToVal(obj, Int));
 		case FnObject:
 			return free(ObjToVal(obj, Fn));
 		case CompfnObject:
@@ -93,6 +183,21 @@ static void GC_free_object(Object *obj)
 			return free(ObjToVal(obj, Thunk));
 		case CompthunkObject:
 			return free(ObjToVal(obj, CompThunk));
+		case BuiltinObject:
+			return free(ObjToVal(obj, Builtin));
+		case StreamObject:
+			return free(ObjToVal(obj, Stream));
+		case ListObject:
+			return free(ObjToVal(obj, Cell));
+		case ArrayObject:
+			free(ArrayObj_data(obj));
+			return free(ObjToVal(obj, Array));
+		case MapObject:
+			return free(ObjToVal(obj, MapNode));
+		case VectorObject:
+			return free(ObjToVal(obj, Vector));
+		case VecnodeObject:
+			return free(ObjToVal(obj, Vecnode));
 		case EnvObject:
 			return Env_drop(EnvObj_env(obj));
 		case StackObject:
@@ -100,10 +205,12 @@ static void GC_free_object(Object *obj)
 	}
 }
 
+// NOTE: nothing references the spare numbers, so they're freed too
 static void GC_sweep(GC *self)
 {
 	Object *obj = self->first;
 	GC_reset(self);
+	self->nspare = 0;
 	while (obj != NULL) {
 		Object *next = obj->next;
 		if (obj->mark != self->curr) {
@@ -115,11 +222,37 @@ static void GC_sweep(GC *self)
 	}
 }
 
-void GC_collect(GC *self, Object *root, Object *stack)
+// The threshold is kept between 2 and 4 times the number of live objects
+// (but below GC_MAX_OBJECTS), so the time spent collecting stays
+// proportional to the allocations. The big arrays count as many objects.
+static unsigned long GC_load(GC *self)
 {
-	if (self->count < self->thres && (root || stack)) {
-		self->thres >>= (self->count < self->thres/2);
-		return;
+	return self->count + self->bytes / GC_OBJECT_BYTES;
+}
+
+static int GC_due(GC *self)
+{
+	if (GC_load(self) >= self->thres) {
+		return 1;
+	}
+	if (GC_load(self) < self->thres/4 && self->thres > GC_INITIAL_THRESHOLD) {
+		self->thres >>= 1;
+	}
+	return 0;
+}
+
+static void GC_adjust(GC *self)
+{
+	while (GC_load(self) >= self->thres/2 && self->thres < GC_MAX_OBJECTS) {
+		self->thres <<= 1;
+	}
+}
+
+// NOTE: returns 0 if the live objects exceed GC_MAX_OBJECTS
+int GC_collect(GC *self, Object *root, Object *stack)
+{
+	if (!GC_due(self) && (root || stack)) {
+		return 1;
 	}
 	self->curr = !self->curr;
 	if (root) {
@@ -128,72 +261,199 @@ void GC_collect(GC *self, Object *root, Object *stack)
 	if (stack) {
 		GC_mark(self, stack);
 	}
+	if (root || stack) {
+		GC_mark_roots(self);
+	}
+	GC_trace_pending(self);
 	GC_sweep(self);
-	if (self->count >= self->thres) {
-		self->thres <<= 1;
+	GC_adjust(self);
+	return self->count <= GC_MAX_OBJECTS;
+}
+
+static void GC_mark_segment(GC *self, void *rsp, void *rbp)
+{
+	for (size_t *v = rsp; v < (size_t *)rbp; v += 2) {
+		if (v[0] == PTR_OBJ) {
+			GC_mark(self, (Object *)v[1]);
+		}
 	}
 }
 
 void GC_collect_comp(GC *self, Object *root, void *rsp, void *rbp)
 {
-	if (self->count < self->thres && root) {
-		self->thres >>= (self->count < self->thres/2);
+	if (!GC_due(self) && root) {
 		return;
 	}
 	self->curr = !self->curr;
 	if (root) {
 		GC_mark(self, root);
+		GC_mark_roots(self);
 	}
-	for (size_t *v = rsp; v < (size_t *)rbp; v += 2) {
-		if (v[0] == PTR_OBJ) {
-			GC_mark(self, (Object *)v[1]);
-		}
+	GC_mark_segment(self, rsp, rbp);
+	for (Segment *s = self->segments; s; s = s->prev) {
+		GC_mark_segment(self, s->rsp, s->rbp);
 	}
+	GC_trace_pending(self);
 	GC_sweep(self);
-	if (self->count >= self->thres) {
-		self->thres <<= 1;
+	GC_adjust(self);
+}
+
+// NOTE: the segment lives on the C stack of the builtin
+void GC_suspend_comp(GC *self, Segment *segment, void *rsp, void *rbp)
+{
+	segment->rsp = rsp;
+	segment->rbp = rbp;
+	segment->prev = self->segments;
+	self->segments = segment;
+}
+
+void GC_resume_comp(GC *self)
+{
+	self->segments = self->segments->prev;
+}
+
+static void GC_spare_number(GC *self, Object *obj)
+{
+	if (obj->owned && self->nspare < GC_SPARE_NUMBERS) {
+		self->spare[self->nspare] = obj;
+		self->nspare += 1;
 	}
 }
 
+// A dead env is cleared to be reused by another call. The numbers that were
+// boxed to be bound in it and were never looked up (see Object) are dead
+// as well, so they're reused by the next numbers that are allocated and
+// a tail recursive loop allocates neither envs nor numbers.
+void GC_clear_env(GC *self, Object *env)
+{
+	Env_for_each(EnvObj_env(env), (void (*)(void *, Object *))GC_spare_number, self);
+	Env_clear(EnvObj_env(env));
+}
+
+// NOTE: an env that is referenced by an object can't be reused, see GC_alloc_tailenv
+#define GC_capture(env) ({\
+	if (env) {\
+		EnvObj_captured(env) = 1;\
+	}\
+})
+
 #define GC_init_object(self, val, otype) ({\
 	Object *obj = ValToObj(val);\
 	obj->mark = self->curr;\
 	obj->type = otype;\
+	obj->owned = 0;\
+	self->allocated[otype] += 1;\
 	GC_append_object(self, obj);\
 	obj;\
 })
 
 Object *GC_alloc_env(GC *self, Object *prev)
 {
+	GC_capture(prev);
 	return GC_init_object(self, Env_new(prev), EnvObject);
 }
 
-Object *GC_alloc_fn(GC *self, Object *env, const Node *body, const char *arg)
+Object *GC_alloc_fn(GC *self, Object *env, const Node *node)
 {
+	GC_capture(env);
 	Fn *fn = malloc(sizeof(*fn));
 	fn->env = env;
-	fn->body = body;
-	fn->arg = arg;
+	fn->node = node;
 	return GC_init_object(self, fn, FnObject);
 }
 
-Object *GC_alloc_compfn(GC *self, Object *env, void *text)
+Object *GC_alloc_compfn(GC *self, Object *env, void *text, const CompFnDesc *desc)
 {
+	GC_capture(env);
 	CompFn *cfn = malloc(sizeof(*cfn));
 	cfn->env = env;
 	cfn->text = text;
+	cfn->desc = desc;
 	return GC_init_object(self, cfn, CompfnObject);
 }
 
+static void GC_bind_args(Object *env, Object *fn, size_t *v, int count)
+{
+	const char **params = CompFnObj_desc(fn)->params;
+	for (int i = 0; i < count; i++) {
+		Env_add(EnvObj_env(env), params[i], (Object *)v[2*(count - 1 - i) + 1]);
+	}
+}
+
+// The env of a call of a compiled function with all of its arguments,
+// they are pushed on the compiled code stack in order ([type, value] pairs)
+Object *GC_alloc_callenv(GC *self, Object *fn, void *args, int count)
+{
+	Object *env = GC_alloc_env(self, CompFnObj_env(fn));
+	GC_bind_args(env, fn, args, count);
+	return env;
+}
+
+// The same for a tail call: the env of the caller is dead after the arguments
+// are computed, so it's reused unless it's global or referenced by an object
+Object *GC_alloc_tailenv(GC *self, Object *fn, void *args, int count, Object *caller)
+{
+	if (!EnvObj_prev(caller) || EnvObj_captured(caller)) {
+		return GC_alloc_callenv(self, fn, args, count);
+	}
+	GC_clear_env(self, caller);
+	EnvObj_prev(caller) = CompFnObj_env(fn);
+	GC_capture(EnvObj_prev(caller));
+	GC_bind_args(caller, fn, args, count);
+	return caller;
+}
+
+// NOTE: Num and Int have the same layout, so a spare number of either
+// type is reused for both (it's still in the list of the objects)
+#define GC_reuse_number(self, vtype, otype, value) ({\
+	self->nspare -= 1;\
+	Object *obj = self->spare[self->nspare];\
+	obj->mark = self->curr;\
+	obj->type = otype;\
+	obj->owned = 0;\
+	ObjToVal(obj, vtype)->num = value;\
+	obj;\
+})
+
 Object *GC_alloc_number(GC *self, double num)
 {
+	if (self->nspare) {
+		return GC_reuse_number(self, Num, NumObject, num);
+	}
 	Num *n = malloc(sizeof(*n));
 	n->num = num;
 	return GC_init_object(self, n, NumObject);
 }
 
+Object *GC_alloc_int(GC *self, long num)
+{
+	if (self->nspare) {
+		return GC_reuse_number(self, Int, IntObject, num);
+	}
+	Int *n = malloc(sizeof(*n));
+	n->num = num;
+	return GC_init_object(self, n, IntObject);
+}
+
+Object *GC_alloc_boxed(GC *self, Number num)
+{
+	return num.exact ? GC_alloc_int(self, num.i) : GC_alloc_number(self, num.d);
+}
+
+// The result of the operation on two numbers, NULL if any of them
+// is not a number (the slow path of the compiled operations)
+Object *GC_alloc_op(GC *self, int op, Object *left, Object *right)
+{
+	Number l, r, result;
+	if (!Number_unbox(left, &l) || !Number_unbox(right, &r) || !Number_op(op, l, r, &result)) {
+		return NULL;
+	}
+	return GC_alloc_boxed(self, result);
+}
+
 Object *GC_alloc_thunk(GC *self, Object *env, const Node *body)
 {
+	GC_capture(env);
 	Thunk *th = malloc(sizeof(*th));
 	th->env = env;
 	th->body = body;
@@ -203,6 +463,7 @@ Object *GC_alloc_thunk(GC *self, Object *env, const Node *body)
 
 Object *GC_alloc_compthunk(GC *self, Object *env, void *text)
 {
+	GC_capture(env);
 	CompThunk *cth = malloc(sizeof(*cth));
 	cth->env = env;
 	cth->text = text;
@@ -210,14 +471,130 @@ Object *GC_alloc_compthunk(GC *self, Object *env, void *text)
 	return GC_init_object(self, cth, CompthunkObject);
 }
 
+// NOTE: the builtin is applied to the first count of the arguments
+Object *GC_alloc_builtin(GC *self, const BuiltinDesc *desc, int count, Object **args)
+{
+	Builtin *b = malloc(sizeof(*b));
+	b->desc = desc;
+	b->count = count;
+	for (int i = 0; i < count; i++) {
+		b->args[i] = args[i];
+	}
+	return GC_init_object(self, b, BuiltinObject);
+}
+
+Object *GC_alloc_stream(GC *self, StreamKind kind, Object *src, Object *fn, Number num)
+{
+	Stream *s = malloc(sizeof(*s));
+	s->kind = kind;
+	s->src = src;
+	s->fn = fn;
+	s->num = num;
+	s->head = NULL;
+	return GC_init_object(self, s, StreamObject);
+}
+
+// NOTE: the builtin must have all of its arguments
+Object *GC_alloc_suspension(GC *self, Object *builtin)
+{
+	Thunk *th = malloc(sizeof(*th));
+	th->env = builtin;
+	th->body = NULL;
+	th->value = NULL;
+	return GC_init_object(self, th, ThunkObject);
+}
+
+Object *GC_alloc_cell(GC *self, Object *head, Object *tail)
+{
+	Cell *c = malloc(sizeof(*c));
+	c->head = head;
+	c->tail = tail;
+	return GC_init_object(self, c, ListObject);
+}
+
+// NOTE: the elements are not initialized, NULL if there's no memory for them
+Object *GC_alloc_array(GC *self, long length)
+{
+	if (length < 0 || length > ARRAY_MAX_LENGTH) {
+		return NULL;
+	}
+	// the size of an aligned allocation must be a multiple of the alignment
+	size_t size = (length * sizeof(double) / ARRAY_ALIGNMENT + 1) * ARRAY_ALIGNMENT;
+	double *data = aligned_alloc(ARRAY_ALIGNMENT, size);
+	if (!data) {
+		return NULL;
+	}
+	Array *arr = malloc(sizeof(*arr));
+	arr->length = length;
+	arr->data = data;
+	return GC_init_object(self, arr, ArrayObject);
+}
+
+// NOTE: the slots are not initialized
+Object *GC_alloc_map(GC *self, unsigned int bitmap, unsigned int leaves, long size)
+{
+	MapNode *node = malloc(sizeof(*node) + __builtin_popcount(bitmap) * sizeof(Slot));
+	node->bitmap = bitmap;
+	node->leaves = leaves;
+	node->size = size;
+	return GC_init_object(self, node, MapObject);
+}
+
+Object *GC_alloc_vector(GC *self, long size, int shift, Object *root, Object *tail)
+{
+	Vector *v = malloc(sizeof(*v));
+	v->size = size;
+	v->shift = shift;
+	v->root = root;
+	v->tail = tail;
+	return GC_init_object(self, v, VectorObject);
+}
+
+// NOTE: the slots are empty
+Object *GC_alloc_vecnode(GC *self, unsigned long edit)
+{
+	Vecnode *node = calloc(1, sizeof(*node));
+	node->edit = edit;
+	return GC_init_object(self, node, VecnodeObject);
+}
+
 Object *GC_alloc_stack(GC *self)
 {
 	return GC_init_object(self, Stack_new(), StackObject);
 }
 
+// The builtins keep the objects they allocate alive while they call
+// back into the evaluator (a collection may happen), the last count of
+// the protected objects are unprotected
+void GC_protect(GC *self, Object *obj)
+{
+	if (self->nroots == self->croots) {
+		self->croots = self->croots ? self->croots * 2 : GC_INITIAL_THRESHOLD;
+		self->roots = reallocarray(self->roots, self->croots, sizeof(*self->roots));
+	}
+	self->roots[self->nroots] = obj;
+	self->nroots += 1;
+}
+
+void GC_unprotect(GC *self, int count)
+{
+	self->nroots -= count;
+}
+
 void GC_dump_objects(GC *self)
 {
 	for (Object *obj = self->first; obj != NULL; obj = obj->next) {
 		Object_println(obj);
 	}
 }
+
+void GC_print_stats(GC *self)
+{
+	fprintf(stderr, "gc: %lu envs, %lu closures, %lu numbers, %lu thunks, %lu cells allocated\n",
+		self->allocated[EnvObject],
+		self->allocated[FnObject] + self->allocated[CompfnObject],
+		self->allocated[NumObject] + self->allocated[IntObject],
+		self->allocated[ThunkObject] + self->allocated[CompthunkObject],
+		self->allocated[ListObject]
+	);
+}
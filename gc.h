@@ -3,15 +3,42 @@
 
 #include "object.h"
 #include "node.h"
+#include "values.h"
 
 #define GC_INITIAL_THRESHOLD 128
+#define GC_MAX_OBJECTS (1 << 23)
+#define GC_OBJECT_TYPES (StackObject + 1)
+#define GC_SPARE_NUMBERS 16
+// the data of the arrays counts as an object per that many bytes
+#define GC_OBJECT_BYTES 32
+
+// A part of the compiled code stack that is suspended by a call of
+// a builtin, it's scanned as well (see Builtin_call_comp)
+typedef struct Segment Segment;
+
+struct Segment {
+	void    *rsp;
+	void    *rbp;
+	Segment *prev;
+};
 
 typedef struct {
 	Object   *first;
 	Object   *last;
 	int      curr;
 	unsigned count;
+	unsigned long bytes; // the data of the arrays
 	unsigned thres;
+	Object   **pending; // marked objects that are not traced yet
+	int      npending;
+	int      cpending;
+	Object   **roots; // the objects only referenced from C, see GC_protect
+	int      nroots;
+	int      croots;
+	Segment  *segments;
+	Object   *spare[GC_SPARE_NUMBERS]; // the dead numbers that are reused, see GC_clear_env
+	int      nspare;
+	unsigned long allocated[GC_OBJECT_TYPES]; // per type, for -d
 } GC;
 
 typedef enum {
@@ -21,14 +48,33 @@ typedef enum {
 
 GC     *GC_new(void);
 void   GC_drop(GC *self);
-void   GC_collect(GC *self, Object *root, Object *stack);
+int    GC_collect(GC *self, Object *root, Object *stack);
 void   GC_collect_comp(GC *self, Object *root, void *rsp, void *rbp);
+void   GC_suspend_comp(GC *self, Segment *segment, void *rsp, void *rbp);
+void   GC_resume_comp(GC *self);
+void   GC_clear_env(GC *self, Object *env);
 Object *GC_alloc_env(GC *self, Object *prev);
-Object *GC_alloc_fn(GC *self, Object *env, const Node *body, const char *arg);
-Object *GC_alloc_compfn(GC *self, Object *env, void *text);
+Object *GC_alloc_fn(GC *self, Object *env, const Node *fn);
+Object *GC_alloc_compfn(GC *self, Object *env, void *text, const CompFnDesc *desc);
+Object *GC_alloc_callenv(GC *self, Object *fn, void *args, int count);
+Object *GC_alloc_tailenv(GC *self, Object *fn, void *args, int count, Object *caller);
 Object *GC_alloc_number(GC *self, double num);
+Object *GC_alloc_int(GC *self, long num);
+Object *GC_alloc_boxed(GC *self, Number num);
+Object *GC_alloc_op(GC *self, int op, Object *left, Object *right);
 Object *GC_alloc_thunk(GC *self, Object *env, const Node *body);
+Object *GC_alloc_builtin(GC *self, const BuiltinDesc *desc, int count, Object **args);
+Object *GC_alloc_stream(GC *self, StreamKind kind, Object *src, Object *fn, Number num);
+Object *GC_alloc_suspension(GC *self, Object *builtin);
+Object *GC_alloc_cell(GC *self, Object *head, Object *tail);
+Object *GC_alloc_array(GC *self, long length);
+Object *GC_alloc_map(GC *self, unsigned int bitmap, unsigned int leaves, long size);
+Object *GC_alloc_vector(GC *self, long size, int shift, Object *root, Object *tail);
+Object *GC_alloc_vecnode(GC *self, unsigned long edit);
 Object *GC_alloc_stack(GC *self);
+void   GC_protect(GC *self, Object *obj);
+void   GC_unprotect(GC *self, int count);
 void   GC_dump_objects(GC *self);
+void   GC_print_stats(GC *self);
 
 #endif // GC_INCLUDED
@@ -8,103 +8,169 @@
 #include "context.h"
 #include "error.h"
 #include "arena.h"
+#include "worklist.h"
 
 
 // TODO: better error messages
 
 #define ERROR_PREFIX "inference error"
 
-typedef struct Subst Subst;
+// The substitution binds the variables (by their numbers) to types,
+// it's only ever extended, so it's a table that is updated in place
+typedef struct {
+	Type **types;
+	int  size;
+} Subst;
 
-struct Subst {
-	int   var;
-	Type  *type;
-	Subst *prev;
-};
+static Subst *Subst_new(void)
+{
+	Subst *subs = malloc(sizeof(*subs));
+	subs->types = NULL;
+	subs->size = 0;
+	return subs;
+}
 
-// TODO: remove that garbage and make a normal struct for that
-#define SUBST_EMPTY (Subst *)1
+static void Subst_drop(Subst *subs)
+{
+	free(subs->types);
+	free(subs);
+}
 
-static Subst *Subst_extend(int var, Type *type, Subst *prev, Arena *a)
+static Subst *Subst_extend(int var, Type *type, Subst *subs)
 {
-	Subst *new = Arena_alloc(a, sizeof(*new));
-	new->var = var;
-	new->type = type;
-	new->prev = prev;
-	return new;
+	if (var >= subs->size) {
+		int size = subs->size ? subs->size : 64;
+		while (size <= var) {
+			size *= 2;
+		}
+		subs->types = reallocarray(subs->types, size, sizeof(*subs->types));
+		memset(subs->types + subs->size, 0, (size - subs->size) * sizeof(*subs->types));
+		subs->size = size;
+	}
+	subs->types[var] = type;
+	return subs;
 }
 
 static Type *Subst_lookup(const Subst *subs, int var)
 {
-	while (subs != SUBST_EMPTY) {
-		if (subs->var == var) {
-			return subs->type;
-		}
-		subs = subs->prev;
+	return var < subs->size ? subs->types[var] : NULL;
+}
+
+// The type a variable is bound to through the chain of the variables
+// bound to each other. NOTE: the chain is shortened to a single step,
+// so long chains (an operation on the result of another one) are only
+// followed once.
+static Type *resolve(Type *type, Subst *subs)
+{
+	Type *end = type;
+	for (Type *val; (end->kind == VarType || end->kind == NumericType) &&
+			(val = Subst_lookup(subs, VarType_value(end)));) {
+		end = val;
 	}
-	return NULL;
+	while (type != end && (type->kind == VarType || type->kind == NumericType)) {
+		Type *next = Subst_lookup(subs, VarType_value(type));
+		subs->types[VarType_value(type)] = end;
+		type = next;
+	}
+	return end;
 }
 
-static int occurs(Type *var, Type *type, const Subst *subs)
+static int occurs(Type *var, Type *type, Subst *subs)
 {
-	if (type->kind == VarType) {
-		if (VarType_value(type) == VarType_value(var)) {
-			return 1;
+	static Worklist(Type *) pending = WORKLIST_EMPTY;
+	pending.size = 0;
+	int found = 0;
+	Worklist_push(&pending, type);
+	while (!found && !Worklist_empty(&pending)) {
+		type = resolve(Worklist_pop(&pending), subs);
+		if (type->kind == VarType || type->kind == NumericType) {
+			found = VarType_value(type) == VarType_value(var);
+		} else if (type->kind == FnType) {
+			Worklist_push(&pending, FnType_to(type));
+			Worklist_push(&pending, FnType_from(type));
+		} else if (type->kind == ConType && ConType_arg(type)) {
+			Worklist_push(&pending, ConType_arg(type));
 		}
-		Type *val = Subst_lookup(subs, VarType_value(type));
-		return val && occurs(var, val, subs);
 	}
-	if (type->kind == FnType) {
-		return (
-			occurs(var, FnType_from(type), subs) ||
-			occurs(var, FnType_to(type), subs)
-		);
-	}
-	return 0;
+	return found;
 }
 
-static Subst *unify(Type *t1, Type *t2, Subst *subs, Arena *a);
+// The unification is a list of the pairs of types to unify, the pairs
+// of the parts of functions and constructors are added, solved in order
+typedef struct {
+	Type *t1;
+	Type *t2;
+} Unified;
+
+typedef Worklist(Unified) Unifieds;
 
-static Subst *unify_var(Type *t1, Type *t2, Subst *subs, Arena *a)
+// NOTE: the pairs are pushed in the reverse order
+#define unify_later(pending, t1, t2) (Worklist_push(pending, t1, t2))
+
+// NOTE: the variables are unbound, see unify
+static Subst *unify_var(Type *t1, Type *t2, Subst *subs)
 {
-	Type *v1 = Subst_lookup(subs, VarType_value(t1));
-	if (v1) {
-		return unify(v1, t2, subs, a);
-	}
-	if (t2->kind == VarType) {
-		if (VarType_value(t1) == VarType_value(t2)) {
-			return subs;
-		}
-		Type *v2 = Subst_lookup(subs, VarType_value(t2));
-		if (v2) {
-			return unify(t1, v2, subs, a);
-		}
+	if (t2->kind == VarType && VarType_value(t1) == VarType_value(t2)) {
+		return subs;
 	}
 	if (occurs(t1, t2, subs)) {
 		error("recursive type");
 		return NULL;
 	}
-	return Subst_extend(VarType_value(t1), t2, subs, a);
+	return Subst_extend(VarType_value(t1), t2, subs);
 }
 
-static Subst *unify_fn(Type *f1, Type *f2, Subst *subs, Arena *a)
+static Subst *unify_fn(Type *f1, Type *f2, Subst *subs, Unifieds *pending)
 {
-	subs = unify(FnType_from(f1), FnType_from(f2), subs, a);
-	if (!subs) {
+	unify_later(pending, FnType_to(f1), FnType_to(f2));
+	unify_later(pending, FnType_from(f1), FnType_from(f2));
+	return subs;
+}
+
+static Subst *unify_con(Type *c1, Type *c2, Subst *subs, Unifieds *pending)
+{
+	if (ConType_name(c1) != ConType_name(c2)) {
+		error("ununifiable types");
 		return NULL;
 	}
-	return unify(FnType_to(f1), FnType_to(f2), subs, a);
+	if (ConType_arg(c1)) {
+		unify_later(pending, ConType_arg(c1), ConType_arg(c2));
+	}
+	return subs;
 }
 
-static Subst *unify(Type *t1, Type *t2, Subst *subs, Arena *a)
+// A numeric variable is either bound to another one or to one
+// of the number types. NOTE: the plain variables are bound to it first.
+static Subst *unify_numeric(Type *n, Type *t, Subst *subs)
 {
+	if (t->kind == NumericType) {
+		if (VarType_value(n) == VarType_value(t)) {
+			return subs;
+		}
+	} else if (t->kind != NumType && t->kind != IntType) {
+		error("ununifiable types");
+		return NULL;
+	}
+	return Subst_extend(VarType_value(n), t, subs);
+}
+
+static Subst *unify_step(Type *t1, Type *t2, Subst *subs, Unifieds *pending)
+{
+	t1 = resolve(t1, subs);
+	t2 = resolve(t2, subs);
 	if (t1->kind == VarType) {
-		return unify_var(t1, t2, subs, a);
+		return unify_var(t1, t2, subs);
 	} else if (t2->kind == VarType) {
-		return unify_var(t2, t1, subs, a);
+		return unify_var(t2, t1, subs);
+	} else if (t1->kind == NumericType) {
+		return unify_numeric(t1, t2, subs);
+	} else if (t2->kind == NumericType) {
+		return unify_numeric(t2, t1, subs);
 	} else if (t1->kind == t2->kind) {
 		if (t1->kind == FnType) {
-			return unify_fn(t1, t2, subs, a);
+			return unify_fn(t1, t2, subs, pending);
+		} else if (t1->kind == ConType) {
+			return unify_con(t1, t2, subs, pending);
 		} else {
 			return subs;
 		}
@@ -113,46 +179,136 @@ static Subst *unify(Type *t1, Type *t2, Subst *subs, Arena *a)
 	return NULL;
 }
 
-static Type *substitute(Type *mono, const Subst *subs, int recursive, Arena *a)
+// NOTE: unify is not reentrant, so the list is reused
+static Subst *unify(Type *t1, Type *t2, Subst *subs)
+{
+	static Unifieds pending = WORKLIST_EMPTY;
+	pending.size = 0;
+	unify_later(&pending, t1, t2);
+	while (subs && !Worklist_empty(&pending)) {
+		Unified u = Worklist_pop(&pending);
+		subs = unify_step(u.t1, u.t2, subs, &pending);
+	}
+	return subs;
+}
+
+// NOTE: the frames of substitute, from is the substituted argument
+// of a function type once it's done
+typedef struct {
+	Type *type;
+	Type *from;
+	int  step;
+} Substituting;
+
+// NOTE: only the substitution of the inference is recursive (the types
+// the variables are bound to are substituted too), the ones of refresh
+// map the numbers of a different type. The children are substituted in
+// order and the result of one is returned to the topmost frame.
+static Type *substitute(Type *mono, Subst *subs, int recursive, Arena *a)
 {
-	switch (mono->kind) {
-		case VarType:
-			Type *val = Subst_lookup(subs, VarType_value(mono));
-			if (!val) {
-				return mono;
+	Worklist(Substituting) frames = WORKLIST_EMPTY;
+	Type *value = NULL;
+	for (;;) {
+		switch (mono->kind) {
+			case VarType:
+			case NumericType:
+				if (recursive) {
+					Type *val = resolve(mono, subs);
+					if (val != mono) {
+						mono = val;
+						continue;
+					}
+					value = mono;
+					break;
+				}
+				value = Subst_lookup(subs, VarType_value(mono));
+				if (!value) {
+					value = mono;
+				}
+				break;
+			case NumType:
+			case IntType:
+				value = mono;
+				break;
+			case FnType:
+				Worklist_push(&frames, mono, NULL, 0);
+				mono = FnType_from(mono);
+				continue;
+			case ConType:
+				if (!ConType_arg(mono)) {
+					value = mono;
+					break;
+				}
+				Worklist_push(&frames, mono, NULL, 0);
+				mono = ConType_arg(mono);
+				continue;
+			case GenType:
+				error("unexpected polytype");
+				Worklist_destroy(&frames);
+				return NULL;
+		}
+		// return the result until a frame needs another child
+		mono = NULL;
+		while (!mono && !Worklist_empty(&frames)) {
+			Substituting *frame = Worklist_top(&frames);
+			Type *parent = frame->type;
+			if (parent->kind == FnType && frame->step == 0) {
+				frame->from = value;
+				frame->step = 1;
+				mono = FnType_to(parent);
+				continue;
 			}
-			if (recursive) {
-				return substitute(val, subs, recursive, a);
+			if (parent->kind == FnType) {
+				value = FnType_new(a, frame->from, value);
+			} else {
+				value = ConType_new(a, ConType_name(parent), value);
 			}
-			return val;
-		case NumType:
-			return NumType_get();
-		case FnType:
-			Type *new_from = substitute(FnType_from(mono), subs, recursive, a);
-			Type *new_to = substitute(FnType_to(mono), subs, recursive, a);
-			return FnType_new(a, new_from, new_to);
-		case GenType:
-			error("unexpected polytype");
+			Worklist_drop(&frames);
+		}
+		if (!mono) {
+			Worklist_destroy(&frames);
+			return value;
+		}
 	}
-	return NULL;
 }
 
+// NOTE: the variables are numbered in the order they appear in
 static Subst *refresh(Type *mono, Subst *subs, Arena *a)
 {
-	switch (mono->kind) {
-		case VarType:
-			if (Subst_lookup(subs, VarType_value(mono))) {
-				return subs;
-			}
-			return Subst_extend(VarType_value(mono), VarType_new(a), subs, a);
-		case FnType:
-			return refresh(FnType_to(mono), refresh(FnType_from(mono), subs, a), a);
-		case NumType:
-			return subs;
-		case GenType:
-			error("unexpected polytype");
+	Worklist(Type *) pending = WORKLIST_EMPTY;
+	Worklist_push(&pending, mono);
+	while (subs && !Worklist_empty(&pending)) {
+		mono = Worklist_pop(&pending);
+		switch (mono->kind) {
+			case VarType:
+				if (!Subst_lookup(subs, VarType_value(mono))) {
+					subs = Subst_extend(VarType_value(mono), VarType_new(a), subs);
+				}
+				break;
+			case NumericType:
+				if (!Subst_lookup(subs, VarType_value(mono))) {
+					subs = Subst_extend(VarType_value(mono), NumericType_new(a), subs);
+				}
+				break;
+			case FnType:
+				Worklist_push(&pending, FnType_to(mono));
+				Worklist_push(&pending, FnType_from(mono));
+				break;
+			case ConType:
+				if (ConType_arg(mono)) {
+					Worklist_push(&pending, ConType_arg(mono));
+				}
+				break;
+			case NumType:
+			case IntType:
+				break;
+			case GenType:
+				error("unexpected polytype");
+				subs = NULL;
+		}
 	}
-	return NULL;
+	Worklist_destroy(&pending);
+	return subs;
 }
 
 static Type *instantiate(Type *type, Arena *a)
@@ -160,20 +316,34 @@ static Type *instantiate(Type *type, Arena *a)
 	if (type->kind != GenType) {
 		return type;
 	}
-	Subst *subs = refresh(GenType_inner(type), SUBST_EMPTY, a);
+	Subst *subs = refresh(GenType_inner(type), Subst_new(), a);
 	Type *mono = substitute(GenType_inner(type), subs, 0, a);
+	Subst_drop(subs);
 	return mono;
 }
 
 static Type *generalize(Type *mono, Arena *a)
 {
 	VarType_reset();
-	Subst *subs = refresh(mono, SUBST_EMPTY, a);
+	Subst *subs = refresh(mono, Subst_new(), a);
 	Type *gen = GenType_new(a, substitute(mono, subs, 0, a));
+	Subst_drop(subs);
 	return gen;
 }
 
-static Subst *M(const Node *expr, TypeEnv *env, Subst *subs, Type *target, Arena *a);
+// The inference is a list of goals: the expression has the target type
+// in the env. The substitution is updated in place, so an expression
+// is handled by adding the goals of its children, they are solved in order.
+typedef struct {
+	const Node *expr;
+	TypeEnv    *env;
+	Type       *target;
+} Goal;
+
+typedef Worklist(Goal) Goals;
+
+// NOTE: the goals are pushed in the reverse order
+#define M_goal(goals, expr, env, target) (Worklist_push(goals, expr, env, target))
 
 static Subst *M_id(const Node *id, TypeEnv *env, Subst *subs, Type *target, Arena *a)
 {
@@ -183,111 +353,175 @@ static Subst *M_id(const Node *id, TypeEnv *env, Subst *subs, Type *target, Aren
 		return NULL;
 	}
 	id_type = instantiate(id_type, a);
-	subs = unify(target, id_type, subs, a);
+	subs = unify(target, id_type, subs);
 	return subs;
 }
 
-static Subst *M_if(const Node *ifelse, TypeEnv *env, Subst *subs, Type *target, Arena *a)
+static Subst *M_if(const Node *ifelse, TypeEnv *env, Subst *subs, Type *target, Goals *goals, Arena *a)
 {
-	subs = M(IfNode_cond(ifelse), env, subs, NumType_get(), a);
-	if (!subs) {
-		return NULL;
-	}
-	subs = M(IfNode_true(ifelse), env, subs, target, a);
-	if (!subs) {
-		return NULL;
-	}
-	return M(IfNode_false(ifelse), env, subs, target, a);
+	M_goal(goals, IfNode_false(ifelse), env, target);
+	M_goal(goals, IfNode_true(ifelse), env, target);
+	M_goal(goals, IfNode_cond(ifelse), env, NumericType_new(a));
+	return subs;
 }
 
-static Subst *M_fn(const Node *fn, TypeEnv *env, Subst *subs, Type *target, Arena *a)
+static TypeEnv *M_extend(const char *name, Type *type, TypeEnv *env, Arena *a)
+{
+	TypeEnv *extended = Arena_alloc(a, sizeof(*extended));
+	*extended = (TypeEnv){(char *)name, type, 0, env};
+	return extended;
+}
+
+static Subst *M_fn(const Node *fn, TypeEnv *env, Subst *subs, Type *target, Goals *goals, Arena *a)
 {
 	Type *arg_type = VarType_new(a);
 	Type *body_type = VarType_new(a);
 	Type *fn_type = FnType_new(a, arg_type, body_type);
-	subs = unify(target, fn_type, subs, a);
+	subs = unify(target, fn_type, subs);
 	if (!subs) {
 		return NULL;
 	}
-	TypeEnv extended = {FnNode_param_value(fn), arg_type, env};
-	subs = M(FnNode_body(fn), &extended, subs, body_type, a);
+	TypeEnv *extended = M_extend(FnNode_param_value(fn), arg_type, env, a);
+	M_goal(goals, FnNode_body(fn), extended, body_type);
 	return subs;
 }
 
-static Subst *M_pair(const Node *pair, TypeEnv *env, Subst *subs, Type *target, Arena *a)
+// The operands of an arithmetic operation (or of 'and' and 'or') have
+// the same type as the result. The operands of a division or of
+// a comparison may be different, the result is a double or 0 or 1
+// (which is also a double, like the integer literals).
+static Subst *M_pair(const Node *pair, TypeEnv *env, Subst *subs, Type *target, Goals *goals, Arena *a)
 {
-	subs = unify(target, NumType_get(), subs, a);
-	if (!subs) {
-		return NULL;
+	Type *left = NumericType_new(a);
+	Type *right = left;
+	switch (PairNode_op(pair)) {
+		case '/':
+			right = NumericType_new(a);
+			subs = unify(target, NumType_get(), subs);
+			break;
+		case '>':
+		case '<':
+		case '=':
+			right = NumericType_new(a);
+			subs = unify(target, NumericType_new(a), subs);
+			break;
+		default:
+			subs = unify(target, left, subs);
 	}
-	subs = M(PairNode_left(pair), env, subs, target, a);
 	if (!subs) {
 		return NULL;
 	}
-	return M(PairNode_right(pair), env, subs, target, a);
+	M_goal(goals, PairNode_right(pair), env, right);
+	M_goal(goals, PairNode_left(pair), env, left);
+	return subs;
 }
 
-static Subst *M_application(const Node *appl, TypeEnv *env, Subst *subs, Type *target, Arena *a)
+static Subst *M_application(const Node *appl, TypeEnv *env, Subst *subs, Type *target, Goals *goals, Arena *a)
 {
 	Type *operand_type = VarType_new(a);
 	Type *operator_type = FnType_new(a, operand_type, target);
-	subs = M(PairNode_left(appl), env, subs, operator_type, a);
-	if (!subs) {
-		return NULL;
-	}
-	subs = M(PairNode_right(appl), env, subs, operand_type, a);
+	M_goal(goals, PairNode_right(appl), env, operand_type);
+	M_goal(goals, PairNode_left(appl), env, operator_type);
 	return subs;
 }
 
-static Subst *M_let(const Node *let, TypeEnv *env, Subst *subs, Type *target, Arena *a)
+static Subst *M_let(const Node *let, TypeEnv *env, Subst *subs, Type *target, Goals *goals, Arena *a)
 {
-	TypeEnv extended = {LetNode_name_value(let), target, env};
-	subs = M(LetNode_value(let), &extended, subs, target, a);
+	TypeEnv *extended = M_extend(LetNode_name_value(let), target, env, a);
+	M_goal(goals, LetNode_value(let), extended, target);
 	return subs;
 }
 
-static Subst *M(const Node *expr, TypeEnv *env, Subst *subs, Type *target, Arena *a)
+static Subst *M_step(const Node *expr, TypeEnv *env, Subst *subs, Type *target, Goals *goals, Arena *a)
 {
 	switch (expr->type) {
 		case NumberNode:
-			return unify(target, NumType_get(), subs, a);
+			// NOTE: an integer is also a double
+			if (NumNode_value(expr).exact) {
+				return unify(target, NumericType_new(a), subs);
+			}
+			return unify(target, NumType_get(), subs);
 		case IdNode:
 			return M_id(expr, env, subs, target, a);
 		case IfNode:
-			return M_if(expr, env, subs, target, a);
+			return M_if(expr, env, subs, target, goals, a);
 		case FnNode:
-			return M_fn(expr, env, subs, target, a);
+			return M_fn(expr, env, subs, target, goals, a);
 		case SumNode:
 		case ProdNode:
 		case ExptNode:
 		case CmpNode:
 		case AndNode:
 		case OrNode:
-			return M_pair(expr, env, subs, target, a);
+		case NumAddNode:
+		case NumSubNode:
+		case NumMulNode:
+		case NumDivNode:
+		case NumModNode:
+		case NumPowNode:
+		case NumGtNode:
+		case NumLtNode:
+		case NumEqNode:
+			return M_pair(expr, env, subs, target, goals, a);
 		case ApplNode:
-			return M_application(expr, env, subs, target, a);
+			return M_application(expr, env, subs, target, goals, a);
 		case LetNode:
-			return M_let(expr, env, subs, target, a);
+			return M_let(expr, env, subs, target, goals, a);
+		case GuardNode:
+			// NOTE: inlining is done after the inference
+			M_goal(goals, GuardNode_original(expr), env, target);
+			return subs;
 	}
 	return NULL;
 }
 
+static Subst *M(const Node *expr, TypeEnv *env, Subst *subs, Type *target, Arena *a)
+{
+	Goals goals = WORKLIST_EMPTY;
+	M_goal(&goals, expr, env, target);
+	while (subs && !Worklist_empty(&goals)) {
+		Goal goal = Worklist_pop(&goals);
+		subs = M_step(goal.expr, goal.env, subs, goal.target, &goals, a);
+	}
+	Worklist_destroy(&goals);
+	return subs;
+}
+
+// A builtin that the program fails to redefine is hidden, so the names
+// used later are not checked against the builtin (the same as before
+// the builtin existed)
+static void reject(const Node *expr, TypeEnv **tenv)
+{
+	if (expr->type != LetNode) {
+		return;
+	}
+	const char *name = LetNode_name_value(expr);
+	TypeEnv *old = TypeEnv_find(*tenv, name);
+	if (old && old->builtin) {
+		TypeEnv_push(tenv, name, NULL, 0);
+	}
+}
+
 Type *infer(const Node *expr, TypeEnv **tenv, Arena *a)
 {
 	Type *target = VarType_new(a);
-	Subst *subs = M(expr, *tenv, SUBST_EMPTY, target, a);
-	if (!subs) {
+	Subst *subs = Subst_new();
+	if (!M(expr, *tenv, subs, target, a)) {
+		Subst_drop(subs);
+		reject(expr, tenv);
 		return NULL;
 	}
 	Type *mono = substitute(target, subs, 1, a);
+	Subst_drop(subs);
 	Type *poly = generalize(mono, a);
 	if (expr->type == LetNode) {
 		const char *name = LetNode_name_value(expr);
 		Type *old = TypeEnv_lookup(*tenv, name);
 		if (!old) {
-			TypeEnv_push(tenv, name, poly);
+			TypeEnv_push(tenv, name, poly, 0);
 		} else if (!Type_eq(old, poly)) {
 			error("symbol type cannot change");
+			reject(expr, tenv);
 			return NULL;
 		}
 	}
@@ -0,0 +1,591 @@
+#include "inline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "node.h"
+#include "arena.h"
+#include "opts.h"
+#include "worklist.h"
+
+
+// Inlining of small global functions: a call of a known function with
+// all of its arguments is replaced by its body with the arguments
+// substituted for the parameters. The result is guarded (see GuardNode),
+// so the function is called as usual once any global is redefined.
+
+#define KNOWN_ARENA_PAGE_SIZE 4096
+
+// NOTE: fn is NULL for the globals that can't be inlined,
+// bound is 0 if the global was never defined successfully
+typedef struct Known Known;
+
+struct Known {
+	const char *name;
+	const Node *fn;
+	int        bound;
+	Known      *next;
+};
+
+// the names bound around the call site
+typedef struct Scope Scope;
+
+struct Scope {
+	const char  *name;
+	const Scope *prev;
+};
+
+// NOTE: value is NULL if the name is shadowed,
+// valued is the nearest replacement (this or an earlier one) with a value
+typedef struct Replace Replace;
+
+struct Replace {
+	const char    *name;
+	Node          *value;
+	const Replace *prev;
+	const Replace *valued;
+};
+
+// NOTE: the frames of subst, the step is the number of the children that
+// are already copied (the results are kept in copied), inner replaces the
+// parameter of a function in its body
+typedef struct {
+	const Node    *expr;
+	const Replace *replace;
+	Replace       *inner;
+	int           step;
+	Node          *copied[NODE_MAX_CHILDREN - 1];
+} Copying;
+
+// NOTE: the frames of inline_expr, the same as in subst, known is the
+// function whose call is inlined, its arguments are kept in replace
+typedef struct {
+	Node        *expr;
+	const Scope *scope;
+	Scope       *inner;
+	const Known *known;
+	Replace     *replace;
+	int         count;
+	int         step;
+	Node        *inlined[NODE_MAX_CHILDREN - 1];
+} Inlining;
+
+typedef struct {
+	const Node *expr;
+	int        weight;
+} Use;
+
+// NOTE: depth is the number of the parameters of the functions around it
+typedef struct {
+	const Node *expr;
+	int        depth;
+} Nested;
+
+// the known functions outlive the parsed lines
+static Arena known_arena;
+static Known *known = NULL;
+static unsigned long inlined = 0;
+
+static Known *lookup(const char *name)
+{
+	for (Known *k = known; k; k = k->next) {
+		if (!strcmp(k->name, name)) {
+			return k;
+		}
+	}
+	return NULL;
+}
+
+static int bound(const char *name, const Scope *scope)
+{
+	for (; scope; scope = scope->prev) {
+		if (!strcmp(scope->name, name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int size(const Node *expr)
+{
+	Worklist(const Node *) pending = WORKLIST_EMPTY;
+	int count = 0;
+	Worklist_push(&pending, expr);
+	while (!Worklist_empty(&pending)) {
+		Node *children[NODE_MAX_CHILDREN];
+		int n = Node_children(Worklist_pop(&pending), children);
+		for (int i = 0; i < n; i++) {
+			Worklist_push(&pending, children[i]);
+		}
+		count += 1;
+	}
+	Worklist_destroy(&pending);
+	return count;
+}
+
+// The number of times the variable is used, the uses inside
+// of functions count twice (they might be evaluated many times)
+static int uses(const Node *expr, const char *name, int weight)
+{
+	Worklist(Use) pending = WORKLIST_EMPTY;
+	int count = 0;
+	Worklist_push(&pending, expr, weight);
+	while (!Worklist_empty(&pending)) {
+		Use use = Worklist_pop(&pending);
+		switch (use.expr->type) {
+			case IdNode:
+				if (!strcmp(IdNode_value(use.expr), name)) {
+					count += use.weight;
+				}
+				break;
+			case FnNode:
+				if (strcmp(FnNode_param_value(use.expr), name)) {
+					Worklist_push(&pending, FnNode_body(use.expr), 2);
+				}
+				break;
+			default: {
+				Node *children[NODE_MAX_CHILDREN];
+				int n = Node_children(use.expr, children);
+				for (int i = 0; i < n; i++) {
+					Worklist_push(&pending, children[i], use.weight);
+				}
+			}
+		}
+	}
+	Worklist_destroy(&pending);
+	return count;
+}
+
+// Whether any free variable of the expression (except for the bound ones)
+// is in the scope
+static int captured(const Node *expr, const Scope *bnd, const Scope *scope)
+{
+	Worklist(Nested) pending = WORKLIST_EMPTY;
+	// the parameters of the functions around the node looked at
+	Worklist(const char *) params = WORKLIST_EMPTY;
+	int found = 0;
+	Worklist_push(&pending, expr, 0);
+	while (!found && !Worklist_empty(&pending)) {
+		Nested nested = Worklist_pop(&pending);
+		params.size = nested.depth;
+		switch (nested.expr->type) {
+			case IdNode: {
+				const char *name = IdNode_value(nested.expr);
+				found = !bound(name, bnd) && bound(name, scope);
+				for (int i = 0; found && i < params.size; i++) {
+					found = strcmp(params.items[i], name);
+				}
+				break;
+			}
+			case FnNode:
+				Worklist_push(&params, FnNode_param_value(nested.expr));
+				Worklist_push(&pending, FnNode_body(nested.expr), nested.depth + 1);
+				break;
+			default: {
+				Node *children[NODE_MAX_CHILDREN];
+				int n = Node_children(nested.expr, children);
+				for (int i = 0; i < n; i++) {
+					Worklist_push(&pending, children[i], nested.depth);
+				}
+			}
+		}
+	}
+	Worklist_destroy(&pending);
+	Worklist_destroy(&params);
+	return found;
+}
+
+static void replace_init(Replace *self, const char *name, Node *value, const Replace *prev)
+{
+	*self = (Replace){name, value, prev, value ? self : prev ? prev->valued : NULL};
+}
+
+// Whether the variable is free in any of the substituted values
+static int free_in_values(const char *name, const Replace *r)
+{
+	for (r = r ? r->valued : NULL; r; r = r->prev ? r->prev->valued : NULL) {
+		Scope scope = {name, NULL};
+		if (captured(r->value, NULL, &scope)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static Node *fresh(const char *name)
+{
+	static int id = 0;
+	char buf[256];
+	// NOTE: the quote can't appear in the source, so the name is unique
+	int length = snprintf(buf, sizeof(buf), "%.200s'%d", name, id);
+	id += 1;
+	return IdNode_new(buf, length);
+}
+
+static Node *subst_id(const Node *expr, const Replace *r)
+{
+	for (; r; r = r->prev) {
+		if (!strcmp(r->name, IdNode_value(expr))) {
+			break;
+		}
+	}
+	if (r && r->value) {
+		return r->value;
+	}
+	return IdNode_new(IdNode_value(expr), strlen(IdNode_value(expr)));
+}
+
+// The copy of the node from the copies of its children, the last one is copied
+static Node *subst_node(const Copying *frame, Node *last)
+{
+	const Node *expr = frame->expr;
+	switch (expr->type) {
+		case IfNode:
+			return IfNode_new(frame->copied[0], frame->copied[1], last);
+		case FnNode: {
+			const char *name = FnNode_param_value(expr);
+			Node *param = frame->inner->value ? frame->inner->value : IdNode_new(name, strlen(name));
+			Node *fn = FnNode_new(param, last);
+			FnNode_lazy(fn) = FnNode_lazy(expr);
+			FnNode_strict(fn) = FnNode_strict(expr);
+			FnNode_saturated(fn) = FnNode_saturated(expr);
+			return fn;
+		}
+		case LetNode:
+			return LetNode_new(subst_id(LetNode_name(expr), NULL), last);
+		case GuardNode:
+			return GuardNode_new(frame->copied[0], last, GuardNode_version(expr));
+		default:
+			return OpNode_new(frame->copied[0], last, expr->type, PairNode_op(expr));
+	}
+}
+
+// Copy the expression replacing the variables, the functions
+// that would capture the free variables of the values are renamed.
+// The children are copied in order and the copy of one is returned
+// to the topmost frame.
+static Node *subst(const Node *expr, const Replace *r)
+{
+	Worklist(Copying) frames = WORKLIST_EMPTY;
+	Node *value = NULL;
+	for (;;) {
+		switch (expr->type) {
+			case NumberNode:
+				value = NumberNode_new(NumNode_value(expr));
+				break;
+			case IdNode:
+				value = subst_id(expr, r);
+				break;
+			case FnNode: {
+				// NOTE: the replacements are linked, so they can't be kept in the frames
+				const char *name = FnNode_param_value(expr);
+				Replace *inner = malloc(sizeof(*inner));
+				replace_init(inner, name, free_in_values(name, r) ? fresh(name) : NULL, r);
+				Worklist_push(&frames, .expr = expr, .replace = r, .inner = inner);
+				expr = FnNode_body(expr);
+				r = inner;
+				continue;
+			}
+			default: {
+				Node *children[NODE_MAX_CHILDREN];
+				Node_children(expr, children);
+				Worklist_push(&frames, .expr = expr, .replace = r);
+				expr = children[0];
+				continue;
+			}
+		}
+		// return the copy until a frame needs another child
+		expr = NULL;
+		while (!expr && !Worklist_empty(&frames)) {
+			Copying *frame = Worklist_top(&frames);
+			Node *children[NODE_MAX_CHILDREN];
+			int count = Node_children(frame->expr, children);
+			r = frame->replace;
+			if (frame->step < count - 1) {
+				frame->copied[frame->step] = value;
+				frame->step += 1;
+				expr = children[frame->step];
+				continue;
+			}
+			value = subst_node(frame, value);
+			free(frame->inner);
+			Worklist_drop(&frames);
+		}
+		if (!expr) {
+			Worklist_destroy(&frames);
+			return value;
+		}
+	}
+}
+
+// The i-th of the count arguments of the call
+static Node *argument(Node *expr, int count, int i)
+{
+	for (int j = count - 1; j > i; j--) {
+		expr = PairNode_left(expr);
+	}
+	return PairNode_right(expr);
+}
+
+// Whether the variable is surely bound when the call site is evaluated
+static int defined(const char *name, const Scope *scope)
+{
+	if (bound(name, scope)) {
+		return 1;
+	}
+	Known *k = lookup(name);
+	return k && k->bound;
+}
+
+// Whether the argument can replace the parameter without changing the
+// meaning of the program: it must be evaluated at most once, and in the
+// strict mode it must be evaluated anyway. Literals and bound variables are
+// cheap to evaluate many times (and can't fail), an unbound variable must be
+// reported even if the parameter is not used.
+static int substitutable(const Node *fn, const Node *body, const Node *arg, const Scope *scope)
+{
+	if (arg->type == NumberNode || (arg->type == IdNode && defined(IdNode_value(arg), scope))) {
+		return 1;
+	}
+	int n = uses(body, FnNode_param_value(fn), 1);
+	if (n > 1) {
+		return 0;
+	}
+	if (lazy || FnNode_lazy(fn) || arg->type == FnNode) {
+		return 1;
+	}
+	return n == 1 && FnNode_saturated(fn);
+}
+
+// The known function if the call can be inlined, head is the head
+// of the application and n is the number of its arguments
+static const Known *inlinable(Node *expr, const Node *head, int n, const Scope *scope)
+{
+	if (head->type != IdNode || bound(IdNode_value(head), scope)) {
+		return NULL;
+	}
+	Known *k = lookup(IdNode_value(head));
+	if (!k || !k->fn || FnNode_arity(k->fn) != n) {
+		return NULL;
+	}
+	const Node *body = k->fn;
+	for (int i = 0; i < n; i++) {
+		body = FnNode_body(body);
+	}
+	// the globals used by the function must not be shadowed at the call site
+	Scope params[n];
+	const Node *fn = k->fn;
+	for (int i = 0; i < n; i++) {
+		params[i] = (Scope){FnNode_param_value(fn), i ? &params[i - 1] : NULL};
+		fn = FnNode_body(fn);
+	}
+	if (captured(body, &params[n - 1], scope)) {
+		return NULL;
+	}
+	fn = k->fn;
+	for (int i = 0; i < n; i++) {
+		// a parameter shadowed by a later one is not used at all
+		if (!substitutable(fn, body, argument(expr, n, i), scope)) {
+			return NULL;
+		}
+		fn = FnNode_body(fn);
+	}
+	return k;
+}
+
+// The call with the arguments (already inlined) substituted for the parameters
+// NOTE: the original call is kept as it is, so the code doesn't
+// grow exponentially with the nesting of the inlined calls, the code
+// in the arguments is still there twice, so only the calls nested in
+// fewer than INLINE_MAX_NESTING inlined calls are inlined
+static Node *inline_call(Node *expr, const Known *k, const Replace *replace, int count, unsigned version)
+{
+	const Node *body = k->fn;
+	for (int i = 0; i < count; i++) {
+		body = FnNode_body(body);
+	}
+	inlined += 1;
+	return GuardNode_new(subst(body, &replace[count - 1]), expr, version);
+}
+
+// The node from the results of its children, the last one is inlined
+static Node *inline_node(const Inlining *frame, Node *last)
+{
+	Node *expr = frame->expr;
+	switch (expr->type) {
+		case IfNode:
+			if (frame->inlined[0] == IfNode_cond(expr) && frame->inlined[1] == IfNode_true(expr) && last == IfNode_false(expr)) {
+				return expr;
+			}
+			return IfNode_new(frame->inlined[0], frame->inlined[1], last);
+		case FnNode: {
+			if (last == FnNode_body(expr)) {
+				return expr;
+			}
+			Node *fn = FnNode_new(FnNode_param(expr), last);
+			FnNode_lazy(fn) = FnNode_lazy(expr);
+			return fn;
+		}
+		case LetNode:
+			if (last == LetNode_value(expr)) {
+				return expr;
+			}
+			return LetNode_new(LetNode_name(expr), last);
+		default:
+			if (frame->inlined[0] == PairNode_left(expr) && last == PairNode_right(expr)) {
+				return expr;
+			}
+			return OpNode_new(frame->inlined[0], last, expr->type, PairNode_op(expr));
+	}
+}
+
+// The children are inlined in order and the result of one is returned to
+// the topmost frame, the arguments of an inlined call are inlined instead
+static Node *inline_expr(Node *expr, const Scope *scope, unsigned version)
+{
+	Worklist(Inlining) frames = WORKLIST_EMPTY;
+	// the head of the application looked at and the number of its arguments
+	// (if it's a part of the spine already looked at)
+	const Node *head = NULL;
+	int count = 0;
+	// the number of the inlined calls whose arguments are looked at
+	int nesting = 0;
+	Node *value = NULL;
+	for (;;) {
+		switch (expr->type) {
+			case NumberNode:
+			case IdNode:
+			case GuardNode:
+				value = expr;
+				break;
+			case FnNode: {
+				// NOTE: the scopes are linked, so they can't be kept in the frames
+				Scope *inner = malloc(sizeof(*inner));
+				*inner = (Scope){FnNode_param_value(expr), scope};
+				Worklist_push(&frames, .expr = expr, .scope = scope, .inner = inner);
+				expr = FnNode_body(expr);
+				scope = inner;
+				head = NULL;
+				continue;
+			}
+			case ApplNode: {
+				if (!head) {
+					count = 0;
+					for (head = expr; head->type == ApplNode; head = PairNode_left(head)) {
+						count += 1;
+					}
+				}
+				const Known *k = nesting < INLINE_MAX_NESTING ? inlinable(expr, head, count, scope) : NULL;
+				if (k) {
+					Replace *replace = malloc(count * sizeof(*replace));
+					Worklist_push(&frames, .expr = expr, .scope = scope, .known = k, .replace = replace, .count = count);
+					expr = argument(expr, count, 0);
+					head = NULL;
+					nesting += 1;
+					continue;
+				}
+			}
+			// fallthrough
+			default: {
+				Node *children[NODE_MAX_CHILDREN];
+				Node_children(expr, children);
+				Worklist_push(&frames, .expr = expr, .scope = scope);
+				// the rest of the spine has the same head
+				if (expr->type == ApplNode && children[0]->type == ApplNode) {
+					count -= 1;
+				} else {
+					head = NULL;
+				}
+				expr = children[0];
+				continue;
+			}
+		}
+		// return the result until a frame needs another child
+		expr = NULL;
+		while (!expr && !Worklist_empty(&frames)) {
+			Inlining *frame = Worklist_top(&frames);
+			Node *parent = frame->expr;
+			scope = frame->scope;
+			head = NULL;
+			if (frame->known) {
+				int i = frame->step;
+				const Node *fn = frame->known->fn;
+				for (int j = 0; j < i; j++) {
+					fn = FnNode_body(fn);
+				}
+				replace_init(&frame->replace[i], FnNode_param_value(fn), value, i ? &frame->replace[i - 1] : NULL);
+				frame->step += 1;
+				if (frame->step < frame->count) {
+					expr = argument(parent, frame->count, frame->step);
+					continue;
+				}
+				value = inline_call(parent, frame->known, frame->replace, frame->count, version);
+				free(frame->replace);
+				Worklist_drop(&frames);
+				nesting -= 1;
+				continue;
+			}
+			Node *children[NODE_MAX_CHILDREN];
+			int n = Node_children(parent, children);
+			if (frame->step < n - 1) {
+				frame->inlined[frame->step] = value;
+				frame->step += 1;
+				expr = children[frame->step];
+				continue;
+			}
+			value = inline_node(frame, value);
+			free(frame->inner);
+			Worklist_drop(&frames);
+		}
+		if (!expr) {
+			Worklist_destroy(&frames);
+			return value;
+		}
+	}
+}
+
+Node *inline_calls(Node *expr, unsigned version)
+{
+	return inline_expr(expr, NULL, version);
+}
+
+// Substitute the value for the variable (e.g. a beta-reduction)
+Node *inline_subst(const Node *expr, const char *name, Node *value)
+{
+	Replace replace;
+	replace_init(&replace, name, value, NULL);
+	return subst(expr, &replace);
+}
+
+Node *inline_copy(const Node *expr)
+{
+	return subst(expr, NULL);
+}
+
+unsigned long inline_stats(void)
+{
+	return inlined;
+}
+
+int inline_define(const char *name, const Node *value)
+{
+	if (!known_arena.page_size) {
+		known_arena = Arena_make(KNOWN_ARENA_PAGE_SIZE);
+	}
+	Known *k = lookup(name);
+	int redefined = k != NULL;
+	if (!k) {
+		k = Arena_alloc(&known_arena, sizeof(*k));
+		k->name = IdNode_value(IdNode_new(name, strlen(name)));
+		k->bound = 0;
+		k->next = known;
+		known = k;
+	}
+	k->bound = k->bound || value != NULL;
+	k->fn = NULL;
+	if (value && value->type == FnNode && size(value) <= INLINE_BUDGET) {
+		k->fn = inline_copy(value);
+	}
+	return redefined;
+}
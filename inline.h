@@ -0,0 +1,20 @@
+#ifndef INLINE_INCLUDED
+#define INLINE_INCLUDED
+
+#include "node.h"
+
+// the largest body (in nodes) of a function that is inlined
+#define INLINE_BUDGET 16
+// the calls in the arguments of this many inlined calls are not inlined,
+// see inline_call
+#define INLINE_MAX_NESTING 4
+
+// NOTE: the version is the one the global env will have when the expression
+// is evaluated, inline_define returns whether the global is redefined
+Node          *inline_calls(Node *expr, unsigned version);
+int           inline_define(const char *name, const Node *value);
+Node          *inline_subst(const Node *expr, const char *name, Node *value);
+Node          *inline_copy(const Node *expr);
+unsigned long inline_stats(void);
+
+#endif // INLINE_INCLUDED
@@ -9,20 +9,51 @@
 #include "types.h"
 #include "eval.h"
 #include "arena.h"
+#include "strict.h"
+#include "memo.h"
+#include "opt.h"
+#include "env.h"
+#include "gc.h"
+#include "builtin.h"
 
 
 #define TMP_ARENA_PAGE_SIZE 4096
 
+static Object *run(Node *ast, Context *ctx)
+{
+	strictness(ast);
+	Node_mark_tail_calls(ast);
+	if (typed) {
+		// the operations are known to be numeric, see CHECKED
+		Node_quicken(ast);
+	}
+	if (debug) {
+		Node_println(ast);
+	}
+	// NOTE: the let may fail, the global is bound if it's new or its version changed
+	unsigned version = EnvObj_version(ctx->root);
+	int defined = ast->type == LetNode && Env_get(EnvObj_env(ctx->root), LetNode_name_value(ast));
+	Object *result = eval(ast, ctx);
+	if ((inlining || optimization) && ast->type == LetNode) {
+		int bound = defined ?
+			EnvObj_version(ctx->root) != version :
+			Env_get(EnvObj_env(ctx->root), LetNode_name_value(ast)) != NULL;
+		optimize_define(LetNode_name_value(ast), bound ? LetNode_value(ast) : NULL);
+	}
+	return result;
+}
+
 int main(int argc, char **argv)
 {
 	if (!parse_args(argc, argv)) {
 		return 1;
 	}
-	int tty = isatty(0);
-	Scanner scanner = Scanner_make(stdin);
+	int tty = isatty(input);
+	Scanner scanner = Scanner_make(input);
 	Context ctx = Context_make();
 	// TODO: maybe make those parts of the context?
 	TypeEnv *tenv = TYPEENV_EMPTY;
+	Builtin_define(&ctx, &tenv);
 	Arena tmp = Arena_make(TMP_ARENA_PAGE_SIZE);
 	Arena longtmp = Arena_make(TMP_ARENA_PAGE_SIZE);
 	while (!Scanner_eof(scanner)) {
@@ -30,7 +61,7 @@ int main(int argc, char **argv)
 		if (tty) {
 			fprintf(stderr, "> ");
 		}
-		Node *ast = parse(&scanner, &longtmp);
+		Node *ast = parse(&scanner);
 		if (!ast) {
 			continue;
 		}
@@ -41,10 +72,11 @@ int main(int argc, char **argv)
 				continue;
 			}
 		}
-		if (debug) {
-			Node_println(ast);
+		ast = optimize(ast, EnvObj_version(ctx.root), &longtmp);
+		for (Node *let; (let = optimize_lifted(EnvObj_version(ctx.root)));) {
+			run(let, &ctx);
 		}
-		Object *result = eval(ast, &ctx);
+		Object *result = run(ast, &ctx);
 		if (!result) {
 			continue;
 		}
@@ -55,6 +87,15 @@ int main(int argc, char **argv)
 		}
 		printf("\n");
 	}
+	if (debug && memoize) {
+		Memo_print_stats();
+	}
+	if (debug && (inlining || optimization)) {
+		optimize_print_stats();
+	}
+	if (debug) {
+		GC_print_stats(ctx.gc);
+	}
 	Scanner_destroy(scanner);
 	Context_destroy(ctx);
 	TypeEnv_drop(tenv);
@@ -1,57 +1,138 @@
 #include "iter.h"
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
-Iter Iter_make(FILE *file)
+// NOTE: a file is mapped only if it's read from the start (stdin
+// may be redirected from a file that was read from already)
+Iter Iter_make(int fd)
 {
 	Iter iter = {0};
-	iter.file = file;
-	iter.buff = malloc(INITIAL_BUFFER_SIZE);
-	iter.end = iter.buff;
-	iter.cursor = iter.buff;
-	iter.size = INITIAL_BUFFER_SIZE;
+	iter.fd = fd;
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0 || lseek(fd, 0, SEEK_CUR) != 0) {
+		return iter;
+	}
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return iter;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	iter.map = map;
+	iter.map_size = st.st_size;
+	iter.mark = map;
+	iter.cursor = map;
+	iter.end = map + st.st_size;
 	return iter;
 }
 
+static void Iter_free_chunks(Chunk *chunk)
+{
+	while (chunk) {
+		Chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
 void Iter_destroy(Iter iter)
 {
-	free(iter.buff);
-	fclose(iter.file);
+	if (iter.map) {
+		munmap(iter.map, iter.map_size);
+	}
+	free(iter.chunk);
+	Iter_free_chunks(iter.used);
+	Iter_free_chunks(iter.free);
+	close(iter.fd);
 }
 
+// The tokens that were taken are not needed anymore
 void Iter_reset(Iter *iter)
 {
-	iter->end = iter->buff;
-	iter->cursor = iter->buff;
+	while (iter->used) {
+		Chunk *next = iter->used->next;
+		iter->used->next = iter->free;
+		iter->free = iter->used;
+		iter->used = next;
+	}
+	if (iter->chunk && iter->cursor >= iter->end) {
+		iter->cursor = iter->end = iter->chunk->data;
+	}
+	iter->mark = iter->cursor;
 }
 
-char *Iter_cursor(const Iter *iter)
+// A chunk that has room for the text that is kept and one more read
+static Chunk *Iter_chunk(Iter *iter, size_t keep)
 {
-	return iter->cursor;
+	size_t size = CHUNK_SIZE;
+	while (size < 2 * keep) {
+		size *= 2;
+	}
+	Chunk *chunk = iter->free;
+	if (chunk && chunk->size >= size) {
+		iter->free = chunk->next;
+		return chunk;
+	}
+	chunk = malloc(sizeof(*chunk) + size);
+	chunk->size = size;
+	return chunk;
 }
 
-static void Iter_getc(Iter *iter, int count)
+// Read more of a stream, returns the next char. The current chunk
+// is filled up before the next one is taken.
+char Iter_fill(Iter *iter)
 {
-	while (!Iter_eof(iter) && count > 0) {
-		if (iter->end - iter->buff == iter->size - 1) {
-			iter->size *= 2;
-			iter->buff = realloc(iter->buff, iter->size);
+	if (iter->eof || iter->map) {
+		iter->eof = 1;
+		return '\0';
+	}
+	if (!iter->chunk || iter->end == iter->chunk->data + iter->chunk->size) {
+		size_t keep = iter->end - iter->mark;
+		Chunk *chunk = Iter_chunk(iter, keep);
+		if (keep) {
+			memcpy(chunk->data, iter->mark, keep);
+		}
+		if (iter->chunk) {
+			iter->chunk->next = iter->used;
+			iter->used = iter->chunk;
 		}
-		int c = fgetc(iter->file);
-		iter->end[0] = c == EOF ? '\0' : c;
-		iter->end += 1;
-		count -= 1;
+		iter->chunk = chunk;
+		iter->mark = chunk->data;
+		iter->cursor = chunk->data + keep;
+		iter->end = iter->cursor;
+	}
+	ssize_t count;
+	do {
+		count = read(iter->fd, iter->end, iter->chunk->data + iter->chunk->size - iter->end);
+	} while (count < 0 && errno == EINTR);
+	if (count <= 0) {
+		iter->eof = 1;
+		return '\0';
 	}
+	iter->end += count;
+	return *iter->cursor;
 }
 
-char Iter_peek(Iter *iter)
+char *Iter_cursor(const Iter *iter)
 {
-	Iter_getc(iter, 1 - (iter->end - iter->cursor));
-	if (iter->cursor >= iter->end) {
-		return '\0';
-	}
-	return iter->cursor[0];
+	return iter->cursor;
+}
+
+// The text from the mark on is kept in one piece, the mark
+// is moved with it (see Iter_marked)
+void Iter_mark(Iter *iter)
+{
+	iter->mark = iter->cursor;
+}
+
+const char *Iter_marked(const Iter *iter)
+{
+	return iter->mark;
 }
 
 char Iter_next(Iter *iter)
@@ -63,5 +144,5 @@ char Iter_next(Iter *iter)
 
 int Iter_eof(const Iter *iter)
 {
-	return feof(iter->file) || ferror(iter->file);
+	return iter->eof;
 }
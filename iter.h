@@ -1,24 +1,49 @@
 #ifndef ITER_INCLUDED
 #define ITER_INCLUDED
 
-#include <stdio.h>
+#include <stddef.h>
 
-#define INITIAL_BUFFER_SIZE 1024
+// the size of the chunks a stream is read in
+#define CHUNK_SIZE (64 * 1024)
 
+typedef struct Chunk Chunk;
+
+struct Chunk {
+	Chunk  *next;
+	size_t size;
+	char   data[];
+};
+
+// A regular file is mapped into memory as a whole, anything else (a pipe or
+// a terminal) is read in chunks. The text of the tokens stays where it is
+// until the iterator is reset: a full chunk is kept while the expression is
+// parsed and the token that is cut by its end (see Iter_mark) is moved to
+// the next one. The chunks are reused after the reset.
 typedef struct {
-	FILE *file;
-	char *buff;
-	char *cursor;
-	char *end;
-	int  size;
+	int        fd;
+	char       *map;     // the mapped file or NULL
+	size_t     map_size;
+	Chunk      *chunk;   // the chunk that is read now
+	Chunk      *used;    // the full chunks of the current expression
+	Chunk      *free;
+	const char *mark;
+	char       *cursor;
+	char       *end;
+	int        eof;
 } Iter;
 
-Iter Iter_make(FILE *file);
+Iter Iter_make(int fd);
 void Iter_destroy(Iter iter);
 void Iter_reset(Iter *iter);
+char Iter_fill(Iter *iter);
 char *Iter_cursor(const Iter *iter);
-char Iter_peek(Iter *iter);
+void Iter_mark(Iter *iter);
+const char *Iter_marked(const Iter *iter);
 char Iter_next(Iter *iter);
 int  Iter_eof(const Iter *iter);
 
+// NOTE: '\0' at the end
+#define Iter_peek(iterptr) \
+	((iterptr)->cursor < (iterptr)->end ? *(iterptr)->cursor : Iter_fill(iterptr))
+
 #endif // ITER_INCLUDED
@@ -1,45 +1,177 @@
 #include "lex.h"
 
-#include <ctype.h>
 #include <string.h>
 
 #include "token.h"
 #include "iter.h"
 
 
-#define kweq(s, keyword, length) \
-	(length == sizeof(keyword) - 1 && !strncmp(s, keyword, length))
+// The runs of the blanks, the comments, the identifiers and the numbers
+// are skipped with vector compares (in 16 or 32 byte strides, whichever
+// the CPU supports) as far as they go in the buffer, the few chars at the
+// end of it are left to the scalar loop. NOTE: the vector loads never go
+// past the end of the buffer, since the end of a mapped file may be
+// the end of the mapping.
 
+#define is_blank(c) ((c) == ' ' || (c) == '\t')
+#define is_comment(c) ((c) != '\n' && (c) != '\0')
+#define is_digit(c) ((c) >= '0' && (c) <= '9')
+#define is_alpha(c) (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z')
+#define is_alnum(c) (is_alpha(c) || is_digit(c))
 
-// keyword <- 'if' | 'then' | 'else' | 'or' | 'and' | 'fn' | 'to'
-// id <- alpha+
-static Token take_keyword_or_id(Iter *iterator)
+// The first char at or after p that is not in the class (or p if the run
+// reaches the last vector of the buffer)
+typedef const char *Scan(const char *p, const char *end);
+
+typedef struct {
+	Scan *blank;
+	Scan *comment;
+	Scan *alnum;
+	Scan *digit;
+} Scanners;
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+// NOTE: V is the prefix of the intrinsics of the vector type T that has
+// W bytes and S is the suffix of its logical operations, MASK is the
+// vector that has the bytes of the chars in the class set
+#define VECTOR_SCAN(isa, name, T, W, V, S, LOAD, MASK)\
+static const char *isa##_##name(const char *p, const char *end)\
+{\
+	for (; end - p >= W; p += W) {\
+		T x = LOAD((const T *)p);\
+		unsigned miss = ~(unsigned)V##_movemask_epi8(MASK) & (unsigned)((1ull << W) - 1);\
+		if (miss) {\
+			return p + __builtin_ctz(miss);\
+		}\
+	}\
+	return p;\
+}
+
+#define VECTOR_RANGE(V, S, x, lo, hi)\
+	V##_and_##S(V##_cmpgt_epi8(x, V##_set1_epi8((lo) - 1)), V##_cmpgt_epi8(V##_set1_epi8((hi) + 1), x))
+
+// NOTE: the chars above 0x7f are negative, so they are not in any range
+#define VECTOR_SCANNERS(isa, T, W, V, S, LOAD)\
+\
+VECTOR_SCAN(isa, blank, T, W, V, S, LOAD,\
+	V##_or_##S(V##_cmpeq_epi8(x, V##_set1_epi8(' ')), V##_cmpeq_epi8(x, V##_set1_epi8('\t'))))\
+VECTOR_SCAN(isa, comment, T, W, V, S, LOAD,\
+	V##_andnot_##S(\
+		V##_or_##S(V##_cmpeq_epi8(x, V##_set1_epi8('\n')), V##_cmpeq_epi8(x, V##_setzero_##S())),\
+		V##_set1_epi8(-1)))\
+VECTOR_SCAN(isa, alnum, T, W, V, S, LOAD,\
+	V##_or_##S(\
+		VECTOR_RANGE(V, S, V##_or_##S(x, V##_set1_epi8(0x20)), 'a', 'z'),\
+		VECTOR_RANGE(V, S, x, '0', '9')))\
+VECTOR_SCAN(isa, digit, T, W, V, S, LOAD, VECTOR_RANGE(V, S, x, '0', '9'))\
+\
+static const Scanners isa##_scanners = {isa##_blank, isa##_comment, isa##_alnum, isa##_digit};
+
+// NOTE: SSE2 is a part of amd64, so it's always there
+VECTOR_SCANNERS(sse2, __m128i, 16, _mm, si128, _mm_loadu_si128)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+VECTOR_SCANNERS(avx2, __m256i, 32, _mm256, si256, _mm256_loadu_si256)
+#pragma GCC pop_options
+
+#else
+
+// the scalar loop takes the whole run
+static const char *scalar_scan(const char *p, const char *end)
 {
-	const char *start = Iter_cursor(iterator);
-	while (isalnum(Iter_peek(iterator))) {
-		Iter_next(iterator);
-	}
-	long unsigned length = Iter_cursor(iterator) - start;
-	if (kweq(start, "if", length)) {
-		return (Token){IfToken, start, length};
-	}
-	if (kweq(start, "then", length)) {
-		return (Token){ThenToken, start, length};
-	}
-	if (kweq(start, "else", length)) {
-		return (Token){ElseToken, start, length};
-	}
-	if (kweq(start, "or", length)) {
-		return (Token){OrToken, start, length};
-	}
-	if (kweq(start, "and", length)) {
-		return (Token){AndToken, start, length};
-	}
-	if (kweq(start, "fn", length)) {
-		return (Token){FnToken, start, length};
+	(void)end;
+	return p;
+}
+
+static const Scanners scalar_scanners = {scalar_scan, scalar_scan, scalar_scan, scalar_scan};
+
+#endif
+
+// NOTE: the best scanners the CPU supports
+static const Scanners *scanners(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return &avx2_scanners;
 	}
-	if (kweq(start, "let", length)) {
-		return (Token){LetToken, start, length};
+	return &sse2_scanners;
+#else
+	return &scalar_scanners;
+#endif
+}
+
+#define CLASS_TEST_blank(c) is_blank(c)
+#define CLASS_TEST_comment(c) is_comment(c)
+#define CLASS_TEST_alnum(c) is_alnum(c)
+#define CLASS_TEST_digit(c) is_digit(c)
+
+// the runs that are shorter are not worth a vector compare
+#define SCALAR_RUN 8
+
+static const Scanners *active = NULL;
+
+// Skip the run of the chars of the class, the chars that are not a part
+// of a token are not kept in the buffer either (see Iter_mark)
+#define take_run(iterator, class, skip) ({\
+	Iter *iter = (iterator);\
+	while (CLASS_TEST_##class(Iter_peek(iter))) {\
+		char *limit = iter->end - iter->cursor > SCALAR_RUN ? iter->cursor + SCALAR_RUN : iter->end;\
+		do {\
+			iter->cursor += 1;\
+		} while (iter->cursor < limit && CLASS_TEST_##class(*iter->cursor));\
+		if (iter->cursor == limit) {\
+			iter->cursor = (char *)active->class(iter->cursor, iter->end);\
+			while (iter->cursor < iter->end && CLASS_TEST_##class(*iter->cursor)) {\
+				iter->cursor += 1;\
+			}\
+		}\
+		if (skip) {\
+			Iter_mark(iter);\
+		}\
+	}\
+})
+
+// The keywords are looked up in a perfect hash table of the first char,
+// the last char and the length. NOTE: the table is built at compile time,
+// a collision overrides an entry, which -Wextra (-Woverride-init) reports.
+#define KEYWORD_HASH(first, last, length) ((3 * (first) + 2 * (last) + (length)) & 7)
+#define KEYWORD_MAX_LENGTH 4
+
+#define KEYWORD(name, first, last, type) \
+	[KEYWORD_HASH(first, last, sizeof(name) - 1)] = {name, sizeof(name) - 1, type}
+
+static const struct {
+	const char *name;
+	long       length;
+	TokenType  type;
+} keywords[8] = {
+	KEYWORD("if",   'i', 'f', IfToken),
+	KEYWORD("then", 't', 'n', ThenToken),
+	KEYWORD("else", 'e', 'e', ElseToken),
+	KEYWORD("or",   'o', 'r', OrToken),
+	KEYWORD("and",  'a', 'd', AndToken),
+	KEYWORD("fn",   'f', 'n', FnToken),
+	KEYWORD("let",  'l', 't', LetToken),
+};
+
+// keyword <- 'if' | 'then' | 'else' | 'or' | 'and' | 'fn' | 'let'
+// id <- alpha alnum*
+static Token take_keyword_or_id(Iter *iterator)
+{
+	Iter_mark(iterator);
+	take_run(iterator, alnum, 0);
+	const char *start = Iter_marked(iterator);
+	long length = Iter_cursor(iterator) - start;
+	if (length <= KEYWORD_MAX_LENGTH) {
+		int hash = KEYWORD_HASH(start[0], start[length - 1], length);
+		if (keywords[hash].length == length && !memcmp(keywords[hash].name, start, length)) {
+			return (Token){keywords[hash].type, start, length};
+		}
 	}
 	return (Token){IdToken, start, length};
 }
@@ -47,16 +179,13 @@ static Token take_keyword_or_id(Iter *iterator)
 // number <- digit+ ('.' digit*)?
 static Token take_number(Iter *iterator)
 {
-	const char *start = Iter_cursor(iterator);
-	while (isdigit(Iter_peek(iterator))) {
-		Iter_next(iterator);
-	}
+	Iter_mark(iterator);
+	take_run(iterator, digit, 0);
 	if (Iter_peek(iterator) == '.') {
 		Iter_next(iterator);
 	}
-	while (isdigit(Iter_peek(iterator))) {
-		Iter_next(iterator);
-	}
+	take_run(iterator, digit, 0);
+	const char *start = Iter_marked(iterator);
 	return (Token){NumberToken, start, Iter_cursor(iterator) - start};
 }
 
@@ -75,37 +204,36 @@ TokenType singlet_token_type(char c)
 		case '<':  return LtToken;
 		case '=':  return EqToken;
 		case ':':  return ColonToken;
+		case '~':  return TildeToken;
 		default:   return ErrorToken;
 	}
 }
 
-// token <- number | id | keyword | '(' | ')' | '+' | '*' | '/' | '^' | '>' | '<' | '=' | ':' | '\0'
+// token <- number | id | keyword | '(' | ')' | '+' | '*' | '/' | '^' | '>' | '<' | '=' | ':' | '~' | '\0'
 Token take_token(Iter *iterator)
 {
-	while (Iter_peek(iterator) == ' ' || Iter_peek(iterator) == '\t') {
-		Iter_next(iterator);
+	if (!active) {
+		active = scanners();
 	}
+	take_run(iterator, blank, 1);
 	if (Iter_peek(iterator) == '#') {
-		while (Iter_peek(iterator) != '\n' && Iter_peek(iterator) != '\0') {
-			Iter_next(iterator);
-		}
+		take_run(iterator, comment, 1);
 	}
 	char next = Iter_peek(iterator);
 	if (next == '\0' || next == '\n') {
-		Token token = (Token){EndToken, Iter_cursor(iterator), 1};
+		// NOTE: there is no text at the end of the input
+		Token token = (Token){EndToken, next ? Iter_cursor(iterator) : "", 1};
 		Iter_next(iterator);
 		return token;
-	} else if (isdigit(next)) {
+	} else if (is_digit(next)) {
 		return take_number(iterator);
-	} else if (isalpha(next)) {
+	} else if (is_alpha(next)) {
 		return take_keyword_or_id(iterator);
 	} else {
 		Token token = {singlet_token_type(next), Iter_cursor(iterator), 1};
 		Iter_next(iterator);
 		if (token.type == ErrorToken) {
-			while (Iter_peek(iterator) != '\n' && Iter_peek(iterator) != '\0') {
-				Iter_next(iterator);
-			}
+			take_run(iterator, comment, 1);
 		}
 		return token;
 	}
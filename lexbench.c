@@ -0,0 +1,47 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "lex.h"
+#include "iter.h"
+#include "token.h"
+
+
+// The lexer benchmark: all of the tokens of the file are taken (and the
+// iterator is reset at the end of every line, as the parser does it),
+// the rate is printed in tokens and megabytes per second.
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s file\n", argv[0]);
+		return 1;
+	}
+	int fd = open(argv[1], O_RDONLY);
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	Iter iterator = Iter_make(fd);
+	long tokens = 0;
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (!Iter_eof(&iterator)) {
+		Token token = take_token(&iterator);
+		tokens += 1;
+		if (token.type == EndToken) {
+			Iter_reset(&iterator);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9;
+	printf(
+		"%ld tokens in %.3fs: %.1fM tokens/s, %.1f MB/s\n",
+		tokens, seconds, tokens / seconds * 1e-6, st.st_size / seconds * 1e-6
+	);
+	Iter_destroy(iterator);
+	return 0;
+}
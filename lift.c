@@ -0,0 +1,333 @@
+#include "lift.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "node.h"
+#include "arena.h"
+#include "worklist.h"
+
+
+// Lambda lifting (-O2): the functions nested in the bodies of other
+// functions are moved to new globals, so their closures are not allocated
+// on each call. A function without free local variables is replaced by
+// the global, and an applied one gets its free variables as the leading
+// parameters (e.g. 'fn x: (fn y: x + y) 1' becomes 'fn x: f'l0 x 1').
+// The other functions that capture variables are kept as they are,
+// the partial application of the global would cost as much.
+
+// NOTE: lazy is set for the parameters passed by need
+typedef struct Scope Scope;
+
+struct Scope {
+	const char  *name;
+	int         lazy;
+	const Scope *prev;
+};
+
+typedef struct Lifted Lifted;
+
+struct Lifted {
+	Node   *let;
+	Lifted *next;
+};
+
+// NOTE: the frames of lift, the step is the number of the children that
+// are already lifted (the results are kept in lifted), inner is the scope
+// of the body of a function. The arguments of a function that is applied
+// right away are kept in args and the call of its global is built in call.
+typedef struct {
+	Node        *expr;
+	const Scope *scope;
+	const char  *prefix;
+	Scope       *inner;
+	int         curried;
+	Node        **args;
+	int         count;
+	Node        *call;
+	int         step;
+	Node        *lifted[NODE_MAX_CHILDREN - 1];
+} Lifting;
+
+static Lifted *first = NULL;
+static Lifted **last = &first;
+static unsigned long lifted = 0;
+
+static int depth(const Scope *scope)
+{
+	int n = 0;
+	for (; scope; scope = scope->prev) {
+		n += 1;
+	}
+	return n;
+}
+
+// Whether the variable of the scope is shadowed by an inner one
+static int shadowed(const Scope *var, const Scope *scope)
+{
+	for (; scope != var; scope = scope->prev) {
+		if (!strcmp(scope->name, var->name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int occurs(const Node *expr, const char *name)
+{
+	Worklist(const Node *) pending = WORKLIST_EMPTY;
+	int found = 0;
+	Worklist_push(&pending, expr);
+	while (!found && !Worklist_empty(&pending)) {
+		expr = Worklist_pop(&pending);
+		switch (expr->type) {
+			case IdNode:
+				found = !strcmp(IdNode_value(expr), name);
+				break;
+			case FnNode:
+				if (strcmp(FnNode_param_value(expr), name)) {
+					Worklist_push(&pending, FnNode_body(expr));
+				}
+				break;
+			default: {
+				Node *children[NODE_MAX_CHILDREN];
+				int n = Node_children(expr, children);
+				for (int i = 0; i < n; i++) {
+					Worklist_push(&pending, children[i]);
+				}
+			}
+		}
+	}
+	Worklist_destroy(&pending);
+	return found;
+}
+
+// The variables of the scope that are free in the expression (innermost
+// first), returns their number. NOTE: vars may be NULL for a test.
+static int captured(const Node *expr, const Scope *scope, const Scope **vars)
+{
+	int count = 0;
+	for (const Scope *var = scope; var; var = var->prev) {
+		if (!shadowed(var, scope) && occurs(expr, var->name)) {
+			if (!vars) {
+				return 1;
+			}
+			vars[count] = var;
+			count += 1;
+		}
+	}
+	return count;
+}
+
+// Bind the function to a new global with the variables as the leading
+// parameters, returns the application of the global to the variables
+static Node *define(Node *fn, const Scope **vars, int count, const char *prefix, Arena *a)
+{
+	static int id = 0;
+	char buf[256];
+	// NOTE: the quote can't appear in the source, so the name is unique
+	int length = snprintf(buf, sizeof(buf), "%.200s'l%d", prefix, id);
+	id += 1;
+	for (int i = 0; i < count; i++) {
+		fn = FnNode_new(IdNode_new(vars[i]->name, strlen(vars[i]->name)), fn);
+		// the argument is passed as it's bound, so a thunk is not forced
+		FnNode_lazy(fn) = vars[i]->lazy;
+	}
+	Lifted *l = Arena_alloc(a, sizeof(*l));
+	l->let = LetNode_new(IdNode_new(buf, length), fn);
+	l->next = NULL;
+	*last = l;
+	last = &l->next;
+	lifted += 1;
+	Node *call = IdNode_new(buf, length);
+	for (int i = count - 1; i >= 0; i--) {
+		call = ApplicationNode_new(call, IdNode_new(vars[i]->name, strlen(vars[i]->name)));
+	}
+	return call;
+}
+
+// The function with the lifted body
+static Node *lift_fn(Node *fn, Node *body)
+{
+	if (body == FnNode_body(fn)) {
+		return fn;
+	}
+	Node *new = FnNode_new(FnNode_param(fn), body);
+	FnNode_lazy(new) = FnNode_lazy(fn);
+	return new;
+}
+
+// A function that is applied right away, e.g. '(fn y: x + y) 1',
+// the global that replaces it is applied to the arguments
+static Node *lift_call(Node *fn, const Scope *scope, const char *prefix, Arena *a)
+{
+	const Scope **vars = malloc(depth(scope) * sizeof(*vars));
+	Node *call = define(fn, vars, captured(fn, scope, vars), prefix, a);
+	free(vars);
+	return call;
+}
+
+// The node from the results of its children, the last one is lifted
+static Node *lift_node(const Lifting *frame, Node *last)
+{
+	Node *expr = frame->expr;
+	switch (expr->type) {
+		case IfNode:
+			if (frame->lifted[0] == IfNode_cond(expr) && frame->lifted[1] == IfNode_true(expr) && last == IfNode_false(expr)) {
+				return expr;
+			}
+			return IfNode_new(frame->lifted[0], frame->lifted[1], last);
+		case LetNode:
+			if (last == LetNode_value(expr)) {
+				return expr;
+			}
+			return LetNode_new(LetNode_name(expr), last);
+		default:
+			if (frame->lifted[0] == PairNode_left(expr) && last == PairNode_right(expr)) {
+				return expr;
+			}
+			return OpNode_new(frame->lifted[0], last, expr->type, PairNode_op(expr));
+	}
+}
+
+// The children are lifted in order and the result of one is returned to
+// the topmost frame. NOTE: the body of a (curried) function and the
+// function applied right away are only lifted inside (curried is set).
+static Node *lift(Node *expr, const Scope *scope, const char *prefix, Arena *a)
+{
+	Worklist(Lifting) frames = WORKLIST_EMPTY;
+	int curried = 0;
+	// the head of the application looked at (if it's a part
+	// of the spine already looked at)
+	Node *head = NULL;
+	Node *value = NULL;
+	for (;;) {
+		switch (expr->type) {
+			case NumberNode:
+			case IdNode:
+			case GuardNode:
+				value = expr;
+				break;
+			case FnNode: {
+				// NOTE: the scopes are linked, so they can't be kept in the frames
+				Scope *inner = malloc(sizeof(*inner));
+				*inner = (Scope){FnNode_param_value(expr), FnNode_lazy(expr), scope};
+				Worklist_push(&frames, .expr = expr, .scope = scope, .prefix = prefix, .inner = inner, .curried = curried);
+				expr = FnNode_body(expr);
+				scope = inner;
+				curried = expr->type == FnNode;
+				head = NULL;
+				continue;
+			}
+			case LetNode:
+				Worklist_push(&frames, .expr = expr, .scope = scope, .prefix = prefix);
+				// the functions are named after the global they are lifted from
+				prefix = LetNode_name_value(expr);
+				expr = LetNode_value(expr);
+				curried = 0;
+				head = NULL;
+				continue;
+			case ApplNode: {
+				if (!head) {
+					for (head = expr; head->type == ApplNode; head = PairNode_left(head)) {
+					}
+				}
+				if (head->type == FnNode && scope) {
+					int count = 0;
+					for (Node *appl = expr; appl->type == ApplNode; appl = PairNode_left(appl)) {
+						count += 1;
+					}
+					Node **args = malloc(count * sizeof(*args));
+					Node *appl = expr;
+					for (int i = count - 1; i >= 0; i--) {
+						args[i] = PairNode_right(appl);
+						appl = PairNode_left(appl);
+					}
+					Worklist_push(&frames, .expr = expr, .scope = scope, .prefix = prefix, .args = args, .count = count);
+					expr = head;
+					curried = 1;
+					head = NULL;
+					continue;
+				}
+			}
+			// fallthrough
+			default: {
+				Node *children[NODE_MAX_CHILDREN];
+				Node_children(expr, children);
+				Worklist_push(&frames, .expr = expr, .scope = scope, .prefix = prefix);
+				// the rest of the spine has the same head
+				if (expr->type != ApplNode || children[0]->type != ApplNode) {
+					head = NULL;
+				}
+				expr = children[0];
+				curried = 0;
+				continue;
+			}
+		}
+		// return the result until a frame needs another child
+		expr = NULL;
+		while (!expr && !Worklist_empty(&frames)) {
+			Lifting *frame = Worklist_top(&frames);
+			Node *parent = frame->expr;
+			scope = frame->scope;
+			prefix = frame->prefix;
+			curried = 0;
+			head = NULL;
+			if (parent->type == FnNode) {
+				free(frame->inner);
+				value = lift_fn(parent, value);
+				if (!frame->curried && scope && !captured(value, scope, NULL)) {
+					value = define(value, NULL, 0, prefix, a);
+				}
+			} else if (frame->args) {
+				frame->call = frame->step ? ApplicationNode_new(frame->call, value) : lift_call(value, scope, prefix, a);
+				frame->step += 1;
+				if (frame->step <= frame->count) {
+					expr = frame->args[frame->step - 1];
+					continue;
+				}
+				value = frame->call;
+				free(frame->args);
+			} else {
+				Node *children[NODE_MAX_CHILDREN];
+				int count = Node_children(parent, children);
+				if (frame->step < count - 1) {
+					frame->lifted[frame->step] = value;
+					frame->step += 1;
+					expr = children[frame->step];
+					continue;
+				}
+				value = lift_node(frame, value);
+			}
+			Worklist_drop(&frames);
+		}
+		if (!expr) {
+			Worklist_destroy(&frames);
+			return value;
+		}
+	}
+}
+
+Node *lift_lambdas(Node *expr, Arena *a)
+{
+	return lift(expr, NULL, "lambda", a);
+}
+
+Node *lift_next(void)
+{
+	if (!first) {
+		return NULL;
+	}
+	Node *let = first->let;
+	first = first->next;
+	if (!first) {
+		last = &first;
+	}
+	return let;
+}
+
+unsigned long lift_stats(void)
+{
+	return lifted;
+}
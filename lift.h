@@ -0,0 +1,14 @@
+#ifndef LIFT_INCLUDED
+#define LIFT_INCLUDED
+
+#include "node.h"
+#include "arena.h"
+
+// NOTE: the lifted functions are bound to new globals, lift_next returns
+// their definitions one by one (NULL when there are none left), they
+// must be evaluated before the expression
+Node          *lift_lambdas(Node *expr, Arena *a);
+Node          *lift_next(void);
+unsigned long lift_stats(void);
+
+#endif // LIFT_INCLUDED
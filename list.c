@@ -0,0 +1,377 @@
+#include "list.h"
+
+#include <stdlib.h>
+
+#include "object.h"
+#include "values.h"
+#include "gc.h"
+#include "eval.h"
+#include "context.h"
+#include "builtin.h"
+#include "opts.h"
+#include "error.h"
+
+
+#define ERROR_PREFIX "evaluation error"
+
+// Native lists: the cells are objects, so the traversals are loops over
+// the cells instead of the calls of the Church encodings (e.g. 'map f xs'
+// allocates one cell per element and calls only f). In the lazy mode map,
+// filter, foldr and range produce their results by need: the rest of
+// the result is a suspension (see GC_alloc_suspension) of a builtin that
+// produces the next cell when it's forced.
+
+static Object *List_map_step(Object **args, Context *ctx);
+static Object *List_apply_step(Object **args, Context *ctx);
+static Object *List_filter_step(Object **args, Context *ctx);
+static Object *List_foldr_step(Object **args, Context *ctx);
+static Object *List_range_step(Object **args, Context *ctx);
+
+static const BuiltinDesc map_step    = {"map",    NULL, 2, List_map_step};
+static const BuiltinDesc apply_step  = {"map",    NULL, 2, List_apply_step};
+static const BuiltinDesc filter_step = {"filter", NULL, 2, List_filter_step};
+static const BuiltinDesc foldr_step  = {"foldr",  NULL, 3, List_foldr_step};
+static const BuiltinDesc range_step  = {"range",  NULL, 2, List_range_step};
+
+static Object *List_arg(Object *arg, Context *ctx)
+{
+	return Builtin_arg(arg, ListObject, ctx);
+}
+
+// The rest of the list, the forced tail replaces the thunk in the cell
+static Object *List_rest(Object *cell, Context *ctx)
+{
+	Object *tail = List_arg(ListObj_tail(cell), ctx);
+	if (tail) {
+		ListObj_tail(cell) = tail;
+	}
+	return tail;
+}
+
+static Object *List_suspend(const BuiltinDesc *desc, Object **args, Context *ctx)
+{
+	return GC_alloc_suspension(ctx->gc, GC_alloc_builtin(ctx->gc, desc, desc->arity, args));
+}
+
+// NOTE: the list is a non-empty one
+static Object *List_nonempty(Object *arg, Context *ctx)
+{
+	Object *list = List_arg(arg, ctx);
+	if (list && ListObj_empty(list)) {
+		error("the list is empty");
+		return NULL;
+	}
+	return list;
+}
+
+Object *List_nil(Object **args, Context *ctx)
+{
+	(void)args;
+	return GC_alloc_cell(ctx->gc, NULL, NULL);
+}
+
+// NOTE: the tail is not forced, so the lists can be built by need
+Object *List_cons(Object **args, Context *ctx)
+{
+	Object *tail = args[1];
+	if (!typed && tail->type != ListObject && tail->type != ThunkObject) {
+		error("type mismatch");
+		return NULL;
+	}
+	return GC_alloc_cell(ctx->gc, args[0], tail);
+}
+
+Object *List_head(Object **args, Context *ctx)
+{
+	Object *list = List_nonempty(args[0], ctx);
+	if (!list) {
+		return NULL;
+	}
+	return ListObj_head(list);
+}
+
+Object *List_tail(Object **args, Context *ctx)
+{
+	Object *list = List_nonempty(args[0], ctx);
+	if (!list) {
+		return NULL;
+	}
+	return ListObj_tail(list);
+}
+
+Object *List_empty(Object **args, Context *ctx)
+{
+	Object *list = List_arg(args[0], ctx);
+	if (!list) {
+		return NULL;
+	}
+	return GC_alloc_int(ctx->gc, ListObj_empty(list));
+}
+
+Object *List_length(Object **args, Context *ctx)
+{
+	long length = 0;
+	for (Object *list = List_arg(args[0], ctx); list; list = List_rest(list, ctx)) {
+		if (ListObj_empty(list)) {
+			return GC_alloc_int(ctx->gc, length);
+		}
+		length += 1;
+	}
+	return NULL;
+}
+
+// The n-th element of the list (from 1)
+Object *List_nth(Object **args, Context *ctx)
+{
+	Number num;
+	if (!Builtin_numeric(args[0], ctx, &num)) {
+		return NULL;
+	}
+	double n = Number_value(num);
+	Object *list = List_arg(args[1], ctx);
+	for (double i = 1; list; i++) {
+		if (ListObj_empty(list) || n < 1) {
+			char text[NUMBER_TEXT_SIZE];
+			errorf("no element %s in a list", Number_format(num, text));
+			return NULL;
+		}
+		if (i == n) {
+			return ListObj_head(list);
+		}
+		list = List_rest(list, ctx);
+	}
+	return NULL;
+}
+
+// NOTE: the results are appended to the last cell of the list that
+// starts with a dummy cell, which is protected during the calls
+static Object *List_append(Object *last, Object *head, Context *ctx)
+{
+	Object *cell = GC_alloc_cell(ctx->gc, head, NULL);
+	ListObj_tail(last) = cell;
+	return cell;
+}
+
+static Object *List_finish(Object *first, Object *last, Context *ctx)
+{
+	GC_unprotect(ctx->gc, 1);
+	if (!last) {
+		return NULL;
+	}
+	ListObj_tail(last) = GC_alloc_cell(ctx->gc, NULL, NULL);
+	return ListObj_tail(first);
+}
+
+static Object *List_map_step(Object **args, Context *ctx)
+{
+	Object *list = List_arg(args[1], ctx);
+	if (!list) {
+		return NULL;
+	}
+	if (ListObj_empty(list)) {
+		return list;
+	}
+	// NOTE: the suspensions are not forced, so there's no collection here
+	Object *head = List_suspend(&apply_step, (Object *[]){args[0], ListObj_head(list)}, ctx);
+	Object *tail = List_suspend(&map_step, (Object *[]){args[0], ListObj_tail(list)}, ctx);
+	return GC_alloc_cell(ctx->gc, head, tail);
+}
+
+static Object *List_apply_step(Object **args, Context *ctx)
+{
+	return eval_apply(args[0], 1, &args[1], ctx);
+}
+
+Object *List_map(Object **args, Context *ctx)
+{
+	if (lazy) {
+		return List_map_step(args, ctx);
+	}
+	Object *first = GC_alloc_cell(ctx->gc, NULL, NULL);
+	GC_protect(ctx->gc, first);
+	Object *last = first;
+	for (Object *list = List_arg(args[1], ctx);; list = List_rest(list, ctx)) {
+		if (!list) {
+			last = NULL;
+			break;
+		}
+		if (ListObj_empty(list)) {
+			break;
+		}
+		Object *head = ListObj_head(list);
+		Object *value = eval_apply(args[0], 1, &head, ctx);
+		if (!value) {
+			last = NULL;
+			break;
+		}
+		last = List_append(last, value, ctx);
+	}
+	return List_finish(first, last, ctx);
+}
+
+// Skip the elements that don't satisfy the predicate, returns the cell
+// of the next element or the empty list
+static Object *List_skip(Object *fn, Object *list, Context *ctx)
+{
+	for (; list && !ListObj_empty(list); list = List_rest(list, ctx)) {
+		Object *head = ListObj_head(list);
+		double keep;
+		Object *result = eval_apply(fn, 1, &head, ctx);
+		if (!result || !Builtin_number(result, ctx, &keep)) {
+			return NULL;
+		}
+		if (keep) {
+			return list;
+		}
+	}
+	return list;
+}
+
+static Object *List_filter_step(Object **args, Context *ctx)
+{
+	Object *list = List_skip(args[0], List_arg(args[1], ctx), ctx);
+	if (!list || ListObj_empty(list)) {
+		return list;
+	}
+	Object *tail = List_suspend(&filter_step, (Object *[]){args[0], ListObj_tail(list)}, ctx);
+	return GC_alloc_cell(ctx->gc, ListObj_head(list), tail);
+}
+
+Object *List_filter(Object **args, Context *ctx)
+{
+	if (lazy) {
+		return List_filter_step(args, ctx);
+	}
+	Object *first = GC_alloc_cell(ctx->gc, NULL, NULL);
+	GC_protect(ctx->gc, first);
+	Object *last = first;
+	Object *list = List_arg(args[1], ctx);
+	for (;;) {
+		list = List_skip(args[0], list, ctx);
+		if (!list) {
+			last = NULL;
+			break;
+		}
+		if (ListObj_empty(list)) {
+			break;
+		}
+		last = List_append(last, ListObj_head(list), ctx);
+		list = List_rest(list, ctx);
+	}
+	return List_finish(first, last, ctx);
+}
+
+// NOTE: strict in the accumulator in both of the modes, so a long list
+// doesn't build a chain of thunks
+Object *List_foldl(Object **args, Context *ctx)
+{
+	GC *gc = ctx->gc;
+	Object *acc = args[1];
+	GC_protect(gc, acc);
+	for (Object *list = List_arg(args[2], ctx);; list = List_rest(list, ctx)) {
+		if (!list) {
+			acc = NULL;
+			break;
+		}
+		if (ListObj_empty(list)) {
+			break;
+		}
+		acc = eval_apply(args[0], 2, (Object *[]){acc, ListObj_head(list)}, ctx);
+		if (!acc) {
+			break;
+		}
+		gc->roots[gc->nroots - 1] = acc;
+	}
+	GC_unprotect(gc, 1);
+	return acc;
+}
+
+static Object *List_foldr_step(Object **args, Context *ctx)
+{
+	Object *list = List_arg(args[2], ctx);
+	if (!list) {
+		return NULL;
+	}
+	if (ListObj_empty(list)) {
+		return args[1];
+	}
+	Object *rest = List_suspend(&foldr_step, (Object *[]){args[0], args[1], ListObj_tail(list)}, ctx);
+	GC_protect(ctx->gc, rest);
+	Object *result = eval_apply(args[0], 2, (Object *[]){ListObj_head(list), rest}, ctx);
+	GC_unprotect(ctx->gc, 1);
+	return result;
+}
+
+// NOTE: in the strict mode the elements are collected first,
+// so the fold doesn't take the C stack
+Object *List_foldr(Object **args, Context *ctx)
+{
+	if (lazy) {
+		return List_foldr_step(args, ctx);
+	}
+	int count = 0, size = 0;
+	Object **elems = NULL;
+	for (Object *list = List_arg(args[2], ctx);; list = List_rest(list, ctx)) {
+		if (!list) {
+			free(elems);
+			return NULL;
+		}
+		if (ListObj_empty(list)) {
+			break;
+		}
+		if (count == size) {
+			size = size ? size * 2 : 16;
+			elems = reallocarray(elems, size, sizeof(*elems));
+		}
+		elems[count] = ListObj_head(list);
+		count += 1;
+	}
+	// NOTE: the elements are kept alive by the list
+	GC *gc = ctx->gc;
+	Object *acc = args[1];
+	GC_protect(gc, acc);
+	for (int i = count - 1; i >= 0 && acc; i--) {
+		acc = eval_apply(args[0], 2, (Object *[]){elems[i], acc}, ctx);
+		gc->roots[gc->nroots - 1] = acc;
+	}
+	GC_unprotect(gc, 1);
+	free(elems);
+	return acc;
+}
+
+static Object *List_range_step(Object **args, Context *ctx)
+{
+	Number from, to;
+	if (!Builtin_numeric(args[0], ctx, &from) || !Builtin_numeric(args[1], ctx, &to)) {
+		return NULL;
+	}
+	if (Number_value(from) >= Number_value(to)) {
+		return GC_alloc_cell(ctx->gc, NULL, NULL);
+	}
+	Number_op('+', from, Number_int(1), &from);
+	Object *next = GC_alloc_boxed(ctx->gc, from);
+	Object *tail = List_suspend(&range_step, (Object *[]){next, args[1]}, ctx);
+	return GC_alloc_cell(ctx->gc, args[0], tail);
+}
+
+// The numbers from the first one up to the second one (not included),
+// they are integers if the first one is
+Object *List_range(Object **args, Context *ctx)
+{
+	Number from, to;
+	if (!Builtin_numeric(args[0], ctx, &from) || !Builtin_numeric(args[1], ctx, &to)) {
+		return NULL;
+	}
+	if (lazy) {
+		Object *bounds[] = {GC_alloc_boxed(ctx->gc, from), GC_alloc_boxed(ctx->gc, to)};
+		return List_range_step(bounds, ctx);
+	}
+	// NOTE: nothing is evaluated, so the list doesn't need protection
+	Object *first = GC_alloc_cell(ctx->gc, NULL, NULL);
+	Object *last = first;
+	for (Number n = from; Number_value(n) < Number_value(to); Number_op('+', n, Number_int(1), &n)) {
+		last = List_append(last, GC_alloc_boxed(ctx->gc, n), ctx);
+	}
+	ListObj_tail(last) = GC_alloc_cell(ctx->gc, NULL, NULL);
+	return ListObj_tail(first);
+}
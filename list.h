@@ -0,0 +1,21 @@
+#ifndef LIST_INCLUDED
+#define LIST_INCLUDED
+
+#include "object.h"
+#include "context.h"
+
+// the builtins, see builtin.c
+Object *List_nil(Object **args, Context *ctx);
+Object *List_cons(Object **args, Context *ctx);
+Object *List_head(Object **args, Context *ctx);
+Object *List_tail(Object **args, Context *ctx);
+Object *List_empty(Object **args, Context *ctx);
+Object *List_length(Object **args, Context *ctx);
+Object *List_nth(Object **args, Context *ctx);
+Object *List_map(Object **args, Context *ctx);
+Object *List_filter(Object **args, Context *ctx);
+Object *List_foldl(Object **args, Context *ctx);
+Object *List_foldr(Object **args, Context *ctx);
+Object *List_range(Object **args, Context *ctx);
+
+#endif // LIST_INCLUDED
@@ -0,0 +1,87 @@
+#include "loop.h"
+
+#include "object.h"
+#include "values.h"
+#include "gc.h"
+#include "eval.h"
+#include "context.h"
+#include "builtin.h"
+
+
+// Counted loops: the builtins call the function once per step from
+// a C loop, so a step costs the call of the function alone instead of
+// a call of a recursive function with the counter and the accumulator.
+// NOTE: the function is forced before the loop and the arguments of a
+// step are protected, so they can't be collected before they are bound.
+// The accumulators are forced on every step, so the loops don't build
+// chains of thunks in the lazy mode.
+
+// 'iterate n f x' is f (f ... (f x)) with n calls of f
+Object *Loop_iterate(Object **args, Context *ctx)
+{
+	GC *gc = ctx->gc;
+	double n;
+	Object *fn;
+	if (!Builtin_number(args[0], ctx, &n) || !(fn = eval_force(args[1], ctx))) {
+		return NULL;
+	}
+	Object *x = args[2];
+	GC_protect(gc, x);
+	for (double i = 0; i < n && x; i++) {
+		x = eval_apply(fn, 1, &x, ctx);
+		gc->roots[gc->nroots - 1] = x;
+	}
+	GC_unprotect(gc, 1);
+	return x;
+}
+
+// 'sumrange a b f' is f a + f (a + 1) + ... + f (b - 1)
+Object *Loop_sumrange(Object **args, Context *ctx)
+{
+	Number from, to;
+	Object *fn;
+	if (
+		!Builtin_numeric(args[0], ctx, &from) || !Builtin_numeric(args[1], ctx, &to) ||
+		!(fn = eval_force(args[2], ctx))
+	) {
+		return NULL;
+	}
+	Number sum = Number_int(0);
+	for (Number i = from; Number_value(i) < Number_value(to); Number_op('+', i, Number_int(1), &i)) {
+		Number term;
+		Object *arg = GC_alloc_boxed(ctx->gc, i);
+		GC_protect(ctx->gc, arg);
+		Object *result = eval_apply(fn, 1, &arg, ctx);
+		GC_unprotect(ctx->gc, 1);
+		if (!result || !Builtin_numeric(result, ctx, &term)) {
+			return NULL;
+		}
+		Number_op('+', sum, term, &sum);
+	}
+	return GC_alloc_boxed(ctx->gc, sum);
+}
+
+// 'foldrange a b f acc' is f (... (f (f acc a) (a + 1)) ...) (b - 1)
+Object *Loop_foldrange(Object **args, Context *ctx)
+{
+	GC *gc = ctx->gc;
+	Number from, to;
+	Object *fn;
+	if (
+		!Builtin_numeric(args[0], ctx, &from) || !Builtin_numeric(args[1], ctx, &to) ||
+		!(fn = eval_force(args[2], ctx))
+	) {
+		return NULL;
+	}
+	Object *acc = args[3];
+	GC_protect(gc, acc);
+	for (Number i = from; Number_value(i) < Number_value(to) && acc; Number_op('+', i, Number_int(1), &i)) {
+		Object *step[] = {acc, GC_alloc_boxed(gc, i)};
+		GC_protect(gc, step[1]);
+		acc = eval_apply(fn, 2, step, ctx);
+		GC_unprotect(gc, 1);
+		gc->roots[gc->nroots - 1] = acc;
+	}
+	GC_unprotect(gc, 1);
+	return acc;
+}
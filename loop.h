@@ -0,0 +1,12 @@
+#ifndef LOOP_INCLUDED
+#define LOOP_INCLUDED
+
+#include "object.h"
+#include "context.h"
+
+// the builtins, see builtin.c
+Object *Loop_iterate(Object **args, Context *ctx);
+Object *Loop_sumrange(Object **args, Context *ctx);
+Object *Loop_foldrange(Object **args, Context *ctx);
+
+#endif // LOOP_INCLUDED
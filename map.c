@@ -0,0 +1,249 @@
+#include "map.h"
+
+#include <string.h>
+#include <math.h>
+
+#include "object.h"
+#include "values.h"
+#include "gc.h"
+#include "context.h"
+#include "builtin.h"
+#include "error.h"
+
+
+#define ERROR_PREFIX "evaluation error"
+
+// Maps from numbers are hash array mapped tries: every level of the trie
+// takes 5 more bits of the hash of the key to pick one of the 32 slots of
+// a node. An update copies only the nodes on the path to the key, the
+// rest of the trie is shared with the old map, so it allocates at most
+// one node per level. The hash of the bits of the key is a bijection and
+// the level below the last bit of the hash is picked by whether the key is
+// an integer, so the different keys never end up in the same slot and
+// the trie needs no collision lists.
+
+#define BITS 5
+#define MASK ((1 << BITS) - 1)
+#define HASH_BITS 64
+
+// The integral doubles are the same keys as the integers (so -0 is 0),
+// the integers are compared exactly
+static Number Map_key(Number num)
+{
+	if (!num.exact && num.d == trunc(num.d) && num.d >= -0x1p63 && num.d < 0x1p63) {
+		return Number_int(num.d);
+	}
+	return num;
+}
+
+static unsigned long Map_hash(Number key)
+{
+	unsigned long h = key.i;
+	// the finalizer of splitmix64, every step of it is invertible
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9UL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebUL;
+	return h ^ (h >> 31);
+}
+
+#define slot_bit(hash, key, shift) \
+	((shift) < HASH_BITS ? 1U << (((hash) >> (shift)) & MASK) : 1U << (key).exact)
+#define slot_index(node, bit) (__builtin_popcount(MapObj_bitmap(node) & ((bit) - 1)))
+
+// A copy of the node with a slot added (at the bit), removed or replaced
+static Object *Map_copy(GC *gc, Object *node, unsigned int bit, int change, long size)
+{
+	unsigned int bitmap = MapObj_bitmap(node);
+	if (change > 0) {
+		bitmap |= bit;
+	} else if (change < 0) {
+		bitmap &= ~bit;
+	}
+	Object *new = GC_alloc_map(gc, bitmap, MapObj_leaves(node) & bitmap, size);
+	int index = slot_index(node, bit);
+	int set = (MapObj_bitmap(node) & bit) != 0;
+	Slot *from = MapObj_slots(node), *to = MapObj_slots(new);
+	memcpy(to, from, index * sizeof(Slot));
+	memcpy(to + index + (change >= 0), from + index + set, (MapObj_count(node) - index - set) * sizeof(Slot));
+	return new;
+}
+
+static Object *Map_leaf(Object *node, unsigned int bit, Number key, Object *value)
+{
+	Slot *slot = &MapObj_slots(node)[slot_index(node, bit)];
+	slot->key = key;
+	slot->value = value;
+	MapObj_leaves(node) |= bit;
+	return node;
+}
+
+static Object *Map_branch(Object *node, unsigned int bit, Object *child)
+{
+	Slot *slot = &MapObj_slots(node)[slot_index(node, bit)];
+	slot->value = child;
+	MapObj_leaves(node) &= ~bit;
+	return node;
+}
+
+// The node of the two pairs, the keys share the bits of the hashes so far
+static Object *Map_pair(GC *gc, int shift, Number key, Object *value, unsigned long hash, Number key2, Object *value2)
+{
+	unsigned int bit = slot_bit(Map_hash(key), key, shift);
+	unsigned int bit2 = slot_bit(hash, key2, shift);
+	if (bit == bit2) {
+		Object *child = Map_pair(gc, shift + BITS, key, value, hash, key2, value2);
+		return Map_branch(GC_alloc_map(gc, bit, 0, 2), bit, child);
+	}
+	Object *node = GC_alloc_map(gc, bit | bit2, 0, 2);
+	return Map_leaf(Map_leaf(node, bit, key, value), bit2, key2, value2);
+}
+
+static Object *Map_insert_at(GC *gc, Object *node, unsigned long hash, int shift, Number key, Object *value)
+{
+	unsigned int bit = slot_bit(hash, key, shift);
+	if (!(MapObj_bitmap(node) & bit)) {
+		return Map_leaf(Map_copy(gc, node, bit, 1, MapObj_size(node) + 1), bit, key, value);
+	}
+	Slot *slot = &MapObj_slots(node)[slot_index(node, bit)];
+	if (!(MapObj_leaves(node) & bit)) {
+		Object *child = Map_insert_at(gc, slot->value, hash, shift + BITS, key, value);
+		long size = MapObj_size(node) + MapObj_size(child) - MapObj_size(slot->value);
+		return Map_branch(Map_copy(gc, node, bit, 0, size), bit, child);
+	}
+	if (Number_same(slot->key, key)) {
+		return Map_leaf(Map_copy(gc, node, bit, 0, MapObj_size(node)), bit, key, value);
+	}
+	Object *child = Map_pair(gc, shift + BITS, slot->key, slot->value, hash, key, value);
+	return Map_branch(Map_copy(gc, node, bit, 0, MapObj_size(node) + 1), bit, child);
+}
+
+// NOTE: returns the same node if there's no such key
+static Object *Map_remove_at(GC *gc, Object *node, unsigned long hash, int shift, Number key)
+{
+	unsigned int bit = slot_bit(hash, key, shift);
+	if (!(MapObj_bitmap(node) & bit)) {
+		return node;
+	}
+	Slot *slot = &MapObj_slots(node)[slot_index(node, bit)];
+	if (MapObj_leaves(node) & bit) {
+		if (!Number_same(slot->key, key)) {
+			return node;
+		}
+		return Map_copy(gc, node, bit, -1, MapObj_size(node) - 1);
+	}
+	Object *child = Map_remove_at(gc, slot->value, hash, shift + BITS, key);
+	if (child == slot->value) {
+		return node;
+	}
+	if (MapObj_size(child) == 1 && MapObj_leaves(child)) {
+		// a single pair is pulled up, so the trie doesn't get deeper than needed
+		Slot *pair = &MapObj_slots(child)[0];
+		return Map_leaf(Map_copy(gc, node, bit, 0, MapObj_size(node) - 1), bit, pair->key, pair->value);
+	}
+	return Map_branch(Map_copy(gc, node, bit, 0, MapObj_size(node) - 1), bit, child);
+}
+
+// NOTE: the slot of the key or NULL
+static Slot *Map_find(Object *node, Number key)
+{
+	unsigned long hash = Map_hash(key);
+	for (int shift = 0;; shift += BITS) {
+		unsigned int bit = slot_bit(hash, key, shift);
+		if (!(MapObj_bitmap(node) & bit)) {
+			return NULL;
+		}
+		Slot *slot = &MapObj_slots(node)[slot_index(node, bit)];
+		if (MapObj_leaves(node) & bit) {
+			return Number_same(slot->key, key) ? slot : NULL;
+		}
+		node = slot->value;
+	}
+}
+
+// NOTE: the key is forced
+static int Map_key_arg(Object *arg, Context *ctx, Number *key)
+{
+	if (!Builtin_numeric(arg, ctx, key)) {
+		return 0;
+	}
+	*key = Map_key(*key);
+	return 1;
+}
+
+static Object *Map_arg(Object *arg, Context *ctx)
+{
+	return Builtin_arg(arg, MapObject, ctx);
+}
+
+Object *Map_empty(Object **args, Context *ctx)
+{
+	(void)args;
+	return GC_alloc_map(ctx->gc, 0, 0, 0);
+}
+
+// NOTE: the value is not forced
+Object *Map_insert(Object **args, Context *ctx)
+{
+	Number key;
+	if (!Map_key_arg(args[0], ctx, &key)) {
+		return NULL;
+	}
+	Object *map = Map_arg(args[2], ctx);
+	if (!map) {
+		return NULL;
+	}
+	return Map_insert_at(ctx->gc, map, Map_hash(key), 0, key, args[1]);
+}
+
+Object *Map_lookup(Object **args, Context *ctx)
+{
+	Number key;
+	if (!Map_key_arg(args[0], ctx, &key)) {
+		return NULL;
+	}
+	Object *map = Map_arg(args[1], ctx);
+	if (!map) {
+		return NULL;
+	}
+	Slot *slot = Map_find(map, key);
+	if (!slot) {
+		char text[NUMBER_TEXT_SIZE];
+		errorf("no key %s in a map", Number_format(key, text));
+		return NULL;
+	}
+	return slot->value;
+}
+
+Object *Map_member(Object **args, Context *ctx)
+{
+	Number key;
+	if (!Map_key_arg(args[0], ctx, &key)) {
+		return NULL;
+	}
+	Object *map = Map_arg(args[1], ctx);
+	if (!map) {
+		return NULL;
+	}
+	return GC_alloc_int(ctx->gc, Map_find(map, key) != NULL);
+}
+
+Object *Map_remove(Object **args, Context *ctx)
+{
+	Number key;
+	if (!Map_key_arg(args[0], ctx, &key)) {
+		return NULL;
+	}
+	Object *map = Map_arg(args[1], ctx);
+	if (!map) {
+		return NULL;
+	}
+	return Map_remove_at(ctx->gc, map, Map_hash(key), 0, key);
+}
+
+Object *Map_size(Object **args, Context *ctx)
+{
+	Object *map = Map_arg(args[0], ctx);
+	if (!map) {
+		return NULL;
+	}
+	return GC_alloc_int(ctx->gc, MapObj_size(map));
+}
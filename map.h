@@ -0,0 +1,15 @@
+#ifndef MAP_INCLUDED
+#define MAP_INCLUDED
+
+#include "object.h"
+#include "context.h"
+
+// the builtins, see builtin.c
+Object *Map_empty(Object **args, Context *ctx);
+Object *Map_insert(Object **args, Context *ctx);
+Object *Map_lookup(Object **args, Context *ctx);
+Object *Map_member(Object **args, Context *ctx);
+Object *Map_remove(Object **args, Context *ctx);
+Object *Map_size(Object **args, Context *ctx);
+
+#endif // MAP_INCLUDED
@@ -0,0 +1,132 @@
+#include "memo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+#include "values.h"
+#include "env.h"
+#include "gc.h"
+
+
+// Memoization (-m): the language is pure, so the result of a call of
+// a global function depends only on its arguments and the globals.
+// Only numeric calls are cached, and the cache is flushed on every 'let'.
+
+typedef struct {
+	const void *fn; // NULL if the entry is empty
+	int        count;
+	Number     args[MEMO_MAX_ARGS];
+	Number     result;
+} Entry;
+
+static Entry *table = NULL;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+// NOTE: the arguments are compared bitwise, so 0 and -0 (or 0 and 0.0)
+// are different keys
+static unsigned long Memo_hash(const void *fn, int count, const Number *args)
+{
+	unsigned long hash = (unsigned long)fn;
+	for (int i = 0; i < count; i++) {
+		unsigned long bits = args[i].i + args[i].exact;
+		hash = (hash ^ bits ^ (bits >> 32)) * 0x100000001b3;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccd;
+	return (hash ^ (hash >> 33)) % MEMO_SIZE;
+}
+
+// The argument bound to the name if it's a number
+int Memo_arg(Object *env, const char *name, Number *arg)
+{
+	Object *obj = Env_get(EnvObj_env(env), name);
+	if (obj && obj->type == ThunkObject) {
+		obj = ThunkObj_value(obj);
+	} else if (obj && obj->type == CompthunkObject) {
+		obj = CompThunkObj_value(obj);
+	}
+	return obj && Number_unbox(obj, arg);
+}
+
+static int Memo_same(const Number *args, const Number *other, int count)
+{
+	for (int i = 0; i < count; i++) {
+		if (!Number_same(args[i], other[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int Memo_get(const void *fn, int count, const Number *args, Number *result)
+{
+	if (!table) {
+		table = calloc(MEMO_SIZE, sizeof(*table));
+	}
+	Entry *entry = &table[Memo_hash(fn, count, args)];
+	if (entry->fn == fn && entry->count == count && Memo_same(entry->args, args, count)) {
+		hits += 1;
+		*result = entry->result;
+		return 1;
+	}
+	misses += 1;
+	return 0;
+}
+
+void Memo_put(const void *fn, int count, const Number *args, Number result)
+{
+	if (!table) {
+		table = calloc(MEMO_SIZE, sizeof(*table));
+	}
+	Entry *entry = &table[Memo_hash(fn, count, args)];
+	entry->fn = fn;
+	entry->count = count;
+	memcpy(entry->args, args, count * sizeof(*args));
+	entry->result = result;
+}
+
+void Memo_flush(void)
+{
+	if (table) {
+		memset(table, 0, MEMO_SIZE * sizeof(*table));
+	}
+}
+
+void Memo_print_stats(void)
+{
+	fprintf(stderr, "memo: %lu hits, %lu misses\n", hits, misses);
+}
+
+static int Memo_args_comp(const CompFnDesc *desc, Object *env, Number *args)
+{
+	for (int i = 0; i < desc->arity; i++) {
+		if (!Memo_arg(env, desc->params[i], &args[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// The boxed result of a call of a compiled function or NULL,
+// the arguments are bound in the env
+Object *Memo_get_comp(GC *gc, const CompFnDesc *desc, Object *env)
+{
+	Number args[MEMO_MAX_ARGS];
+	Number result;
+	if (!Memo_args_comp(desc, env, args) || !Memo_get(desc, desc->arity, args, &result)) {
+		return NULL;
+	}
+	return GC_alloc_boxed(gc, result);
+}
+
+void Memo_put_comp(const CompFnDesc *desc, Object *env, Object *value)
+{
+	Number args[MEMO_MAX_ARGS];
+	Number result;
+	if (Number_unbox(value, &result) && Memo_args_comp(desc, env, args)) {
+		Memo_put(desc, desc->arity, args, result);
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef MEMO_INCLUDED
+#define MEMO_INCLUDED
+
+#include "object.h"
+#include "gc.h"
+#include "values.h"
+
+// functions with more parameters are not memoized
+#define MEMO_MAX_ARGS 4
+// the cache is direct mapped: a new entry evicts the old one with the same hash
+#define MEMO_SIZE (1 << 16)
+
+// NOTE: the key of a function is any address that identifies its code
+// (the FnNode or the CompFnDesc of the outermost one of the nested functions)
+int    Memo_arg(Object *env, const char *name, Number *arg);
+int    Memo_get(const void *fn, int count, const Number *args, Number *result);
+void   Memo_put(const void *fn, int count, const Number *args, Number result);
+void   Memo_flush(void);
+void   Memo_print_stats(void);
+Object *Memo_get_comp(GC *gc, const CompFnDesc *desc, Object *env);
+void   Memo_put_comp(const CompFnDesc *desc, Object *env, Object *value);
+
+#endif // MEMO_INCLUDED
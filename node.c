@@ -1,127 +1,410 @@
 #include "node.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
-#include "arena.h"
+#include "worklist.h"
+#include "error.h"
 
 
-static Node *Node_alloc(Arena *a, NodeType type)
+#define ERROR_PREFIX "memory error"
+
+// NOTE: only the address space is reserved, the pages are used
+// once the nodes are built there
+#define NODE_POOL_MAX (1 << 26)
+#define NAMES_INITIAL_BUCKETS 256
+
+Node   *Node_pool = NULL;
+Number *Node_numbers = NULL;
+char   **Node_names = NULL;
+
+static NodeIndex nodes = 0;
+static Worklist(Number) numbers = WORKLIST_EMPTY;
+static Worklist(char *) names = WORKLIST_EMPTY;
+// the open addressing table of the names, the indices are shifted by 1
+static unsigned *buckets = NULL;
+static unsigned nbuckets = 0;
+
+static Node *Node_alloc(NodeType type)
 {
-	Node *node = Arena_alloc(a, sizeof(*node));
+	if (!Node_pool) {
+		Node_pool = mmap(NULL, NODE_POOL_MAX * sizeof(Node), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (Node_pool == MAP_FAILED) {
+			error("can't reserve the nodes");
+			exit(1);
+		}
+	}
+	if (nodes == NODE_POOL_MAX) {
+		error("too many nodes");
+		exit(1);
+	}
+	Node *node = Node_at(nodes++);
 	node->type = type;
 	return node;
 }
 
-Node *NumberNode_new(Arena *a, double number)
+Node *NumberNode_new(Number number)
 {
-	Node *node = Node_alloc(a, NumberNode);
-	node->as.number = number;
+	Node *node = Node_alloc(NumberNode);
+	node->as.number = numbers.size;
+	Worklist_push(&numbers, 0);
+	*Worklist_top(&numbers) = number;
+	Node_numbers = numbers.items;
 	return node;
 }
 
-Node *IdNode_new(Arena *a, const char *string, int length)
+static unsigned hash(const char *string, int length)
+{
+	unsigned h = 2166136261u;
+	for (int i = 0; i < length; i++) {
+		h = (h ^ (unsigned char)string[i]) * 16777619u;
+	}
+	return h;
+}
+
+static void rehash(void)
+{
+	free(buckets);
+	nbuckets = nbuckets ? nbuckets * 2 : NAMES_INITIAL_BUCKETS;
+	buckets = calloc(nbuckets, sizeof(*buckets));
+	for (int i = 0; i < names.size; i++) {
+		unsigned j = hash(names.items[i], strlen(names.items[i])) & (nbuckets - 1);
+		for (; buckets[j]; j = (j + 1) & (nbuckets - 1));
+		buckets[j] = i + 1;
+	}
+}
+
+static IdValue intern(const char *string, int length)
 {
-	Node *node = Node_alloc(a, IdNode);
-	char *id = Arena_alloc(a, length+1);
-	strncpy(id, string, length);
-	id[length] = '\0';
-	node->as.id = id;
+	if (2 * names.size >= (int)nbuckets) {
+		rehash();
+	}
+	unsigned i = hash(string, length) & (nbuckets - 1);
+	for (; buckets[i]; i = (i + 1) & (nbuckets - 1)) {
+		const char *name = names.items[buckets[i] - 1];
+		if (!strncmp(name, string, length) && name[length] == '\0') {
+			return buckets[i] - 1;
+		}
+	}
+	buckets[i] = names.size + 1;
+	Worklist_push(&names, strndup(string, length));
+	Node_names = names.items;
+	return names.size - 1;
+}
+
+Node *IdNode_new(const char *string, int length)
+{
+	Node *node = Node_alloc(IdNode);
+	node->as.id = intern(string, length);
 	return node;
 }
 
-static Node *PairNode_new(Arena *a, NodeType type, Node *left, Node *right, int op)
+static Node *PairNode_new(NodeType type, Node *left, Node *right, int op)
 {
-	Node *node = Node_alloc(a, type);
-	node->as.pair.left = left;
-	node->as.pair.right = right;
+	Node *node = Node_alloc(type);
+	node->as.pair.left = Node_index(left);
+	node->as.pair.right = Node_index(right);
 	node->as.pair.op = op;
 	return node;
 }
 
-Node *ApplicationNode_new(Arena *a, Node *left, Node *right)
+Node *ApplicationNode_new(Node *left, Node *right)
 {
-	return PairNode_new(a, ApplNode, left, right, ' ');
+	return PairNode_new(ApplNode, left, right, 0);
 }
 
-Node *OpNode_new(Arena *a, Node *left, Node *right, NodeType type, int op)
+Node *OpNode_new(Node *left, Node *right, NodeType type, int op)
 {
-	return PairNode_new(a, type, left, right, op);
+	return PairNode_new(type, left, right, op);
 }
 
-Node *IfNode_new(Arena *a, Node *cond, Node *true, Node *false)
+Node *IfNode_new(Node *cond, Node *true, Node *false)
 {
-	Node *node = Node_alloc(a, IfNode);
-	node->as.ifelse.cond = cond;
-	node->as.ifelse.true = true;
-	node->as.ifelse.false = false;
+	Node *node = Node_alloc(IfNode);
+	node->as.ifelse.cond = Node_index(cond);
+	node->as.ifelse.true = Node_index(true);
+	node->as.ifelse.false = Node_index(false);
 	return node;
 }
 
-Node *FnNode_new(Arena *a, Node *param, Node *body)
+Node *FnNode_new(Node *param, Node *body)
 {
-	Node *node = Node_alloc(a, FnNode);
-	node->as.fn.param = param;
-	node->as.fn.body = body;
+	Node *node = Node_alloc(FnNode);
+	node->as.fn.param = Node_index(param);
+	node->as.fn.body = Node_index(body);
+	// NOTE: 'let f x y = ...' is desugared into nested functions, that
+	// can be called with all of the arguments at once, see eval.c
+	node->as.fn.arity = body->type == FnNode ? FnNode_arity(body) + 1 : 1;
+	node->as.fn.strict = 0;
+	node->as.fn.saturated = 0;
+	node->as.fn.lazy = 0;
 	return node;
 }
 
-Node *LetNode_new(Arena *a, Node *name, Node *value)
+Node *LetNode_new(Node *name, Node *value)
 {
-	Node *node = Node_alloc(a, LetNode);
-	node->as.let.name = name;
-	node->as.let.value = value;
+	Node *node = Node_alloc(LetNode);
+	node->as.let.name = Node_index(name);
+	node->as.let.value = Node_index(value);
 	return node;
 }
 
-static void Node_print_parenthesised(const Node *expr)
+Node *GuardNode_new(Node *inlined, Node *original, unsigned version)
 {
-	putchar('(');
-	Node_print(expr);
-	putchar(')');
+	Node *node = Node_alloc(GuardNode);
+	node->as.guard.inlined = Node_index(inlined);
+	node->as.guard.original = Node_index(original);
+	node->as.guard.version = version;
+	return node;
 }
 
-void Node_print(const Node *expr)
+void PairNode_quicken(Node *node)
+{
+	switch (PairNode_op(node)) {
+		case '+': node->type = NumAddNode; break;
+		case '-': node->type = NumSubNode; break;
+		case '*': node->type = NumMulNode; break;
+		case '/': node->type = NumDivNode; break;
+		case '%': node->type = NumModNode; break;
+		case '^': node->type = NumPowNode; break;
+		case '>': node->type = NumGtNode;  break;
+		case '<': node->type = NumLtNode;  break;
+		case '=': node->type = NumEqNode;  break;
+	}
+}
+
+void PairNode_deopt(Node *node)
+{
+	switch (PairNode_op(node)) {
+		case '+': case '-':           node->type = SumNode;  break;
+		case '*': case '/': case '%': node->type = ProdNode; break;
+		case '^':                     node->type = ExptNode; break;
+		case '>': case '<': case '=': node->type = CmpNode;  break;
+	}
+}
+
+int Node_children(const Node *expr, Node *children[NODE_MAX_CHILDREN])
 {
 	switch (expr->type) {
 		case NumberNode:
-			printf("%lf", NumNode_value(expr));
-			break;
 		case IdNode:
-			printf("%s", IdNode_value(expr));
-			break;
-		case ApplNode:
-		case ExptNode:
-		case ProdNode:
-		case SumNode:
-		case CmpNode:
-		case AndNode:
-		case OrNode:
-			Node_print_parenthesised(PairNode_left(expr));
-			putchar(PairNode_op(expr));
-			Node_print_parenthesised(PairNode_right(expr));
-			break;
+			return 0;
 		case IfNode:
-			printf("if ");
-			Node_print_parenthesised(IfNode_cond(expr));
-			printf(" then ");
-			Node_print_parenthesised(IfNode_true(expr));
-			printf(" else ");
-			Node_print_parenthesised(IfNode_false(expr));
-			break;
+			children[0] = IfNode_cond(expr);
+			children[1] = IfNode_true(expr);
+			children[2] = IfNode_false(expr);
+			return 3;
 		case FnNode:
-			printf("fn ");
-			Node_print(FnNode_param(expr));
-			printf(": ");
-			Node_print(FnNode_body(expr));
-			break;
+			children[0] = FnNode_body(expr);
+			return 1;
 		case LetNode:
-			printf("let ");
-			Node_print(LetNode_name(expr));
-			printf("= ");
-			Node_print(LetNode_value(expr));
-			break;
+			children[0] = LetNode_value(expr);
+			return 1;
+		case GuardNode:
+			children[0] = GuardNode_inlined(expr);
+			children[1] = GuardNode_original(expr);
+			return 2;
+		default:
+			children[0] = PairNode_left(expr);
+			children[1] = PairNode_right(expr);
+			return 2;
+	}
+}
+
+// Push the children so that they are popped in order
+#define push_children(pending, node, ...) ({\
+	Node *children[NODE_MAX_CHILDREN];\
+	for (int i = Node_children(node, children) - 1; i >= 0; i--) {\
+		Worklist_push(pending, children[i], ##__VA_ARGS__);\
+	}\
+})
+
+void Node_quicken(Node *expr)
+{
+	Worklist(Node *) pending = WORKLIST_EMPTY;
+	Worklist_push(&pending, expr);
+	while (!Worklist_empty(&pending)) {
+		Node *node = Worklist_pop(&pending);
+		switch (node->type) {
+			case ExptNode:
+			case ProdNode:
+			case SumNode:
+			case CmpNode:
+				PairNode_quicken(node);
+				break;
+			default:
+				break;
+		}
+		push_children(&pending, node);
+	}
+	Worklist_destroy(&pending);
+}
+
+static void Node_mark_calls(Node *expr)
+{
+	Worklist(Node *) pending = WORKLIST_EMPTY;
+	Worklist_push(&pending, expr);
+	while (!Worklist_empty(&pending)) {
+		Node *node = Worklist_pop(&pending);
+		if (node->type == ApplNode) {
+			ApplNode_tail(node) = 1;
+		}
+		push_children(&pending, node);
+	}
+	Worklist_destroy(&pending);
+}
+
+typedef struct {
+	Node *node;
+	int  tail; // the node is in a tail position
+} Position;
+
+static void Node_unmark_calls(Node *expr)
+{
+	Worklist(Position) pending = WORKLIST_EMPTY;
+	Worklist_push(&pending, expr, 0);
+	while (!Worklist_empty(&pending)) {
+		Position p = Worklist_pop(&pending);
+		Node *node = p.node;
+		switch (node->type) {
+			case NumberNode:
+			case IdNode:
+				break;
+			case IfNode:
+				Worklist_push(&pending, IfNode_false(node), p.tail);
+				Worklist_push(&pending, IfNode_true(node), p.tail);
+				Worklist_push(&pending, IfNode_cond(node), 0);
+				break;
+			case FnNode:
+				Worklist_push(&pending, FnNode_body(node), 1);
+				break;
+			case GuardNode:
+				Worklist_push(&pending, GuardNode_original(node), p.tail);
+				Worklist_push(&pending, GuardNode_inlined(node), p.tail);
+				break;
+			case ApplNode:
+				if (!p.tail) {
+					ApplNode_tail(node) = 0;
+				}
+				// NOTE: only the outermost node of the spine is looked at
+				// fallthrough
+			default:
+				push_children(&pending, node, 0);
+				break;
+		}
+	}
+	Worklist_destroy(&pending);
+}
+
+// NOTE: a node can be shared by several places of the tree (see inline.c),
+// it's a tail call only if it's a tail call in all of them
+void Node_mark_tail_calls(Node *expr)
+{
+	Node_mark_calls(expr);
+	Node_unmark_calls(expr);
+}
+
+// NOTE: an item is either a node or the text around the nodes, a single
+// character if there is no text
+typedef struct {
+	const Node *node;
+	int        depth;
+	const char *text;
+	int        ch;
+} Printed;
+
+#define print_text(pending, text) (Worklist_push(pending, NULL, 0, text, 0))
+#define print_char(pending, ch) (Worklist_push(pending, NULL, 0, NULL, ch))
+#define print_node(pending, node, depth) (Worklist_push(pending, node, depth, NULL, 0))
+#define print_parenthesised(pending, node, depth) ({\
+	print_char(pending, ')');\
+	print_node(pending, node, depth);\
+	print_char(pending, '(');\
+})
+
+// NOTE: the items are pushed in the reverse order
+void Node_print_shallow(const Node *expr, int depth)
+{
+	Worklist(Printed) pending = WORKLIST_EMPTY;
+	print_node(&pending, expr, depth);
+	while (!Worklist_empty(&pending)) {
+		Printed p = Worklist_pop(&pending);
+		if (!p.node) {
+			if (p.text) {
+				printf("%s", p.text);
+			} else {
+				putchar(p.ch);
+			}
+			continue;
+		}
+		const Node *node = p.node;
+		if (p.depth == 0) {
+			printf("...");
+			continue;
+		}
+		int inner = p.depth - 1;
+		switch (node->type) {
+			case NumberNode:
+				Number_print(NumNode_value(node));
+				break;
+			case IdNode:
+				printf("%s", IdNode_value(node));
+				break;
+			case ApplNode:
+			case ExptNode:
+			case ProdNode:
+			case SumNode:
+			case CmpNode:
+			case AndNode:
+			case OrNode:
+			case NumAddNode:
+			case NumSubNode:
+			case NumMulNode:
+			case NumDivNode:
+			case NumModNode:
+			case NumPowNode:
+			case NumGtNode:
+			case NumLtNode:
+			case NumEqNode:
+				print_parenthesised(&pending, PairNode_right(node), inner);
+				print_char(&pending, node->type == ApplNode ? ' ' : PairNode_op(node));
+				print_parenthesised(&pending, PairNode_left(node), inner);
+				break;
+			case IfNode:
+				print_parenthesised(&pending, IfNode_false(node), inner);
+				print_text(&pending, " else ");
+				print_parenthesised(&pending, IfNode_true(node), inner);
+				print_text(&pending, " then ");
+				print_parenthesised(&pending, IfNode_cond(node), inner);
+				print_text(&pending, "if ");
+				break;
+			case FnNode:
+				print_node(&pending, FnNode_body(node), inner);
+				print_text(&pending, ": ");
+				print_text(&pending, FnNode_param_value(node));
+				print_text(&pending, FnNode_lazy(node) ? "fn ~" : "fn ");
+				break;
+			case LetNode:
+				print_node(&pending, LetNode_value(node), inner);
+				print_text(&pending, "= ");
+				print_text(&pending, LetNode_name_value(node));
+				print_text(&pending, "let ");
+				break;
+			case GuardNode:
+				print_parenthesised(&pending, GuardNode_inlined(node), inner);
+				print_text(&pending, "inline ");
+				break;
+		}
 	}
+	Worklist_destroy(&pending);
+}
+
+void Node_print(const Node *expr)
+{
+	Node_print_shallow(expr, -1);
 }
 
 void Node_println(const Node *node)
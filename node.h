@@ -1,10 +1,24 @@
 #ifndef NODE_INCLUDED
 #define NODE_INCLUDED
 
-#include "arena.h"
+#include "number.h"
 
 typedef struct Node Node;
 
+// The nodes are stored in one array in the order they are built (the
+// children before their parents, i.e. in the order they are evaluated)
+// and refer to their children by 32-bit indices into it. The numbers and
+// the names are kept in side tables. The array is reserved up front, so
+// the nodes never move and a Node * is a view into it.
+typedef unsigned NodeIndex;
+
+extern Node   *Node_pool;
+extern Number *Node_numbers;
+extern char   **Node_names;
+
+#define Node_at(index) (&Node_pool[index])
+#define Node_index(nodeptr) ((NodeIndex)((nodeptr) - Node_pool))
+
 typedef enum {
 	NumberNode,
 	IdNode,
@@ -18,53 +32,87 @@ typedef enum {
 	IfNode,
 	FnNode,
 	LetNode,
+	GuardNode,
+	// quickened binary operations, see PairNode_quicken
+	NumAddNode,
+	NumSubNode,
+	NumMulNode,
+	NumDivNode,
+	NumModNode,
+	NumPowNode,
+	NumGtNode,
+	NumLtNode,
+	NumEqNode,
 } NodeType;
 
-typedef double NumberValue;
+typedef unsigned NumberValue; // the index in Node_numbers
 
-#define NumNode_value(nodeptr) ((nodeptr)->as.number)
+#define NumNode_value(nodeptr) (Node_numbers[(nodeptr)->as.number])
 
-typedef char *IdValue;
+typedef unsigned IdValue; // the index in Node_names, the names are interned
 
-#define IdNode_value(nodeptr) ((nodeptr)->as.id)
+#define IdNode_value(nodeptr) (Node_names[(nodeptr)->as.id])
 
 typedef struct {
-	Node *left;
-	Node *right;
-	int  op; // used by SumNode, ProdNode and CmpNode to store the operation
+	NodeIndex left;
+	NodeIndex right;
+	int       op; // used by SumNode, ProdNode and CmpNode to store the operation
+	              // and by ApplNode to store whether it's a tail call
 } PairValue;
 
-#define PairNode_left(nodeptr) ((nodeptr)->as.pair.left)
-#define PairNode_right(nodeptr) ((nodeptr)->as.pair.right)
+#define PairNode_left(nodeptr) Node_at((nodeptr)->as.pair.left)
+#define PairNode_right(nodeptr) Node_at((nodeptr)->as.pair.right)
 #define PairNode_op(nodeptr) ((nodeptr)->as.pair.op)
+#define PairNode_quick(nodeptr) ((nodeptr)->type >= NumAddNode)
+#define ApplNode_tail(nodeptr) ((nodeptr)->as.pair.op)
 
 typedef struct {
-	Node *cond;
-	Node *true;
-	Node *false;
+	NodeIndex cond;
+	NodeIndex true;
+	NodeIndex false;
 } IfValue;
 
-#define IfNode_cond(nodeptr) ((nodeptr)->as.ifelse.cond)
-#define IfNode_true(nodeptr) ((nodeptr)->as.ifelse.true)
-#define IfNode_false(nodeptr) ((nodeptr)->as.ifelse.false)
+#define IfNode_cond(nodeptr) Node_at((nodeptr)->as.ifelse.cond)
+#define IfNode_true(nodeptr) Node_at((nodeptr)->as.ifelse.true)
+#define IfNode_false(nodeptr) Node_at((nodeptr)->as.ifelse.false)
 
 typedef struct {
-	Node *param;
-	Node *body;
+	NodeIndex param;
+	NodeIndex body;
+	unsigned  arity:29;    // the number of directly nested functions, this one included
+	unsigned  strict:1;    // the body always forces the parameter, see strict.c
+	unsigned  saturated:1; // the innermost body of the nested functions forces the parameter
+	unsigned  lazy:1;      // the parameter is passed by need ('~x')
 } FnValue;
 
-#define FnNode_param(nodeptr) ((nodeptr)->as.fn.param)
-#define FnNode_param_value(nodeptr) IdNode_value(((nodeptr)->as.fn.param))
-#define FnNode_body(nodeptr) ((nodeptr)->as.fn.body)
+#define FnNode_param(nodeptr) Node_at((nodeptr)->as.fn.param)
+#define FnNode_param_value(nodeptr) IdNode_value(FnNode_param(nodeptr))
+#define FnNode_body(nodeptr) Node_at((nodeptr)->as.fn.body)
+#define FnNode_arity(nodeptr) ((nodeptr)->as.fn.arity)
+#define FnNode_strict(nodeptr) ((nodeptr)->as.fn.strict)
+#define FnNode_saturated(nodeptr) ((nodeptr)->as.fn.saturated)
+#define FnNode_lazy(nodeptr) ((nodeptr)->as.fn.lazy)
 
 typedef struct {
-	Node *name;
-	Node *value;
+	NodeIndex name;
+	NodeIndex value;
 } LetValue;
 
-#define LetNode_name(nodeptr) ((nodeptr)->as.let.name)
-#define LetNode_name_value(nodeptr) IdNode_value(((nodeptr)->as.let.name))
-#define LetNode_value(nodeptr) ((nodeptr)->as.let.value)
+#define LetNode_name(nodeptr) Node_at((nodeptr)->as.let.name)
+#define LetNode_name_value(nodeptr) IdNode_value(LetNode_name(nodeptr))
+#define LetNode_value(nodeptr) Node_at((nodeptr)->as.let.value)
+
+// Inlined code is only valid while the global functions it was taken from
+// are not redefined, i.e. while the global env has the same version
+typedef struct {
+	NodeIndex inlined;
+	NodeIndex original;
+	unsigned  version;
+} GuardValue;
+
+#define GuardNode_inlined(nodeptr) Node_at((nodeptr)->as.guard.inlined)
+#define GuardNode_original(nodeptr) Node_at((nodeptr)->as.guard.original)
+#define GuardNode_version(nodeptr) ((nodeptr)->as.guard.version)
 
 typedef union {
 	NumberValue number; // NumberNode
@@ -72,6 +120,7 @@ typedef union {
 	IfValue     ifelse; // IfNode
 	FnValue     fn;     // FnNode
 	LetValue    let;    // LetNode
+	GuardValue  guard;  // GuardNode
 	PairValue   pair;   // others
 } NodeValue;
 
@@ -80,14 +129,29 @@ struct Node {
 	NodeValue as;
 };
 
-Node *NumberNode_new(Arena *a, double number);
-Node *IdNode_new(Arena *a, const char *string, int length);
-Node *ApplicationNode_new(Arena *a, Node *left, Node *right);
-Node *OpNode_new(Arena *a, Node *left, Node *right, NodeType type, int op);
-Node *IfNode_new(Arena *a, Node *cond, Node *true, Node *false);
-Node *FnNode_new(Arena *a, Node *param, Node *body);
-Node *LetNode_new(Arena *a, Node *name, Node *value);
+Node *NumberNode_new(Number number);
+Node *IdNode_new(const char *string, int length);
+Node *ApplicationNode_new(Node *left, Node *right);
+Node *OpNode_new(Node *left, Node *right, NodeType type, int op);
+Node *IfNode_new(Node *cond, Node *true, Node *false);
+Node *FnNode_new(Node *param, Node *body);
+Node *LetNode_new(Node *name, Node *value);
+Node *GuardNode_new(Node *inlined, Node *original, unsigned version);
+// NOTE: quickening rewrites the node in place, it only changes the type
+void PairNode_quicken(Node *node);
+void PairNode_deopt(Node *node);
+#define NODE_MAX_CHILDREN 3
+
+// NOTE: the children in the order they are evaluated, the parameters
+// and the names are not included. Returns their count.
+int  Node_children(const Node *expr, Node *children[NODE_MAX_CHILDREN]);
+// NOTE: quickens all of the binary operations, only valid if they are known to be numeric
+void Node_quicken(Node *expr);
+// NOTE: marks the calls the env of the enclosing function is dead after (see ApplNode_tail)
+void Node_mark_tail_calls(Node *expr);
 void Node_print(const Node *expr);
+// NOTE: the subtrees deeper than depth are printed as '...'
+void Node_print_shallow(const Node *expr, int depth);
 void Node_println(const Node *node);
 
 #endif // NODE_INCLUDED
@@ -0,0 +1,106 @@
+#include "number.h"
+
+#include <math.h>
+#include <stdio.h>
+
+
+// The operations on two integers are exact and the result is an integer,
+// unless it overflows or the operation has no exact result ('/', '%' by 0
+// or '^' with a negative exponent), then the operands are converted to
+// doubles, as they are when any of them is a double. The comparisons
+// are integers (1 or 0) either way.
+
+// NOTE: b is not negative, returns 0 on overflow
+static int Number_ipow(long a, long b, long *result)
+{
+	long r = 1;
+	for (; b; b >>= 1) {
+		if ((b & 1) && __builtin_mul_overflow(r, a, &r)) {
+			return 0;
+		}
+		if (b > 1 && __builtin_mul_overflow(a, a, &a)) {
+			return 0;
+		}
+	}
+	*result = r;
+	return 1;
+}
+
+static int Number_exact_op(int op, long left, long right, Number *result)
+{
+	long r;
+	switch (op) {
+		case '+':
+			if (__builtin_add_overflow(left, right, &r)) {
+				return 0;
+			}
+			break;
+		case '-':
+			if (__builtin_sub_overflow(left, right, &r)) {
+				return 0;
+			}
+			break;
+		case '*':
+			if (__builtin_mul_overflow(left, right, &r)) {
+				return 0;
+			}
+			break;
+		case '%':
+			if (!right) {
+				return 0;
+			}
+			// NOTE: LONG_MIN % -1 overflows
+			r = right == -1 ? 0 : left % right;
+			break;
+		case '^':
+			if (right < 0 || !Number_ipow(left, right, &r)) {
+				return 0;
+			}
+			break;
+		case '>': r = left > right;  break;
+		case '<': r = left < right;  break;
+		case '=': r = left == right; break;
+		default:
+			return 0;
+	}
+	*result = Number_int(r);
+	return 1;
+}
+
+int Number_op(int op, Number left, Number right, Number *result)
+{
+	if (left.exact && right.exact && Number_exact_op(op, left.i, right.i, result)) {
+		return 1;
+	}
+	double l = Number_value(left), r = Number_value(right);
+	switch (op) {
+		case '^': *result = Number_double(pow(l, r));  return 1;
+		case '*': *result = Number_double(l * r);      return 1;
+		case '/': *result = Number_double(l / r);      return 1;
+		case '%': *result = Number_double(fmod(l, r)); return 1;
+		case '+': *result = Number_double(l + r);      return 1;
+		case '-': *result = Number_double(l - r);      return 1;
+		case '>': *result = Number_int(l > r);         return 1;
+		case '<': *result = Number_int(l < r);         return 1;
+		case '=': *result = Number_int(l == r);        return 1;
+		default:  return 0;
+	}
+}
+
+// The text of the number as it's printed (e.g. in the error messages),
+// there must be NUMBER_TEXT_SIZE bytes for it
+char *Number_format(Number num, char *text)
+{
+	if (num.exact) {
+		snprintf(text, NUMBER_TEXT_SIZE, "%ld", num.i);
+	} else {
+		snprintf(text, NUMBER_TEXT_SIZE, "%lf", num.d);
+	}
+	return text;
+}
+
+void Number_print(Number num)
+{
+	char text[NUMBER_TEXT_SIZE];
+	fputs(Number_format(num, text), stdout);
+}
@@ -0,0 +1,28 @@
+#ifndef NUMBER_INCLUDED
+#define NUMBER_INCLUDED
+
+// An unboxed number: either an exact integer or a double
+typedef struct {
+	int exact;
+	union {
+		long   i;
+		double d;
+	};
+} Number;
+
+#define Number_int(n) ((Number){.exact = 1, .i = (n)})
+#define Number_double(n) ((Number){.exact = 0, .d = (n)})
+#define Number_value(n) ((n).exact ? (double)(n).i : (n).d)
+#define Number_true(n) ((n).exact ? (n).i != 0 : (n).d != 0)
+// NOTE: bitwise, so 0 and 0.0 (or 0.0 and -0.0) are different
+#define Number_same(n, m) ((n).exact == (m).exact && (n).i == (m).i)
+
+// enough for any double printed with "%lf"
+#define NUMBER_TEXT_SIZE 320
+
+// NOTE: returns 0 if the operation is unknown
+int  Number_op(int op, Number left, Number right, Number *result);
+char *Number_format(Number num, char *text);
+void Number_print(Number num);
+
+#endif // NUMBER_INCLUDED
@@ -3,14 +3,94 @@
 #include <stdio.h>
 
 #include "values.h"
+#include "vector.h"
 
 
+// The value of an evaluated thunk, NULL for an unevaluated one
+static const Object *Object_value(const Object *obj)
+{
+	if (obj->type == ThunkObject) {
+		return ThunkObj_value(obj);
+	}
+	return obj;
+}
+
+// NOTE: nothing is forced, the unevaluated parts are printed as '...'
+static void List_print(const Object *obj)
+{
+	putchar('[');
+	for (int first = 1;; first = 0) {
+		obj = Object_value(obj);
+		if (obj && ListObj_empty(obj)) {
+			break;
+		}
+		if (!first) {
+			printf(", ");
+		}
+		if (!obj) {
+			printf("...");
+			break;
+		}
+		const Object *head = Object_value(ListObj_head(obj));
+		if (head) {
+			Object_print(head);
+		} else {
+			printf("...");
+		}
+		obj = ListObj_tail(obj);
+	}
+	putchar(']');
+}
+
+// NOTE: the pairs are printed in the order of the hashes of the keys
+static int Map_print(const Object *node, int first)
+{
+	const Slot *slot = MapObj_slots(node);
+	for (unsigned int bits = MapObj_bitmap(node); bits; bits &= bits - 1, slot++) {
+		if (!(MapObj_leaves(node) & bits & -bits)) {
+			first = Map_print(slot->value, first);
+			continue;
+		}
+		const Object *value = Object_value(slot->value);
+		printf(first ? "" : ", ");
+		Number_print(slot->key);
+		printf(": ");
+		if (value) {
+			Object_print(value);
+		} else {
+			printf("...");
+		}
+		first = 0;
+	}
+	return first;
+}
+
+static void Vector_print(const Object *vec)
+{
+	printf("#[");
+	for (long i = 0; i < VectorObj_size(vec); i++) {
+		const Object *value = Object_value(Vector_element(vec, i));
+		if (i) {
+			printf(", ");
+		}
+		if (value) {
+			Object_print(value);
+		} else {
+			printf("...");
+		}
+	}
+	putchar(']');
+}
+
 void Object_print(const Object *obj)
 {
 	switch (obj->type) {
 		case NumObject:
 			printf("%lf", NumObj_num(obj));
 			return;
+		case IntObject:
+			printf("%ld", IntObj_num(obj));
+			return;
 		case FnObject:
 			printf("<fn %s>", FnObj_arg(obj));
 			return;
@@ -26,6 +106,31 @@ void Object_print(const Object *obj)
 		case CompthunkObject:
 			printf("<compthunk-%p>", CompThunkObj_text(obj));
 			return;
+		case BuiltinObject:
+			printf("<builtin %s>", BuiltinObj_desc(obj)->name);
+			return;
+		case StreamObject:
+			printf("<stream-%p>", obj);
+			return;
+		case ListObject:
+			return List_print(obj);
+		case ArrayObject:
+			putchar('{');
+			for (long i = 0; i < ArrayObj_length(obj); i++) {
+				printf(i ? ", %lf" : "%lf", ArrayObj_data(obj)[i]);
+			}
+			putchar('}');
+			return;
+		case VectorObject:
+			return Vector_print(obj);
+		case VecnodeObject:
+			printf("<vecnode-%p>", obj);
+			return;
+		case MapObject:
+			printf("#{");
+			Map_print(obj, 1);
+			putchar('}');
+			return;
 		case StackObject:
 			printf("<stack-%p>", obj);
 			return;
@@ -8,8 +8,16 @@ typedef enum {
 	CompfnObject,
 	EnvObject,
 	NumObject,
+	IntObject,
 	ThunkObject,
 	CompthunkObject,
+	BuiltinObject,
+	StreamObject,
+	ListObject,
+	ArrayObject,
+	MapObject,
+	VectorObject,
+	VecnodeObject,
 	StackObject,
 } ObjectType;
 
@@ -19,6 +27,7 @@ struct Object {
 	ObjectType  type;
 	Object      *next;
 	int         mark;
+	int         owned; // a number only referenced by the env it was bound in, see GC_clear_env
 };
 
 #define ValToObj(val) (&(val)->handle)
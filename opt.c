@@ -0,0 +1,558 @@
+#include "opt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "node.h"
+#include "arena.h"
+#include "inline.h"
+#include "lift.h"
+#include "opts.h"
+#include "strict.h"
+#include "worklist.h"
+
+
+// The optimizer (-O1): folds constant arithmetic, propagates the numbers
+// bound by 'let', removes the branches that are never taken and reduces
+// the applications of functions to literals. -O2 also lifts the nested
+// functions (see lift.c) and inlines (see inline.c).
+// The globals may be redefined before the code is evaluated (it may be
+// the body of a function or a thunk), so the propagated constants are
+// guarded the same way as the inlined code.
+// A partial application of a function to numbers is specialized: the
+// numbers are substituted for the parameters and the rest of the function
+// is folded. The results are cached per function and arguments, the
+// interpreter does that at runtime (see SpecFrame), and the applications
+// of the globals to literals are specialized ahead of time.
+
+#define CONST_ARENA_PAGE_SIZE 4096
+#define SPEC_ARENA_PAGE_SIZE  4096
+#define SPEC_TABLE_SIZE       1024
+
+// NOTE: a global that is not a number is still remembered, so the
+// redefinitions are noticed, fn is the function it's bound to
+typedef struct Const Const;
+
+struct Const {
+	const char *name;
+	int        known;
+	Number     value;
+	const Node *fn;
+	Const      *next;
+};
+
+typedef struct Spec Spec;
+
+struct Spec {
+	const Node *fn;
+	int        count;
+	int        global;
+	unsigned   version;
+	Number     args[SPECIALIZE_MAX_ARGS];
+	const Node *result;
+	Spec       *next;
+};
+
+// NOTE: a scope with no name binds all of the names, see optimize_specialize
+typedef struct Scope Scope;
+
+struct Scope {
+	const char  *name;
+	const Scope *prev;
+};
+
+static const Scope opaque = {NULL, NULL};
+
+static Arena const_arena;
+static Const *consts = NULL;
+// the specialized functions outlive the calls
+static Arena spec_arena;
+static Spec *specs[SPEC_TABLE_SIZE];
+static int nspecs = 0;
+
+static struct {
+	unsigned long folded;
+	unsigned long propagated;
+	unsigned long pruned;
+	unsigned long reduced;
+	unsigned long specialized;
+} stats;
+
+static Const *lookup(const char *name)
+{
+	for (Const *c = consts; c; c = c->next) {
+		if (!strcmp(c->name, name)) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static int bound(const char *name, const Scope *scope)
+{
+	for (; scope; scope = scope->prev) {
+		if (!scope->name || !strcmp(scope->name, name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// The number the expression (or its guarded version) evaluates to
+static int literal(const Node *expr, unsigned version, Number *value)
+{
+	if (expr->type == GuardNode && GuardNode_version(expr) == version) {
+		expr = GuardNode_inlined(expr);
+	}
+	if (expr->type != NumberNode) {
+		return 0;
+	}
+	*value = NumNode_value(expr);
+	return 1;
+}
+
+static int guarded(const Node *expr, unsigned version)
+{
+	return expr->type == GuardNode && GuardNode_version(expr) == version;
+}
+
+// The unguarded version of the expression
+static Node *original(Node *expr, unsigned version)
+{
+	return guarded(expr, version) ? GuardNode_original(expr) : expr;
+}
+
+// Whether the expression is surely a number (the type checks can't be dropped)
+static int numeric(const Node *expr)
+{
+	switch (expr->type) {
+		case NumberNode:
+		case ExptNode:
+		case ProdNode:
+		case SumNode:
+		case CmpNode:
+		case NumAddNode:
+		case NumSubNode:
+		case NumMulNode:
+		case NumDivNode:
+		case NumModNode:
+		case NumPowNode:
+		case NumGtNode:
+		case NumLtNode:
+		case NumEqNode:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// The result is guarded if any of the parts it was computed from is
+static Node *result(Node *value, Node *orig, int guard, unsigned version)
+{
+	return guard ? GuardNode_new(value, orig, version) : value;
+}
+
+// NOTE: the frames of fold, the step is the number of the children that are
+// already folded (the results are kept in folded), inner is the scope of the
+// body of a function and applied is the number of the arguments applied to
+// the result of an application (see fold_application)
+typedef struct {
+	Node        *expr;
+	const Scope *scope;
+	Scope       *inner;
+	int         applied;
+	int         step;
+	Node        *folded[2];
+} Folding;
+
+static Node *fold_pair(Node *expr, Node *left, Node *right, unsigned version)
+{
+	int guard = guarded(left, version) || guarded(right, version);
+	Node *orig = expr;
+	if (left != PairNode_left(expr) || right != PairNode_right(expr)) {
+		orig = OpNode_new(original(left, version), original(right, version), expr->type, PairNode_op(expr));
+	}
+	Number l, r, folded;
+	int lconst = literal(left, version, &l);
+	int rconst = literal(right, version, &r);
+	switch (expr->type) {
+		case AndNode:
+		case OrNode:
+			if (!lconst) {
+				break;
+			}
+			// the left operand is the result if it decides the answer,
+			// the right one has to be checked to be a number otherwise
+			if (expr->type == AndNode ? !Number_true(l) : Number_true(l)) {
+				stats.pruned += 1;
+				return result(NumberNode_new(l), orig, guard, version);
+			}
+			if (numeric(right)) {
+				stats.pruned += 1;
+				return result(right, orig, guard, version);
+			}
+			break;
+		default:
+			// NOTE: the same as eval_op
+			if (lconst && rconst && Number_op(PairNode_op(expr), l, r, &folded)) {
+				stats.folded += 1;
+				return result(NumberNode_new(folded), orig, guard, version);
+			}
+	}
+	if (orig == expr) {
+		return expr;
+	}
+	return OpNode_new(left, right, expr->type, PairNode_op(expr));
+}
+
+// 'f 1' => the specialized rest of f if it's a global function of more
+// parameters (only at the top level, where its globals can't be shadowed)
+static Node *fold_partial(Node *expr, unsigned version)
+{
+	int count = 0;
+	Node *head = expr;
+	for (; head->type == ApplNode; head = PairNode_left(head)) {
+		count += 1;
+	}
+	if (head->type != IdNode || count > SPECIALIZE_MAX_ARGS) {
+		return NULL;
+	}
+	Const *c = lookup(IdNode_value(head));
+	if (!c || !c->fn || FnNode_arity(c->fn) <= count) {
+		return NULL;
+	}
+	Number args[SPECIALIZE_MAX_ARGS];
+	Node *appl = expr;
+	for (int i = count - 1; i >= 0; i--) {
+		if (!literal(PairNode_right(appl), version, &args[i])) {
+			return NULL;
+		}
+		appl = PairNode_left(appl);
+	}
+	const Node *spec = optimize_specialize(c->fn, count, args, 1, version);
+	if (!spec) {
+		return NULL;
+	}
+	return GuardNode_new((Node *)spec, expr, version);
+}
+
+// (fn x: body) 1 => body with 1 substituted for x, which is returned
+// in reduced to be folded instead
+// NOTE: only the whole spine of a partial application is specialized
+static Node *fold_application(Node *expr, Node *fn, Node *arg, int applied, const Scope *scope, unsigned version, Node **reduced)
+{
+	if (fn->type == FnNode && arg->type == NumberNode) {
+		stats.reduced += 1;
+		*reduced = inline_subst(FnNode_body(fn), FnNode_param_value(fn), arg);
+		return NULL;
+	}
+	if (fn != PairNode_left(expr) || arg != PairNode_right(expr)) {
+		expr = ApplicationNode_new(fn, arg);
+	}
+	if (!applied && !scope) {
+		Node *spec = fold_partial(expr, version);
+		if (spec) {
+			return spec;
+		}
+	}
+	return expr;
+}
+
+static Node *fold_if(Node *expr, Node *cond, Node *true, Node *false, unsigned version)
+{
+	Number c;
+	if (literal(cond, version, &c)) {
+		stats.pruned += 1;
+		Node *taken = Number_true(c) ? true : false;
+		if (!guarded(cond, version)) {
+			return taken;
+		}
+		return GuardNode_new(taken, IfNode_new(GuardNode_original(cond), true, false), version);
+	}
+	if (cond == IfNode_cond(expr) && true == IfNode_true(expr) && false == IfNode_false(expr)) {
+		return expr;
+	}
+	return IfNode_new(cond, true, false);
+}
+
+// The children are folded in order and the result of one is returned to
+// the topmost frame, a reduced application is replaced by its body
+static Node *fold(Node *expr, const Scope *scope, unsigned version)
+{
+	Worklist(Folding) frames = WORKLIST_EMPTY;
+	int applied = 0;
+	Node *value = NULL;
+	for (;;) {
+		switch (expr->type) {
+			case NumberNode:
+				value = expr;
+				break;
+			case IdNode: {
+				Const *c = lookup(IdNode_value(expr));
+				value = expr;
+				if (c && c->known && !bound(IdNode_value(expr), scope)) {
+					stats.propagated += 1;
+					value = GuardNode_new(NumberNode_new(c->value), expr, version);
+				}
+				break;
+			}
+			case GuardNode:
+				Worklist_push(&frames, .expr = expr, .scope = scope);
+				expr = GuardNode_inlined(expr);
+				applied = 0;
+				continue;
+			case IfNode:
+				Worklist_push(&frames, .expr = expr, .scope = scope);
+				expr = IfNode_cond(expr);
+				applied = 0;
+				continue;
+			case FnNode: {
+				// NOTE: the scopes are linked, so they can't be kept in the frames
+				Scope *inner = malloc(sizeof(*inner));
+				*inner = (Scope){FnNode_param_value(expr), scope};
+				Worklist_push(&frames, .expr = expr, .scope = scope, .inner = inner);
+				expr = FnNode_body(expr);
+				scope = inner;
+				applied = 0;
+				continue;
+			}
+			case LetNode:
+				Worklist_push(&frames, .expr = expr, .scope = scope);
+				expr = LetNode_value(expr);
+				applied = 0;
+				continue;
+			case ApplNode:
+				Worklist_push(&frames, .expr = expr, .scope = scope, .applied = applied);
+				expr = PairNode_left(expr);
+				applied += 1;
+				continue;
+			default:
+				Worklist_push(&frames, .expr = expr, .scope = scope);
+				expr = PairNode_left(expr);
+				applied = 0;
+				continue;
+		}
+		// return the result until a frame needs another child
+		expr = NULL;
+		while (!expr && !Worklist_empty(&frames)) {
+			Folding *frame = Worklist_top(&frames);
+			Node *parent = frame->expr;
+			scope = frame->scope;
+			applied = 0;
+			switch (parent->type) {
+				case GuardNode:
+					if (value != GuardNode_inlined(parent)) {
+						value = GuardNode_new(value, GuardNode_original(parent), GuardNode_version(parent));
+					} else {
+						value = parent;
+					}
+					break;
+				case IfNode:
+					if (frame->step < 2) {
+						frame->folded[frame->step] = value;
+						frame->step += 1;
+						expr = frame->step == 1 ? IfNode_true(parent) : IfNode_false(parent);
+						continue;
+					}
+					value = fold_if(parent, frame->folded[0], frame->folded[1], value, version);
+					break;
+				case FnNode:
+					free(frame->inner);
+					if (value != FnNode_body(parent)) {
+						Node *fn = FnNode_new(FnNode_param(parent), value);
+						FnNode_lazy(fn) = FnNode_lazy(parent);
+						value = fn;
+					} else {
+						value = parent;
+					}
+					break;
+				case LetNode:
+					if (value != LetNode_value(parent)) {
+						value = LetNode_new(LetNode_name(parent), value);
+					} else {
+						value = parent;
+					}
+					break;
+				case ApplNode:
+					if (frame->step == 0) {
+						frame->folded[0] = value;
+						frame->step = 1;
+						expr = PairNode_right(parent);
+						continue;
+					}
+					value = fold_application(parent, frame->folded[0], value, frame->applied, scope, version, &expr);
+					break;
+				default:
+					if (frame->step == 0) {
+						frame->folded[0] = value;
+						frame->step = 1;
+						expr = PairNode_right(parent);
+						continue;
+					}
+					value = fold_pair(parent, frame->folded[0], value, version);
+					break;
+			}
+			Worklist_drop(&frames);
+		}
+		if (!expr) {
+			Worklist_destroy(&frames);
+			return value;
+		}
+	}
+}
+
+static Node *optimize_expr(Node *expr, unsigned version)
+{
+	if (inlining) {
+		expr = inline_calls(expr, version);
+	}
+	if (optimization) {
+		expr = fold(expr, NULL, version);
+	}
+	return expr;
+}
+
+Node *optimize(Node *expr, unsigned version, Arena *a)
+{
+	if (optimization >= 2) {
+		expr = lift_lambdas(expr, a);
+	}
+	return optimize_expr(expr, version);
+}
+
+// NOTE: the bodies of the lifted functions are already lifted
+Node *optimize_lifted(unsigned version)
+{
+	Node *let = lift_next();
+	if (!let) {
+		return NULL;
+	}
+	return optimize_expr(let, version);
+}
+
+int optimize_define(const char *name, const Node *value)
+{
+	if (!const_arena.page_size) {
+		const_arena = Arena_make(CONST_ARENA_PAGE_SIZE);
+	}
+	Const *c = lookup(name);
+	if (!c) {
+		c = Arena_alloc(&const_arena, sizeof(*c));
+		c->name = IdNode_value(IdNode_new(name, strlen(name)));
+		c->next = consts;
+		consts = c;
+	}
+	// NOTE: the value was just evaluated, so the guarded version was used
+	if (value && value->type == GuardNode) {
+		value = GuardNode_inlined(value);
+	}
+	c->known = value && value->type == NumberNode;
+	c->value = c->known ? NumNode_value(value) : Number_int(0);
+	c->fn = value && value->type == FnNode ? inline_copy(value) : NULL;
+	return inline_define(name, value);
+}
+
+static unsigned long spec_hash(const Node *fn, int count, const Number *args, unsigned version)
+{
+	unsigned long hash = (unsigned long)fn ^ version;
+	for (int i = 0; i < count; i++) {
+		unsigned long bits = args[i].i + args[i].exact;
+		hash = (hash ^ bits ^ (bits >> 32)) * 0x100000001b3;
+	}
+	return (hash ^ (hash >> 29)) % SPEC_TABLE_SIZE;
+}
+
+static int spec_same(const Spec *s, int count, const Number *args)
+{
+	for (int i = 0; i < count; i++) {
+		if (!Number_same(s->args[i], args[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Whether the expression has at most that many nodes, the walk stops
+// as soon as there are more
+static int spec_fits(const Node *expr, int budget)
+{
+	Worklist(const Node *) pending = WORKLIST_EMPTY;
+	Worklist_push(&pending, expr);
+	while (!Worklist_empty(&pending) && budget >= 0) {
+		Node *children[NODE_MAX_CHILDREN];
+		int n = Node_children(Worklist_pop(&pending), children);
+		for (int i = 0; i < n; i++) {
+			Worklist_push(&pending, children[i]);
+		}
+		budget -= 1;
+	}
+	Worklist_destroy(&pending);
+	return budget >= 0;
+}
+
+// NOTE: the arguments are compared bitwise, the same as in the memo cache.
+// The free variables of a function that is not global may be bound by the
+// enclosing functions, so no globals are propagated into it.
+const Node *optimize_specialize(const Node *fn, int count, const Number *args, int global, unsigned version)
+{
+	unsigned long hash = spec_hash(fn, count, args, version);
+	for (Spec *s = specs[hash]; s; s = s->next) {
+		if (
+			s->fn == fn && s->count == count && s->global == global &&
+			s->version == version && spec_same(s, count, args)
+		) {
+			return s->result;
+		}
+	}
+	if (nspecs == SPECIALIZE_MAX) {
+		return NULL;
+	}
+	const Node *params[SPECIALIZE_MAX_ARGS];
+	Node *rest = (Node *)fn;
+	for (int i = 0; i < count; i++) {
+		params[i] = rest;
+		rest = FnNode_body(rest);
+	}
+	// NOTE: a large rest is not copied for every new argument
+	if (!spec_fits(rest, SPECIALIZE_BUDGET)) {
+		return NULL;
+	}
+	if (!spec_arena.page_size) {
+		spec_arena = Arena_make(SPEC_ARENA_PAGE_SIZE);
+	}
+	// a parameter shadowed by a later one is not visible in the rest
+	for (int i = count - 1; i >= 0; i--) {
+		const char *name = FnNode_param_value(params[i]);
+		int shadowed = 0;
+		for (int j = i + 1; j < count; j++) {
+			shadowed = shadowed || !strcmp(name, FnNode_param_value(params[j]));
+		}
+		if (!shadowed) {
+			rest = inline_subst(rest, name, NumberNode_new(args[i]));
+		}
+	}
+	rest = fold(rest, global ? NULL : &opaque, version);
+	strictness(rest);
+	Node_mark_tail_calls(rest);
+	Spec *s = Arena_alloc(&spec_arena, sizeof(*s));
+	s->fn = fn;
+	s->count = count;
+	s->global = global;
+	s->version = version;
+	memcpy(s->args, args, count * sizeof(*args));
+	s->result = rest;
+	s->next = specs[hash];
+	specs[hash] = s;
+	nspecs += 1;
+	stats.specialized += 1;
+	return rest;
+}
+
+void optimize_print_stats(void)
+{
+	fprintf(stderr,
+		"optimizer: %lu folded, %lu propagated, %lu pruned, %lu reduced, %lu inlined, %lu specialized, %lu lifted\n",
+		stats.folded, stats.propagated, stats.pruned, stats.reduced, inline_stats(), stats.specialized, lift_stats()
+	);
+}
@@ -0,0 +1,30 @@
+#ifndef OPT_INCLUDED
+#define OPT_INCLUDED
+
+#include "node.h"
+#include "arena.h"
+
+// functions are specialized on at most that many arguments
+#define SPECIALIZE_MAX_ARGS 4
+// the number of specializations that are kept (the cache is never evicted)
+#define SPECIALIZE_MAX (1 << 12)
+// the largest rest (in nodes) of a function that is specialized, every
+// specialization is a copy of it
+#define SPECIALIZE_BUDGET 256
+
+// NOTE: the version is the one the global env will have when the
+// expression is evaluated (see GuardNode), the value passed to
+// optimize_define is NULL if the 'let' failed, and the returned
+// flag tells whether the global is redefined.
+// optimize_specialize returns the function that is left after the first
+// count parameters of fn are bound to the numbers (NULL if it can't),
+// global tells whether fn is closed over the global env only.
+// optimize_lifted returns the next definition of a function lifted
+// from the expression (NULL if there are none left), see lift.h
+Node       *optimize(Node *expr, unsigned version, Arena *a);
+Node       *optimize_lifted(unsigned version);
+int        optimize_define(const char *name, const Node *value);
+const Node *optimize_specialize(const Node *fn, int count, const Number *args, int global, unsigned version);
+void       optimize_print_stats(void);
+
+#endif // OPT_INCLUDED
@@ -1,35 +1,67 @@
 #include "opts.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
 #include "error.h"
 
 
 #define ERROR_PREFIX "arguments error"
 
-#define DEBUG_DEFAULT 0
-#define LAZY_DEFAULT  0
-#define TYPED_DEFAULT 0
+#define DEBUG_DEFAULT    0
+#define LAZY_DEFAULT     0
+#define TYPED_DEFAULT    0
+#define MEMOIZE_DEFAULT  0
+#define INLINE_DEFAULT   0
+#define OPTIMIZE_DEFAULT 0
 
-int debug = DEBUG_DEFAULT;
-int lazy  = LAZY_DEFAULT;
-int typed = TYPED_DEFAULT;
+int debug        = DEBUG_DEFAULT;
+int lazy         = LAZY_DEFAULT;
+int typed        = TYPED_DEFAULT;
+int memoize      = MEMOIZE_DEFAULT;
+int inlining     = INLINE_DEFAULT;
+int optimization = OPTIMIZE_DEFAULT;
+// the descriptor the program is read from, stdin if no file is given
+int input        = 0;
 
 #define usage(name) \
-	(fprintf(stderr, "usage: %s [-dlt]\n", name))
+	(fprintf(stderr, "usage: %s [-dilmt] [-O[level]] [file]\n", name))
 
 int parse_args(int argc, char **argv)
 {
 	for (int optind = 1; optind < argc; optind++) {
 		char *arg = argv[optind];
-		if (arg[0] != '-') {
+		if (arg[0] != '-' && input) {
 			errorf("unexpected positional argument: '%s'", arg);
 			usage(argv[0]);
 			return 0;
 		}
+		if (arg[0] != '-') {
+			input = open(arg, O_RDONLY);
+			if (input < 0) {
+				errorf("can't open '%s': %s", arg, strerror(errno));
+				return 0;
+			}
+			continue;
+		}
 		for (arg++; *arg; arg++) {
 			switch (*arg) {
-				case 'd': debug = 1; break;
-				case 'l': lazy = 1;  break;
-				case 't': typed = 1; break;
+				case 'd': debug = 1;    break;
+				case 'i': inlining = 1; break;
+				case 'l': lazy = 1;     break;
+				case 'm': memoize = 1;  break;
+				case 't': typed = 1;    break;
+				case 'O':
+					// NOTE: -O is the same as -O1, -O2 also inlines
+					optimization = 1;
+					if (arg[1] >= '0' && arg[1] <= '9') {
+						optimization = *++arg - '0';
+					}
+					if (optimization >= 2) {
+						inlining = 1;
+					}
+					break;
 				default:
 					errorf("unknown flag: '%s'", arg);
 					usage(argv[0]);
@@ -4,6 +4,10 @@
 extern int debug;
 extern int lazy;
 extern int typed;
+extern int memoize;
+extern int inlining;
+extern int optimization;
+extern int input;
 
 int parse_args(int argc, char **argv);
 
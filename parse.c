@@ -7,7 +7,7 @@
 #include "node.h"
 #include "token.h"
 #include "error.h"
-#include "arena.h"
+#include "worklist.h"
 
 
 #define ERROR_PREFIX "parsing error"
@@ -28,37 +28,26 @@ typedef enum {
 } Assoc;
 
 typedef struct {
-	Assoc     assoc;
-	NodeType  optype;
-	int       count;
-	TokenType types[TOKEN_COUNT];
-} Oplevel;
+	int      prec; // 0 if the token is not a binary operator
+	Assoc    assoc;
+	NodeType optype;
+} Operator;
 
-// Binary operators in the order of increasing precedence
-static const Oplevel optable[] = {
-	{LeftAssoc,  OrNode,      1, {OrToken}},
-	{LeftAssoc,  AndNode,     1, {AndToken}},
-	{NoneAssoc,  CmpNode,     3, {GtToken, LtToken, EqToken}},
-	{LeftAssoc,  SumNode,     2, {PlusToken, MinusToken}},
-	{LeftAssoc,  ProdNode,    3, {AsteriskToken, SlashToken, PercentToken}},
-	{RightAssoc, ExptNode,    1, {CaretToken}},
+// The binary operators by their tokens, a higher precedence binds tighter
+static const Operator operators[TOKEN_COUNT] = {
+	[OrToken]       = {1, LeftAssoc,  OrNode},
+	[AndToken]      = {2, LeftAssoc,  AndNode},
+	[GtToken]       = {3, NoneAssoc,  CmpNode},
+	[LtToken]       = {3, NoneAssoc,  CmpNode},
+	[EqToken]       = {3, NoneAssoc,  CmpNode},
+	[PlusToken]     = {4, LeftAssoc,  SumNode},
+	[MinusToken]    = {4, LeftAssoc,  SumNode},
+	[AsteriskToken] = {5, LeftAssoc,  ProdNode},
+	[SlashToken]    = {5, LeftAssoc,  ProdNode},
+	[PercentToken]  = {5, LeftAssoc,  ProdNode},
+	[CaretToken]    = {6, RightAssoc, ExptNode},
 };
 
-#define MAXPREC (int)(sizeof(optable)/sizeof(optable[0]))
-
-// OP_TOKEN <- any token from optable
-static const Oplevel *is_op_token(Token token)
-{
-	for (int prec = 0; prec < MAXPREC; prec++) {
-		for (int i = 0; i < optable[prec].count; i++) {
-			if (optable[prec].types[i] == token.type) {
-				return &optable[prec];
-			}
-		}
-	}
-	return NULL;
-}
-
 // TERM_TOKEN <- '(' | 'NUMBER' | 'ID'
 static int is_term_token(Token token)
 {
@@ -69,333 +58,353 @@ static int is_term_token(Token token)
 	);
 }
 
-static Node *parse_let(Scanner *scanner, Arena *a);
-static Node *parse_expression(Scanner *scanner, Arena *a);
-static Node *parse_if(Scanner *s, Arena *a);
-static Node *parse_fn(Scanner *s, Arena *a);
-static Node *parse_opseq(Scanner *scanner, const Oplevel *op, Arena *a);
-static Node *parse_application(Scanner *s, Arena *a);
-static Node *parse_term(Scanner *s, Arena *a);
+// The parser is a pushdown automaton: the rules that are not finished
+// are frames on an explicit stack and a parsed node is returned to the
+// topmost frame, so the nesting is only limited by the heap.
+//
+// VALID      ::= (EXPRESSION | LET)? 'END'
+// LET        ::= 'LET' 'ID' LET_VALUE
+// LET_VALUE  ::= '=' EXPRESSION | PARAM LET_VALUE
+// EXPRESSION ::= IF | FN | OPSEQ
+// FN         ::= 'FN' PARAM FN_BODY
+// FN_BODY    ::= ':' EXPRESSION | PARAM FN_BODY
+// PARAM      ::= 'ID' | '~' 'ID'
+// IF         ::= 'IF' OPSEQ 'THEN' EXPRESSION IF_TAIL
+// IF_TAIL    ::= 'ELSE' EXPRESSION | IF
+// OPSEQ      ::= APPLICATION (OP APPLICATION)*
+// APPLICATION::= TERM | APPLICATION TERM
+// TERM       ::= '(' EXPRESSION ')' | 'NUMBER' | 'ID' | '-' TERM
+typedef enum {
+	OpseqFrame,  // the term is the next one of the application
+	ParenFrame,  // expect ')'
+	NegFrame,    // negate the term
+	CondFrame,   // expect 'then' and parse the true branch
+	TrueFrame,   // parse the tail of the if
+	FalseFrame,  // make the if
+	FnFrame,     // make the function of the body
+	LetFrame,    // make the let of the value
+} FrameKind;
 
-// VALID ::= (EXPRESSION | LET)? 'END'
-Node *parse(Scanner *scanner, Arena *a)
-{
-	Scanner_start(scanner);
-	Token next = Scanner_peek(scanner);
-	if (next.type == EndToken) {
-		return NULL;
-	}
-	Node *expr = NULL;
-	if (next.type == LetToken) {
-		expr = parse_let(scanner, a);
-	} else {
-		expr = parse_expression(scanner, a);
-	}
-	if (!expr) {
-		Scanner_seek_end(scanner);
-		return NULL;
-	}
-	next = Scanner_peek(scanner);
-	if (next.type != EndToken) {
-		tokerror("unexpected token after the expression", next);
-		Scanner_seek_end(scanner);
-		return NULL;
-	}
-	return expr;
-}
+typedef struct {
+	FrameKind kind;
+	Node      *node;  // the application (OpseqFrame), the condition (TrueFrame and FalseFrame),
+	                  // the parameter (FnFrame) or the name (LetFrame)
+	Node      *other; // the true branch (FalseFrame)
+	int       base;   // the operators below belong to the enclosing sequences (OpseqFrame)
+	                  // or whether the parameter is passed by need (FnFrame)
+} Frame;
 
-// LET_VALUE ::= '=' EXPRESSION | 'ID' LET_VALUE
-static Node *parse_let_value(Scanner *scanner, Arena *a)
-{
-	Token next = Scanner_next(scanner);
-	if (next.type == EqToken) {
-		Scanner_skip_nl(scanner);
-		return parse_expression(scanner, a);
-	} else if (next.type == IdToken) {
-		Node *param = IdNode_new(a, next.string, next.length);
-		Scanner_skip_nl(scanner);
-		Node *body = parse_let_value(scanner, a);
-		if (!body) {
-			return NULL;
-		}
-		return FnNode_new(a, param, body);
-	} else {
-		tokerror("expected '=' or an identifier", next);
-		return NULL;
-	}
-}
+// An operator that waits for its right operand, the operators of
+// a sequence are in the order of increasing precedence
+typedef struct {
+	Node           *left;
+	const Operator *op;
+	int            opchar;
+} Pending;
 
-// LET ::= 'LET' 'ID' LET_VALUE
-static Node *parse_let(Scanner *scanner, Arena *a)
-{
-	Scanner_next(scanner); // drop 'LET'
-	Scanner_skip_nl(scanner);
-	Token next = Scanner_next(scanner);
-	if (next.type != IdToken) {
-		tokerror("expected identifier", next);
-		return NULL;
-	}
-	Node *name = IdNode_new(a, next.string, next.length);
-	Scanner_skip_nl(scanner);
-	Node *value = parse_let_value(scanner, a);
-	if (!value) {
-		return NULL;
-	}
-	return LetNode_new(a, name, value);
-}
+typedef struct {
+	Scanner          *scanner;
+	Worklist(Frame)   frames;
+	Worklist(Pending) pending;
+} Parser;
 
-// EXPRESSION ::= IF | FN | OP
-static Node *parse_expression(Scanner *scanner, Arena *a)
-{
-	Token next = Scanner_peek(scanner);
-	if (next.type == IfToken) {
-		return parse_if(scanner, a);
-	}
-	if (next.type == FnToken) {
-		return parse_fn(scanner, a);
-	}
-	return parse_opseq(scanner, 0, a);
-}
+// The goal of the parser, the rule it parses next
+typedef enum {
+	Expression,
+	Opseq,
+	Term,
+} Goal;
 
-// FN_BODY ::= ':' EXPRESSION | 'ID' FN_BODY
-static Node *parse_fn_body(Scanner *scanner, Arena *a)
-{
-	Token next = Scanner_next(scanner);
-	if (next.type == ColonToken) {
-		Scanner_skip_nl(scanner);
-		return parse_expression(scanner, a);
-	} else if (next.type == IdToken) {
-		Node *param = IdNode_new(a, next.string, next.length);
-		Scanner_skip_nl(scanner);
-		Node *body = parse_fn_body(scanner, a);
-		if (!body) {
-			return NULL;
-		}
-		return FnNode_new(a, param, body);
-	} else {
-		tokerror("expected ':' or and identifier", next);
-		return NULL;
-	}
-}
+#define push_frame(parser, ...) (Worklist_push(&(parser)->frames, __VA_ARGS__))
 
-// FN ::= 'FN' FN_BODY
-static Node *parse_fn(Scanner *scanner, Arena *a)
+// PARAM ::= 'ID' | '~' 'ID'
+// NOTE: the first token is already taken, '~' marks a parameter passed by need
+static Node *parse_param(Scanner *scanner, Token first, int *lazy)
 {
-	Scanner_next(scanner); // drop 'FN'
-	Scanner_skip_nl(scanner);
-	Token next = Scanner_next(scanner);
-	if (next.type != IdToken) {
-		tokerror("expected identifier", next);
-		return NULL;
+	*lazy = first.type == TildeToken;
+	if (*lazy) {
+		first = Scanner_next(scanner);
 	}
-	Node *param = IdNode_new(a, next.string, next.length);
-	Scanner_skip_nl(scanner);
-	Node *body = parse_fn_body(scanner, a);
-	if (!body) {
+	if (first.type != IdToken) {
+		tokerror("expected identifier", first);
 		return NULL;
 	}
-	return FnNode_new(a, param, body);
+	return IdNode_new(first.string, first.length);
 }
 
-// IF_TAIL ::= 'ELSE' EXPRESSION | IF
-static Node *parse_if_tail(Scanner *scanner, Arena *a)
-{
-	Token next = Scanner_peek(scanner);
-	if (next.type == ElseToken) {
-		Scanner_next(scanner);
-		Scanner_skip_nl(scanner);
-		return parse_expression(scanner, a);
-	} else if (next.type == IfToken) {
-		return parse_if(scanner, a);
-	} else {
-		tokerror("expected 'if' or 'else'", next);
-		return NULL;
-	}
-}
-
-// IF ::= 'IF OPSEQ 'THEN' EXPRESSION IF_TAIL
-static Node *parse_if(Scanner *scanner, Arena *a)
+// NUMBER ::= DIGIT+ ('.' DIGIT*)?
+// NOTE: a number without the dot is an integer unless it doesn't fit
+static Node *parse_number(Token tok)
 {
-	Scanner_next(scanner); // drop 'IF'
-	Scanner_skip_nl(scanner);
-	Node *cond = parse_opseq(scanner, 0, a);
-	if (!cond) {
-		return NULL;
-	}
-	Scanner_skip_nl(scanner);
-	Token next = Scanner_next(scanner);
-	if (next.type != ThenToken) {
-		tokerror("expected 'then'", next);
-		return NULL;
+	double number = 0;
+	long integer = 0;
+	int exact = 1;
+	int i;
+	for (i = 0; i < tok.length && isdigit(tok.string[i]); i++) {
+		number = (tok.string[i] - '0') + number * 10;
+		exact = exact &&
+			!__builtin_mul_overflow(integer, 10, &integer) &&
+			!__builtin_add_overflow(integer, tok.string[i] - '0', &integer);
 	}
-	Scanner_skip_nl(scanner);
-	Node *true = parse_expression(scanner, a);
-	if (!true) {
-		return NULL;
+	if (i < tok.length && tok.string[i] == '.') {
+		exact = 0;
+		i++;
 	}
-	Scanner_skip_nl(scanner);
-	Node *false = parse_if_tail(scanner, a);
-	if (!false) {
-		return NULL;
+	for (double factor = 0.1; i < tok.length; i++, factor/=10) {
+		number += (tok.string[i] - '0') * factor;
 	}
-	return IfNode_new(a, cond, true, false);
+	return NumberNode_new(exact ? Number_int(integer) : Number_double(number));
 }
 
-// LASSOC ::= OP OPSEQ | LASSOC OP OPSEQ
-static Node *parse_lassoc(Scanner *scanner, const Oplevel *op, Node *left, Arena *a)
+// LET_VALUE and FN_BODY: the parameters are taken until the separator,
+// each one is a frame that makes the function of the body
+static int parse_params(Parser *p, TokenType separator, const char *message)
 {
 	for (;;) {
-		Token optok = Scanner_next(scanner);
-		Scanner_skip_nl(scanner);
-		Node *right = parse_opseq(scanner, op, a);
-		if (!right) {
-			return NULL;
+		Token next = Scanner_next(p->scanner);
+		if (next.type == separator) {
+			Scanner_skip_nl(p->scanner);
+			return 1;
 		}
-		left = OpNode_new(a, left, right, op->optype, optok.string[0]);
-		Token next = Scanner_peek(scanner);
-		const Oplevel *op2 = is_op_token(next);
-		if (op2 < op) {
-			return left;
+		if (next.type != IdToken && next.type != TildeToken) {
+			tokerror(message, next);
+			return 0;
 		}
+		int lazy;
+		Node *param = parse_param(p->scanner, next, &lazy);
+		if (!param) {
+			return 0;
+		}
+		Scanner_skip_nl(p->scanner);
+		push_frame(p, FnFrame, param, NULL, lazy);
 	}
 }
 
-// RASSOC ::= OP OPSEQ | OP OPSEQ RASSOC
-static Node *parse_rassoc(Scanner *scanner, const Oplevel *op, Node *left, Arena *a)
+// The first tokens of the rule, the frames of its rest are pushed. Returns
+// the node if the rule is already finished (a number or a variable),
+// NULL if there is the next goal or an error (then *goal is negative).
+static Node *parse_start(Parser *p, int *goal)
 {
-	Token optok = Scanner_next(scanner);
-	Scanner_skip_nl(scanner);
-	Node *right = parse_opseq(scanner, op, a);
-	if (!right) {
-		return NULL;
-	}
-	Token next = Scanner_peek(scanner);
-	const Oplevel *op2 = is_op_token(next);
-	if (op2 == op) {
-		right = parse_rassoc(scanner, op, right, a);
-		if (!right) {
+	Scanner *scanner = p->scanner;
+	Token next;
+	switch (*goal) {
+		case Expression:
+			next = Scanner_peek(scanner);
+			if (next.type == IfToken) {
+				// IF ::= 'IF' OPSEQ 'THEN' EXPRESSION IF_TAIL
+				Scanner_next(scanner);
+				Scanner_skip_nl(scanner);
+				push_frame(p, CondFrame, NULL, NULL, 0);
+				*goal = Opseq;
+				return NULL;
+			}
+			if (next.type == FnToken) {
+				// FN ::= 'FN' PARAM FN_BODY
+				Scanner_next(scanner);
+				Scanner_skip_nl(scanner);
+				int lazy;
+				Node *param = parse_param(scanner, Scanner_next(scanner), &lazy);
+				if (!param) {
+					*goal = -1;
+					return NULL;
+				}
+				Scanner_skip_nl(scanner);
+				push_frame(p, FnFrame, param, NULL, lazy);
+				if (!parse_params(p, ColonToken, "expected ':' or and identifier")) {
+					*goal = -1;
+				}
+				return NULL;
+			}
+			// fallthrough
+		case Opseq:
+			push_frame(p, OpseqFrame, NULL, NULL, p->pending.size);
+			*goal = Term;
+			return NULL;
+		case Term:
+			next = Scanner_next(scanner);
+			if (next.type == MinusToken) {
+				push_frame(p, NegFrame, NULL, NULL, 0);
+				return NULL;
+			} else if (next.type == LparenToken) {
+				Scanner_skip_nl(scanner);
+				push_frame(p, ParenFrame, NULL, NULL, 0);
+				*goal = Expression;
+				return NULL;
+			} else if (next.type == NumberToken) {
+				return parse_number(next);
+			} else if (next.type == IdToken) {
+				return IdNode_new(next.string, next.length);
+			}
+			tokerror("expected '(', '-' or a number", next);
+			*goal = -1;
 			return NULL;
-		}
 	}
-	return OpNode_new(a, left, right, op->optype, optok.string[0]);
+	return NULL;
 }
 
-// NASSOC ::= OP OPSEQ
-static Node *parse_nassoc(Scanner *scanner, const Oplevel *op, Node *left, Arena *a)
+// Combine the operand with the operators of the sequence that bind
+// tighter than the next one (Pratt's loop)
+static Node *parse_reduce(Parser *p, Node *right, const Operator *next, int base)
 {
-	Token optok = Scanner_next(scanner);
-	Scanner_skip_nl(scanner);
-	Node *right = parse_opseq(scanner, op, a);
-	if (!right) {
-		return NULL;
-	}
-	Token next = Scanner_peek(scanner);
-	const Oplevel *op2 = is_op_token(next);
-	if (op2 == op) {
-		tokerror("non-assosiative operator", next);
-		return NULL;
+	while (p->pending.size > base) {
+		Pending *top = Worklist_top(&p->pending);
+		if (top->op->prec < next->prec) {
+			break;
+		}
+		if (top->op->prec == next->prec) {
+			if (next->assoc == RightAssoc) {
+				break;
+			}
+			if (next->assoc == NoneAssoc) {
+				tokerror("non-assosiative operator", Scanner_peek(p->scanner));
+				return NULL;
+			}
+		}
+		right = OpNode_new(top->left, right, top->op->optype, top->opchar);
+		Worklist_drop(&p->pending);
 	}
-	return OpNode_new(a, left, right, op->optype, optok.string[0]);
+	return right;
 }
 
-// OPSEQ ::= APPLICATION | APPLICATION (LASSOC | RASSOC | NASSOC)
-static Node *parse_opseq(Scanner *scanner, const Oplevel *op, Arena *a)
+// The node is returned to the topmost frame. Returns the node that is
+// returned to the next frame, NULL if there is the next goal or an error.
+static Node *parse_return(Parser *p, Node *node, int *goal)
 {
-	Node *left = parse_application(scanner, a);
-	if (!left) {
-		return NULL;
-	}
-	for (;;) {
-		Token next = Scanner_peek(scanner);
-		const Oplevel *op2 = is_op_token(next);
-		if (op2 <= op) {
-			return left;
-		}
-		switch (op2->assoc) {
-			case LeftAssoc:
-				left = parse_lassoc(scanner, op2, left, a);
+	Scanner *scanner = p->scanner;
+	Frame *frame = Worklist_top(&p->frames);
+	Token next;
+	switch (frame->kind) {
+		case OpseqFrame:
+			// APPLICATION ::= TERM | APPLICATION TERM
+			node = frame->node ? ApplicationNode_new(frame->node, node) : node;
+			next = Scanner_peek(scanner);
+			if (is_term_token(next)) {
+				frame->node = node;
+				*goal = Term;
+				return NULL;
+			}
+			int base = frame->base;
+			const Operator *op = &operators[next.type];
+			node = parse_reduce(p, node, op, base);
+			if (!node) {
 				break;
-			case RightAssoc:
-				left = parse_rassoc(scanner, op2, left, a);
+			}
+			if (!op->prec) {
+				Worklist_drop(&p->frames);
+				return node;
+			}
+			frame->node = NULL;
+			Worklist_push(&p->pending, node, op, next.string[0]);
+			Scanner_next(scanner);
+			Scanner_skip_nl(scanner);
+			*goal = Term;
+			return NULL;
+		case ParenFrame:
+			Worklist_drop(&p->frames);
+			Scanner_skip_nl(scanner);
+			next = Scanner_next(scanner);
+			if (next.type != RparenToken) {
+				tokerror("expected ')'", next);
 				break;
-			case NoneAssoc:
-				left = parse_nassoc(scanner, op2, left, a);
+			}
+			return node;
+		case NegFrame:
+			Worklist_drop(&p->frames);
+			return OpNode_new(node, NumberNode_new(Number_int(-1)), ProdNode, '*');
+		case CondFrame:
+			Scanner_skip_nl(scanner);
+			next = Scanner_next(scanner);
+			if (next.type != ThenToken) {
+				tokerror("expected 'then'", next);
 				break;
-		}
-		if (!left) {
+			}
+			Scanner_skip_nl(scanner);
+			*frame = (Frame){TrueFrame, node, NULL, 0};
+			*goal = Expression;
 			return NULL;
-		}
-	}
+		case TrueFrame:
+			// IF_TAIL ::= 'ELSE' EXPRESSION | IF
+			Scanner_skip_nl(scanner);
+			next = Scanner_peek(scanner);
+			if (next.type == ElseToken) {
+				Scanner_next(scanner);
+				Scanner_skip_nl(scanner);
+			} else if (next.type != IfToken) {
+				tokerror("expected 'if' or 'else'", next);
+				break;
+			}
+			*frame = (Frame){FalseFrame, frame->node, node, 0};
+			*goal = Expression;
+			return NULL;
+		case FalseFrame:
+			Worklist_drop(&p->frames);
+			return IfNode_new(frame->node, frame->other, node);
+		case FnFrame:
+			Worklist_drop(&p->frames);
+			Node *fn = FnNode_new(frame->node, node);
+			FnNode_lazy(fn) = frame->base;
+			return fn;
+		case LetFrame:
+			Worklist_drop(&p->frames);
+			return LetNode_new(frame->node, node);
+	}
+	*goal = -1;
 	return NULL;
 }
 
-// APPLICATION ::= TERM | APPLICATION TERM
-static Node *parse_application(Scanner *scanner, Arena *a)
+// Parse the goal and finish the rules of the frames that are already
+// pushed, returns NULL on error
+static Node *parse_goal(Parser *p, int goal)
 {
-	Node *operator = parse_term(scanner, a);
-	if (!operator) {
-		return NULL;
-	}
 	for (;;) {
-		Token next = Scanner_peek(scanner);
-		if (!is_term_token(next)) {
-			return operator;
+		Node *node = parse_start(p, &goal);
+		while (node && !Worklist_empty(&p->frames)) {
+			node = parse_return(p, node, &goal);
 		}
-		Node *operand = parse_term(scanner, a);
-		if (!operand) {
-			return NULL;
+		if (node || goal < 0) {
+			return node;
 		}
-		operator = ApplicationNode_new(a, operator, operand);
 	}
 }
 
-// NUMBER ::= DIGIT+ ('.' DIGIT*)?
-static Node *parse_number(Token tok, Arena *a)
-{
-	double number = 0;
-	int i;
-	for (i = 0; i < tok.length && isdigit(tok.string[i]); i++) {
-		number = (tok.string[i] - '0') + number * 10;
-	}
-	if (tok.string[i] == '.') {
-		i++;
-	}
-	for (double factor = 0.1; i < tok.length; i++, factor/=10) {
-		number += (tok.string[i] - '0') * factor;
-	}
-	return NumberNode_new(a, number);
-}
-
-// TERM ::= '(' EXPRESSION ')' | 'NUMBER' | 'ID' | '-' TERM
-static Node *parse_term(Scanner *scanner, Arena *a)
+// VALID ::= (EXPRESSION | LET)? 'END'
+// LET ::= 'LET' 'ID' LET_VALUE
+Node *parse(Scanner *scanner)
 {
-	Token next = Scanner_next(scanner);
-	if (next.type == MinusToken) {
-		Node *term = parse_term(scanner, a);
-		if (!term) {
-			return NULL;
-		}
-		return OpNode_new(a, term, NumberNode_new(a, -1), ProdNode, '*');
+	Scanner_start(scanner);
+	Token next = Scanner_peek(scanner);
+	if (next.type == EndToken) {
+		return NULL;
 	}
-	if (next.type == LparenToken) {
-		Scanner_skip_nl(scanner);
-		Node *expr = parse_expression(scanner, a);
-		if (!expr) {
-			return NULL;
-		}
+	Parser p = {scanner, WORKLIST_EMPTY, WORKLIST_EMPTY};
+	Node *expr = NULL;
+	if (next.type == LetToken) {
+		Scanner_next(scanner); // drop 'LET'
 		Scanner_skip_nl(scanner);
 		next = Scanner_next(scanner);
-		if (next.type != RparenToken) {
-			tokerror("expected ')'", next);
-			return NULL;
+		if (next.type != IdToken) {
+			tokerror("expected identifier", next);
+		} else {
+			push_frame(&p, LetFrame, IdNode_new(next.string, next.length), NULL, 0);
+			Scanner_skip_nl(scanner);
+			if (parse_params(&p, EqToken, "expected '=' or an identifier")) {
+				expr = parse_goal(&p, Expression);
+			}
 		}
-		return expr;
-	} else if (next.type == NumberToken) {
-		return parse_number(next, a);
-	} else if (next.type == IdToken) {
-		return IdNode_new(a, next.string, next.length);
 	} else {
-		tokerror("expected '(', '-' or a number", next);
+		expr = parse_goal(&p, Expression);
+	}
+	Worklist_destroy(&p.frames);
+	Worklist_destroy(&p.pending);
+	if (!expr) {
+		Scanner_seek_end(scanner);
+		return NULL;
+	}
+	next = Scanner_peek(scanner);
+	if (next.type != EndToken) {
+		tokerror("unexpected token after the expression", next);
+		Scanner_seek_end(scanner);
 		return NULL;
 	}
+	return expr;
 }
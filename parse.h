@@ -4,6 +4,6 @@
 #include "scanner.h"
 #include "node.h"
 
-Node *parse(Scanner *scanner, Arena *a);
+Node *parse(Scanner *scanner);
 
 #endif // PARSE_INCLUDED
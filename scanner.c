@@ -5,10 +5,10 @@
 #include "token.h"
 
 
-Scanner Scanner_make(FILE *file)
+Scanner Scanner_make(int fd)
 {
 	Scanner scanner;
-	scanner.iterator = Iter_make(file);
+	scanner.iterator = Iter_make(fd);
 	scanner.next = (Token){ErrorToken, "", 0};
 	return scanner;
 }
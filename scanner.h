@@ -9,7 +9,7 @@ typedef struct {
 	Token next;
 } Scanner;
 
-Scanner Scanner_make(FILE *file);
+Scanner Scanner_make(int fd);
 void    Scanner_destroy(Scanner scanner);
 void    Scanner_start(Scanner *scanner);
 Token   Scanner_peek(Scanner *scanner);
@@ -0,0 +1,226 @@
+#include "simd.h"
+
+
+// The kernels are written once for each of the instruction sets: the
+// vector loops handle the elements in blocks of the vector width and the
+// scalar loops handle the rest. The vector sums and dot products add the
+// elements in a different order than the scalar ones, so the results may
+// differ in the last bits.
+
+#define SCALAR_BINARY(name, expr)\
+static void name(double *r, const double *a, const double *b, long n)\
+{\
+	for (long i = 0; i < n; i++) {\
+		r[i] = (expr);\
+	}\
+}
+
+SCALAR_BINARY(scalar_add, a[i] + b[i])
+SCALAR_BINARY(scalar_sub, a[i] - b[i])
+SCALAR_BINARY(scalar_mul, a[i] * b[i])
+SCALAR_BINARY(scalar_div, a[i] / b[i])
+SCALAR_BINARY(scalar_lt, a[i] < b[i])
+SCALAR_BINARY(scalar_eq, a[i] == b[i])
+
+static void scalar_scale(double *r, double k, const double *a, long n)
+{
+	for (long i = 0; i < n; i++) {
+		r[i] = k * a[i];
+	}
+}
+
+static double scalar_sum(const double *a, long n)
+{
+	double s = 0;
+	for (long i = 0; i < n; i++) {
+		s += a[i];
+	}
+	return s;
+}
+
+static double scalar_dot(const double *a, const double *b, long n)
+{
+	double s = 0;
+	for (long i = 0; i < n; i++) {
+		s += a[i] * b[i];
+	}
+	return s;
+}
+
+static double scalar_min(const double *a, long n)
+{
+	double m = a[0];
+	for (long i = 1; i < n; i++) {
+		m = a[i] < m ? a[i] : m;
+	}
+	return m;
+}
+
+static double scalar_max(const double *a, long n)
+{
+	double m = a[0];
+	for (long i = 1; i < n; i++) {
+		m = a[i] > m ? a[i] : m;
+	}
+	return m;
+}
+
+static const Kernels scalar_kernels = {
+	"scalar",
+	scalar_add, scalar_sub, scalar_mul, scalar_div, scalar_lt, scalar_eq,
+	scalar_scale, scalar_sum, scalar_dot, scalar_min, scalar_max,
+};
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+#define VECTOR_BINARY(isa, name, T, W, V, vexpr, expr)\
+static void isa##_##name(double *r, const double *a, const double *b, long n)\
+{\
+	long i = 0;\
+	for (; i + W <= n; i += W) {\
+		T x = V##_load_pd(a + i), y = V##_load_pd(b + i);\
+		V##_store_pd(r + i, (vexpr));\
+	}\
+	for (; i < n; i++) {\
+		r[i] = (expr);\
+	}\
+}
+
+// NOTE: V is the prefix of the intrinsics of the vector type T
+// that has W elements, LT and EQ are the comparisons
+#define VECTOR_KERNELS(isa, T, W, V, LT, EQ)\
+\
+VECTOR_BINARY(isa, add, T, W, V, V##_add_pd(x, y), a[i] + b[i])\
+VECTOR_BINARY(isa, sub, T, W, V, V##_sub_pd(x, y), a[i] - b[i])\
+VECTOR_BINARY(isa, mul, T, W, V, V##_mul_pd(x, y), a[i] * b[i])\
+VECTOR_BINARY(isa, div, T, W, V, V##_div_pd(x, y), a[i] / b[i])\
+VECTOR_BINARY(isa, lt, T, W, V, V##_and_pd(LT(x, y), V##_set1_pd(1)), a[i] < b[i])\
+VECTOR_BINARY(isa, eq, T, W, V, V##_and_pd(EQ(x, y), V##_set1_pd(1)), a[i] == b[i])\
+\
+static void isa##_scale(double *r, double k, const double *a, long n)\
+{\
+	long i = 0;\
+	T vk = V##_set1_pd(k);\
+	for (; i + W <= n; i += W) {\
+		V##_store_pd(r + i, V##_mul_pd(vk, V##_load_pd(a + i)));\
+	}\
+	for (; i < n; i++) {\
+		r[i] = k * a[i];\
+	}\
+}\
+\
+/* the lanes of the vector combined with the operation */\
+static double isa##_reduce(T v, int op)\
+{\
+	_Alignas(T) double lanes[W];\
+	V##_store_pd(lanes, v);\
+	double s = lanes[0];\
+	for (int i = 1; i < W; i++) {\
+		switch (op) {\
+			case '+': s += lanes[i]; break;\
+			case '<': s = lanes[i] < s ? lanes[i] : s; break;\
+			case '>': s = lanes[i] > s ? lanes[i] : s; break;\
+		}\
+	}\
+	return s;\
+}\
+\
+static double isa##_sum(const double *a, long n)\
+{\
+	long i = 0;\
+	T s = V##_setzero_pd();\
+	for (; i + W <= n; i += W) {\
+		s = V##_add_pd(s, V##_load_pd(a + i));\
+	}\
+	double r = isa##_reduce(s, '+');\
+	for (; i < n; i++) {\
+		r += a[i];\
+	}\
+	return r;\
+}\
+\
+static double isa##_dot(const double *a, const double *b, long n)\
+{\
+	long i = 0;\
+	T s = V##_setzero_pd();\
+	for (; i + W <= n; i += W) {\
+		s = V##_add_pd(s, V##_mul_pd(V##_load_pd(a + i), V##_load_pd(b + i)));\
+	}\
+	double r = isa##_reduce(s, '+');\
+	for (; i < n; i++) {\
+		r += a[i] * b[i];\
+	}\
+	return r;\
+}\
+\
+static double isa##_min(const double *a, long n)\
+{\
+	if (n < W) {\
+		return scalar_min(a, n);\
+	}\
+	long i = W;\
+	T m = V##_load_pd(a);\
+	for (; i + W <= n; i += W) {\
+		m = V##_min_pd(m, V##_load_pd(a + i));\
+	}\
+	double r = isa##_reduce(m, '<');\
+	for (; i < n; i++) {\
+		r = a[i] < r ? a[i] : r;\
+	}\
+	return r;\
+}\
+\
+static double isa##_max(const double *a, long n)\
+{\
+	if (n < W) {\
+		return scalar_max(a, n);\
+	}\
+	long i = W;\
+	T m = V##_load_pd(a);\
+	for (; i + W <= n; i += W) {\
+		m = V##_max_pd(m, V##_load_pd(a + i));\
+	}\
+	double r = isa##_reduce(m, '>');\
+	for (; i < n; i++) {\
+		r = a[i] > r ? a[i] : r;\
+	}\
+	return r;\
+}\
+\
+static const Kernels isa##_kernels = {\
+	#isa,\
+	isa##_add, isa##_sub, isa##_mul, isa##_div, isa##_lt, isa##_eq,\
+	isa##_scale, isa##_sum, isa##_dot, isa##_min, isa##_max,\
+};
+
+// NOTE: SSE2 is a part of amd64, so it's always there
+VECTOR_KERNELS(sse2, __m128d, 2, _mm, _mm_cmplt_pd, _mm_cmpeq_pd)
+
+#define AVX_LT(x, y) _mm256_cmp_pd(x, y, _CMP_LT_OQ)
+#define AVX_EQ(x, y) _mm256_cmp_pd(x, y, _CMP_EQ_OQ)
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+VECTOR_KERNELS(avx2, __m256d, 4, _mm256, AVX_LT, AVX_EQ)
+#pragma GCC pop_options
+
+#endif
+
+const Kernels *Simd_kernels(void)
+{
+	static const Kernels *kernels = NULL;
+	if (kernels) {
+		return kernels;
+	}
+	kernels = &scalar_kernels;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	kernels = &sse2_kernels;
+	if (__builtin_cpu_supports("avx2")) {
+		kernels = &avx2_kernels;
+	}
+#endif
+	return kernels;
+}
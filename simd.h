@@ -0,0 +1,25 @@
+#ifndef SIMD_INCLUDED
+#define SIMD_INCLUDED
+
+// The kernels of the array builtins. NOTE: the arrays must be aligned
+// to ARRAY_ALIGNMENT (see values.h), the result may be one of the operands.
+// The masks of the comparisons are 1 where the comparison holds and 0 elsewhere.
+typedef struct {
+	const char *name;
+	void       (*add)(double *r, const double *a, const double *b, long n);
+	void       (*sub)(double *r, const double *a, const double *b, long n);
+	void       (*mul)(double *r, const double *a, const double *b, long n);
+	void       (*div)(double *r, const double *a, const double *b, long n);
+	void       (*lt)(double *r, const double *a, const double *b, long n);
+	void       (*eq)(double *r, const double *a, const double *b, long n);
+	void       (*scale)(double *r, double k, const double *a, long n);
+	double     (*sum)(const double *a, long n);
+	double     (*dot)(const double *a, const double *b, long n);
+	double     (*min)(const double *a, long n); // NOTE: n must be positive
+	double     (*max)(const double *a, long n);
+} Kernels;
+
+// NOTE: the best kernels the CPU supports, selected on the first call
+const Kernels *Simd_kernels(void);
+
+#endif // SIMD_INCLUDED
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include "object.h"
+#include "node.h"
 
 
 Stack *Stack_new(void)
@@ -10,43 +11,56 @@ Stack *Stack_new(void)
 	Stack *self = malloc(sizeof(*self));
 	self->size = 0;
 	self->capacity = INITIAL_STACK_CAPACITY;
-	self->objects = calloc(INITIAL_STACK_CAPACITY, sizeof(*self->objects));
+	self->frames = calloc(INITIAL_STACK_CAPACITY, sizeof(*self->frames));
+	self->spare = NULL;
 	return self;
 }
 
 void Stack_drop(Stack *self)
 {
-	free(self->objects);
+	free(self->frames);
 	free(self);
 }
 
-void Stack_push(Stack *self, Object *value)
+Frame *Stack_push(Stack *self, int kind, const Node *expr, Object *env)
 {
 	if (self->size >= self->capacity) {
+		Frame *frames = reallocarray(self->frames, self->capacity * 2, sizeof(*self->frames));
+		if (!frames) {
+			return NULL;
+		}
+		self->frames = frames;
 		self->capacity *= 2;
-		self->objects = reallocarray(self->objects, self->capacity, sizeof(*self->objects));
 	}
-	self->objects[self->size] = value;
+	Frame *frame = &self->frames[self->size];
 	self->size += 1;
-}
-
-Object *Stack_pop(Stack *self)
-{
-	if (!self->size) {
-		return NULL;
-	}
-	self->size -= 1;
-	return self->objects[self->size];
+	frame->kind = kind;
+	frame->count = 0;
+	frame->expr = expr;
+	frame->callee = NULL;
+	frame->env = env;
+	frame->value = NULL;
+	frame->num = Number_int(0);
+	return frame;
 }
 
 void Stack_clear(Stack *self)
 {
 	self->size = 0;
+	self->spare = NULL;
 }
 
 void Stack_for_each(const Stack *self, void (*fn)(void *, Object *), void *param)
 {
+	if (self->spare) {
+		fn(param, self->spare);
+	}
 	for (int i = 0; i < self->size; i++) {
-		fn(param, self->objects[i]);
+		if (self->frames[i].env) {
+			fn(param, self->frames[i].env);
+		}
+		if (self->frames[i].value) {
+			fn(param, self->frames[i].value);
+		}
 	}
 }
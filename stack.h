@@ -2,11 +2,25 @@
 #define STACK_INCLUDED
 
 #include "object.h"
+#include "node.h"
 
+// A continuation frame of the evaluator, the kind is owned by eval.c
 typedef struct {
-	Object **objects;
+	int        kind;
+	int        count;
+	const Node *expr;
+	const Node *callee;
+	Object     *env;
+	Object     *value;
+	Number     num;
+} Frame;
+
+// NOTE: spare is the env of a finished tail call that is reused by the next call
+typedef struct {
+	Frame  *frames;
 	int    capacity;
 	int    size;
+	Object *spare;
 	Object handle;
 } Stack;
 
@@ -14,10 +28,13 @@ typedef struct {
 
 #define INITIAL_STACK_CAPACITY 100
 
+#define Stack_top(self) (&(self)->frames[(self)->size - 1])
+#define Stack_pop(self) ((self)->size -= 1)
+
+// NOTE: the returned pointer is only valid until the next push
 Stack  *Stack_new(void);
 void   Stack_drop(Stack *self);
-void   Stack_push(Stack *self, Object *value);
-Object *Stack_pop(Stack *self);
+Frame  *Stack_push(Stack *self, int kind, const Node *expr, Object *env);
 void   Stack_clear(Stack *self);
 void   Stack_for_each(const Stack *self, void (*fn)(void *, Object *), void *param);
 
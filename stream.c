@@ -0,0 +1,217 @@
+#include "stream.h"
+
+#include <stdlib.h>
+
+#include "object.h"
+#include "values.h"
+#include "gc.h"
+#include "eval.h"
+#include "context.h"
+#include "builtin.h"
+#include "error.h"
+
+
+#define ERROR_PREFIX "evaluation error"
+
+// Stream fusion: a stream is not a list of cells, it's the description of
+// the pipeline that produces it (e.g. 'smap f (sfilter g (from 1))'). The
+// consumers pull the elements through all of the stages at once, so no
+// intermediate cells are allocated, the work per element is the calls of
+// the functions of the stages.
+
+// The state of a stage during a pull, the stage the elements
+// come from is the next one
+typedef struct {
+	const Object *stream;
+	Number       num; // the next number of 'from', the elements left to drop
+} Cursor;
+
+static Object *Cursor_next(Cursor *c, Context *ctx)
+{
+	const Object *s = c->stream;
+	switch (StreamObj_kind(s)) {
+		case FromStream: {
+			Object *n = GC_alloc_boxed(ctx->gc, c->num);
+			Number_op('+', c->num, Number_int(1), &c->num);
+			return n;
+		}
+		case MapStream: {
+			Object *x = Cursor_next(c + 1, ctx);
+			if (!x) {
+				return NULL;
+			}
+			return eval_apply(StreamObj_fn(s), 1, &x, ctx);
+		}
+		case FilterStream:
+			for (;;) {
+				Object *x = Cursor_next(c + 1, ctx);
+				if (!x) {
+					return NULL;
+				}
+				// NOTE: the element is alive while it's bound to the parameter
+				double keep;
+				Object *result = eval_apply(StreamObj_fn(s), 1, &x, ctx);
+				if (!result || !Builtin_number(result, ctx, &keep)) {
+					return NULL;
+				}
+				if (keep) {
+					return x;
+				}
+			}
+		case DropStream:
+			for (; Number_value(c->num) > 0; Number_op('-', c->num, Number_int(1), &c->num)) {
+				if (!Cursor_next(c + 1, ctx)) {
+					return NULL;
+				}
+			}
+			return Cursor_next(c + 1, ctx);
+	}
+	return NULL;
+}
+
+// The cursors of the stages of a pipeline, from the last one to the source
+static Cursor *Stream_cursors(Object *stream, int *depth)
+{
+	*depth = 0;
+	for (Object *s = stream; s; s = StreamObj_src(s)) {
+		*depth += 1;
+	}
+	Cursor *cursors = malloc(*depth * sizeof(*cursors));
+	Object *s = stream;
+	for (int i = 0; i < *depth; i++) {
+		cursors[i] = (Cursor){s, StreamObj_num(s)};
+		s = StreamObj_src(s);
+	}
+	return cursors;
+}
+
+// The n-th element of the stream (from 1)
+static Object *Stream_pull(Object *stream, double n, Context *ctx)
+{
+	int depth;
+	Cursor *cursors = Stream_cursors(stream, &depth);
+	Object *x = NULL;
+	for (double i = 0; i < n; i++) {
+		x = Cursor_next(cursors, ctx);
+		if (!x) {
+			break;
+		}
+	}
+	free(cursors);
+	return x;
+}
+
+// The pipeline that continues where the cursors stopped, the stages
+// that have nothing left to drop are skipped
+static Object *Stream_resume(const Cursor *cursors, int depth, Context *ctx)
+{
+	Object *src = NULL;
+	for (int i = depth - 1; i >= 0; i--) {
+		const Object *s = cursors[i].stream;
+		if (StreamObj_kind(s) == DropStream && Number_value(cursors[i].num) <= 0) {
+			continue;
+		}
+		src = GC_alloc_stream(ctx->gc, StreamObj_kind(s), src, StreamObj_fn(s), cursors[i].num);
+	}
+	return src;
+}
+
+static Object *Stream_stage(StreamKind kind, Object *fn, Object *src, Number num, Context *ctx)
+{
+	// NOTE: the function is forced right away, so pulling an element
+	// doesn't evaluate anything before the element is bound
+	if (fn && !(fn = eval_force(fn, ctx))) {
+		return NULL;
+	}
+	if (!(src = Builtin_arg(src, StreamObject, ctx))) {
+		return NULL;
+	}
+	return GC_alloc_stream(ctx->gc, kind, src, fn, num);
+}
+
+// The numbers from the argument on, they are integers if it is
+Object *Stream_from(Object **args, Context *ctx)
+{
+	Number start;
+	if (!Builtin_numeric(args[0], ctx, &start)) {
+		return NULL;
+	}
+	return GC_alloc_stream(ctx->gc, FromStream, NULL, NULL, start);
+}
+
+Object *Stream_map(Object **args, Context *ctx)
+{
+	return Stream_stage(MapStream, args[0], args[1], Number_int(0), ctx);
+}
+
+Object *Stream_filter(Object **args, Context *ctx)
+{
+	return Stream_stage(FilterStream, args[0], args[1], Number_int(0), ctx);
+}
+
+Object *Stream_drop(Object **args, Context *ctx)
+{
+	Number count;
+	if (!Builtin_numeric(args[0], ctx, &count)) {
+		return NULL;
+	}
+	return Stream_stage(DropStream, NULL, args[1], count, ctx);
+}
+
+// The first element is pulled right away and the rest is the pipeline
+// resumed after it, so taking the tails over and over (e.g. the sieve in
+// examples/stream.calcl) doesn't run the pipeline from the start every time
+Object *Stream_tail(Object **args, Context *ctx)
+{
+	Object *stream = Builtin_arg(args[0], StreamObject, ctx);
+	if (!stream) {
+		return NULL;
+	}
+	int depth;
+	Cursor *cursors = Stream_cursors(stream, &depth);
+	Object *head = Cursor_next(cursors, ctx);
+	Object *tail = NULL;
+	if (head) {
+		if (!StreamObj_head(stream)) {
+			StreamObj_head(stream) = head;
+		}
+		tail = Stream_resume(cursors, depth, ctx);
+	}
+	free(cursors);
+	return tail;
+}
+
+// NOTE: the first element is remembered, since the language is pure
+Object *Stream_head(Object **args, Context *ctx)
+{
+	Object *stream = Builtin_arg(args[0], StreamObject, ctx);
+	if (!stream) {
+		return NULL;
+	}
+	if (!StreamObj_head(stream)) {
+		StreamObj_head(stream) = Stream_pull(stream, 1, ctx);
+	}
+	return StreamObj_head(stream);
+}
+
+Object *Stream_nth(Object **args, Context *ctx)
+{
+	Number num;
+	if (!Builtin_numeric(args[0], ctx, &num)) {
+		return NULL;
+	}
+	double n = Number_value(num);
+	if (n < 1) {
+		char text[NUMBER_TEXT_SIZE];
+		errorf("no element %s in a stream", Number_format(num, text));
+		return NULL;
+	}
+	if (n == 1) {
+		return Stream_head(&args[1], ctx);
+	}
+	Object *stream = Builtin_arg(args[1], StreamObject, ctx);
+	if (!stream) {
+		return NULL;
+	}
+	return Stream_pull(stream, n, ctx);
+}
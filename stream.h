@@ -0,0 +1,16 @@
+#ifndef STREAM_INCLUDED
+#define STREAM_INCLUDED
+
+#include "object.h"
+#include "context.h"
+
+// the builtins, see builtin.c
+Object *Stream_from(Object **args, Context *ctx);
+Object *Stream_map(Object **args, Context *ctx);
+Object *Stream_filter(Object **args, Context *ctx);
+Object *Stream_drop(Object **args, Context *ctx);
+Object *Stream_head(Object **args, Context *ctx);
+Object *Stream_tail(Object **args, Context *ctx);
+Object *Stream_nth(Object **args, Context *ctx);
+
+#endif // STREAM_INCLUDED
@@ -0,0 +1,177 @@
+#include "strict.h"
+
+#include <string.h>
+
+#include "node.h"
+#include "worklist.h"
+
+
+// Strictness analysis: a function is strict in its parameter if evaluating
+// its body always forces the parameter. In lazy mode the arguments of strict
+// functions can be evaluated before the call without changing the meaning
+// of the program: if the argument fails or diverges, so does the call.
+
+// The sets of the names that the analyzed expressions force. A set is a
+// sorted segment of the names, from its start on, and the sets of the
+// children of a node are the topmost ones when the node is analyzed.
+typedef struct {
+	Worklist(const char *) names;
+	Worklist(int)          starts;
+	Worklist(const char *) merged;
+} Forced;
+
+static void Forced_push(Forced *self, const char *name)
+{
+	Worklist_push(&self->starts, self->names.size);
+	if (name) {
+		Worklist_push(&self->names, name);
+	}
+}
+
+static void Forced_drop(Forced *self)
+{
+	self->names.size = Worklist_pop(&self->starts);
+}
+
+static void Forced_clear(Forced *self)
+{
+	self->names.size = *Worklist_top(&self->starts);
+}
+
+// Replace the two topmost sets with their union or their intersection
+static void Forced_merge(Forced *self, int intersect)
+{
+	const char **names = self->names.items;
+	int end = self->names.size;
+	int right = Worklist_pop(&self->starts);
+	int left = *Worklist_top(&self->starts);
+	int i = left, j = right;
+	self->merged.size = 0;
+	while (i < right && j < end) {
+		int cmp = strcmp(names[i], names[j]);
+		if (!cmp || !intersect) {
+			Worklist_push(&self->merged, cmp <= 0 ? names[i] : names[j]);
+		}
+		i += cmp <= 0;
+		j += cmp >= 0;
+	}
+	if (!intersect) {
+		for (; i < right; i++) {
+			Worklist_push(&self->merged, names[i]);
+		}
+		for (; j < end; j++) {
+			Worklist_push(&self->merged, names[j]);
+		}
+	}
+	memcpy(&names[left], self->merged.items, self->merged.size * sizeof(*names));
+	self->names.size = left + self->merged.size;
+}
+
+// The index of the name in the topmost set, -1 if it's not there
+static int Forced_find(const Forced *self, const char *name)
+{
+	int low = *Worklist_top(&self->starts), high = self->names.size;
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		int cmp = strcmp(self->names.items[mid], name);
+		if (!cmp) {
+			return mid;
+		}
+		if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return -1;
+}
+
+// NOTE: the children are analyzed before their parent, chained is set
+// for the body of a function
+typedef struct {
+	Node *expr;
+	int  done;
+	int  chained;
+} Analyzed;
+
+// The set of an expression is the names that evaluating it always forces.
+// The one of a function is empty (its body is not evaluated), unless it's
+// the body of another function: then it's the set of the innermost body
+// without the parameters of the nested functions (a saturated call runs
+// that body right away, see FnNode_saturated). So the children's sets are
+// merged into their parent's and the whole tree is analyzed in one pass.
+void strictness(Node *expr)
+{
+	Worklist(Analyzed) pending = WORKLIST_EMPTY;
+	Forced forced = {WORKLIST_EMPTY, WORKLIST_EMPTY, WORKLIST_EMPTY};
+	Worklist_push(&pending, expr, 0, 0);
+	while (!Worklist_empty(&pending)) {
+		Analyzed item = Worklist_pop(&pending);
+		Node *node = item.expr;
+		if (!item.done) {
+			Worklist_push(&pending, node, 1, item.chained);
+			Node *children[NODE_MAX_CHILDREN];
+			for (int i = Node_children(node, children) - 1; i >= 0; i--) {
+				Worklist_push(&pending, children[i], 0, node->type == FnNode);
+			}
+			continue;
+		}
+		switch (node->type) {
+			case IdNode:
+				Forced_push(&forced, IdNode_value(node));
+				break;
+			case NumberNode:
+				Forced_push(&forced, NULL);
+				break;
+			case LetNode:
+				Forced_clear(&forced);
+				break;
+			case FnNode: {
+				int param = Forced_find(&forced, FnNode_param_value(node));
+				FnNode_strict(node) = param >= 0 && FnNode_body(node)->type != FnNode;
+				FnNode_saturated(node) = param >= 0;
+				if (!item.chained) {
+					Forced_clear(&forced);
+				} else if (param >= 0) {
+					// the parameter shadows the one of the outer functions
+					memmove(
+						&forced.names.items[param], &forced.names.items[param + 1],
+						(forced.names.size - param - 1) * sizeof(*forced.names.items)
+					);
+					forced.names.size -= 1;
+				}
+				break;
+			}
+			case AndNode:
+			case OrNode:
+				// left || (left && right)
+				Forced_drop(&forced);
+				break;
+			case ApplNode: {
+				// (fn x: ...) arg
+				const Node *fn = PairNode_left(node);
+				if (fn->type == FnNode && FnNode_strict(fn)) {
+					Forced_merge(&forced, 0);
+				} else {
+					Forced_drop(&forced);
+				}
+				break;
+			}
+			case IfNode:
+				// cond || (true && false)
+				Forced_merge(&forced, 1);
+				Forced_merge(&forced, 0);
+				break;
+			case GuardNode:
+				Forced_merge(&forced, 1);
+				break;
+			default:
+				Forced_merge(&forced, 0);
+				break;
+		}
+	}
+	Worklist_destroy(&pending);
+	Worklist_destroy(&forced.names);
+	Worklist_destroy(&forced.starts);
+	Worklist_destroy(&forced.merged);
+}
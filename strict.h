@@ -0,0 +1,8 @@
+#ifndef STRICT_INCLUDED
+#define STRICT_INCLUDED
+
+#include "node.h"
+
+void strictness(Node *expr);
+
+#endif // STRICT_INCLUDED
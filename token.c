@@ -30,6 +30,7 @@ void Token_print(Token token)
 		case FnToken:       tokprintf("fn", token);       break;
 		case ColonToken:    tokprintf("colon", token);    break;
 		case LetToken:      tokprintf("let", token);      break;
+		case TildeToken:    tokprintf("tilde", token);    break;
 		case ErrorToken:    tokprintf("error", token);    break;
 		case EndToken:      tokprintf("end", token);      break;
 	}
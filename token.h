@@ -23,6 +23,7 @@ typedef enum {
 	FnToken,
 	ColonToken,
 	LetToken,
+	TildeToken,
 	ErrorToken,
 	EndToken,
 } TokenType;
@@ -1,10 +1,12 @@
 #include "types.h"
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "arena.h"
+#include "worklist.h"
 
 
 static Type *Type_alloc(Arena *a, TypeKind kind)
@@ -23,14 +25,22 @@ Type *VarType_new(Arena *a)
 	return var;
 }
 
+// NOTE: the same numbering as the other variables
+Type *NumericType_new(Arena *a)
+{
+	Type *var = Type_alloc(a, NumericType);
+	var->as.var = id++;
+	return var;
+}
+
 void VarType_reset()
 {
 	id = 0;
 }
 
-static Type *VarType_new_from_value(Arena *a, int value)
+static Type *VarType_new_from_value(Arena *a, TypeKind kind, int value)
 {
-	Type *var = Type_alloc(a, VarType);
+	Type *var = Type_alloc(a, kind);
 	var->as.var = value;
 	return var;
 }
@@ -50,71 +60,191 @@ Type *GenType_new(Arena *a, Type *inner)
 	return gen;
 }
 
+Type *ConType_new(Arena *a, const char *name, Type *arg)
+{
+	Type *con = Type_alloc(a, ConType);
+	con->as.con.name = name;
+	con->as.con.arg = arg;
+	return con;
+}
+
 Type *NumType_get(void)
 {
 	static Type num = {.kind = NumType};
 	return &num;
 }
 
+Type *IntType_get(void)
+{
+	static Type num = {.kind = IntType};
+	return &num;
+}
+
+// NOTE: either a type or a text is printed
+typedef struct {
+	const Type *type;
+	const char *text;
+} Printed;
+
+#define print_text(pending, text) (Worklist_push(pending, NULL, text))
+#define print_type(pending, type) (Worklist_push(pending, type, NULL))
+
+// NOTE: the items are pushed in the reverse order
 void Type_print(const Type *type)
 {
-	switch (type->kind) {
-		case VarType:
-			printf("v%d", VarType_value(type));
-			break;
-		case NumType:
-			printf("num");
-			break;
-		case GenType:
-			Type_print(GenType_inner(type));
-			break;
-		case FnType:
-			if (FnType_from(type)->kind == FnType) {
-				putchar('(');
-				Type_print(FnType_from(type));
-				putchar(')');
-			} else {
-				Type_print(FnType_from(type));
-			}
-			printf(" -> ");
-			Type_print(FnType_to(type));
-			break;
+	Worklist(Printed) pending = WORKLIST_EMPTY;
+	print_type(&pending, type);
+	while (!Worklist_empty(&pending)) {
+		Printed p = Worklist_pop(&pending);
+		if (!p.type) {
+			printf("%s", p.text);
+			continue;
+		}
+		type = p.type;
+		switch (type->kind) {
+			case VarType:
+				printf("v%d", VarType_value(type));
+				break;
+			case NumericType:
+				printf("num");
+				break;
+			case NumType:
+				printf("float");
+				break;
+			case IntType:
+				printf("int");
+				break;
+			case GenType:
+				print_type(&pending, GenType_inner(type));
+				break;
+			case FnType:
+				print_type(&pending, FnType_to(type));
+				print_text(&pending, " -> ");
+				if (FnType_from(type)->kind == FnType) {
+					print_text(&pending, ")");
+					print_type(&pending, FnType_from(type));
+					print_text(&pending, "(");
+				} else {
+					print_type(&pending, FnType_from(type));
+				}
+				break;
+			case ConType:
+				if (!ConType_arg(type)) {
+					printf("%s", ConType_name(type));
+					break;
+				}
+				print_text(&pending, ConType_name(type));
+				if (ConType_arg(type)->kind == FnType) {
+					print_text(&pending, ") ");
+					print_type(&pending, ConType_arg(type));
+					print_text(&pending, "(");
+				} else {
+					print_text(&pending, " ");
+					print_type(&pending, ConType_arg(type));
+				}
+				break;
+		}
 	}
+	Worklist_destroy(&pending);
 }
 
 void Type_drop(Type *type)
 {
-	switch (type->kind) {
-		case VarType:
-			free(type);
-			break;
-		case FnType:
-			Type_drop(FnType_from(type));
-			Type_drop(FnType_to(type));
-			free(type);
-			break;
-		case GenType:
-			Type_drop(GenType_inner(type));
-			free(type);
-			break;
-		case NumType:
-			return;
+	Worklist(Type *) pending = WORKLIST_EMPTY;
+	Worklist_push(&pending, type);
+	while (!Worklist_empty(&pending)) {
+		type = Worklist_pop(&pending);
+		switch (type->kind) {
+			case VarType:
+			case NumericType:
+				break;
+			case FnType:
+				Worklist_push(&pending, FnType_from(type));
+				Worklist_push(&pending, FnType_to(type));
+				break;
+			case GenType:
+				Worklist_push(&pending, GenType_inner(type));
+				break;
+			case ConType:
+				if (ConType_arg(type)) {
+					Worklist_push(&pending, ConType_arg(type));
+				}
+				break;
+			case NumType:
+			case IntType:
+				continue;
+		}
+		free(type);
 	}
+	Worklist_destroy(&pending);
 }
 
+// NOTE: the frames of Type_copy, from is the copy of the argument
+// of a function type once it's done
+typedef struct {
+	const Type *type;
+	Type       *from;
+	int        step;
+} Copying;
+
+// The children are copied in order and the copy of one is returned
+// to the topmost frame
 Type *Type_copy(const Type *type)
 {
-	switch (type->kind) {
-		case VarType:
-			return VarType_new_from_value(NULL, VarType_value(type));
-		case NumType:
-			return NumType_get();
-		case FnType:
-			return FnType_new(NULL, Type_copy(FnType_from(type)), Type_copy(FnType_to(type)));
-		case GenType:
-			return GenType_new(NULL, Type_copy(GenType_inner(type)));
+	Worklist(Copying) frames = WORKLIST_EMPTY;
+	Type *copy = NULL;
+	for (;;) {
+		switch (type->kind) {
+			case VarType:
+			case NumericType:
+				copy = VarType_new_from_value(NULL, type->kind, VarType_value(type));
+				break;
+			case NumType:
+			case IntType:
+				copy = (Type *)type;
+				break;
+			case FnType:
+				Worklist_push(&frames, type, NULL, 0);
+				type = FnType_from(type);
+				continue;
+			case GenType:
+				Worklist_push(&frames, type, NULL, 0);
+				type = GenType_inner(type);
+				continue;
+			case ConType:
+				if (!ConType_arg(type)) {
+					copy = ConType_new(NULL, ConType_name(type), NULL);
+					break;
+				}
+				Worklist_push(&frames, type, NULL, 0);
+				type = ConType_arg(type);
+				continue;
+		}
+		// return the copy until a frame needs another child
+		type = NULL;
+		while (!type && !Worklist_empty(&frames)) {
+			Copying *frame = Worklist_top(&frames);
+			const Type *parent = frame->type;
+			if (parent->kind == FnType && frame->step == 0) {
+				frame->from = copy;
+				frame->step = 1;
+				type = FnType_to(parent);
+				continue;
+			}
+			if (parent->kind == FnType) {
+				copy = FnType_new(NULL, frame->from, copy);
+			} else if (parent->kind == GenType) {
+				copy = GenType_new(NULL, copy);
+			} else {
+				copy = ConType_new(NULL, ConType_name(parent), copy);
+			}
+			Worklist_drop(&frames);
+		}
+		if (!type) {
+			Worklist_destroy(&frames);
+			return copy;
+		}
 	}
-	return NULL;
 }
 
 void Type_println(const Type *type)
@@ -123,51 +253,178 @@ void Type_println(const Type *type)
 	putchar('\n');
 }
 
+typedef struct {
+	const Type *t1;
+	const Type *t2;
+} Compared;
+
 int Type_eq(const Type *t1, const Type *t2)
 {
-	if (t1->kind != t2->kind) {
-		return 0;
+	Worklist(Compared) pending = WORKLIST_EMPTY;
+	int eq = 1;
+	Worklist_push(&pending, t1, t2);
+	while (eq && !Worklist_empty(&pending)) {
+		Compared c = Worklist_pop(&pending);
+		t1 = c.t1;
+		t2 = c.t2;
+		if (t1->kind != t2->kind) {
+			eq = 0;
+		} else if (t1->kind == GenType) {
+			Worklist_push(&pending, GenType_inner(t1), GenType_inner(t2));
+		} else if (t1->kind == FnType) {
+			Worklist_push(&pending, FnType_to(t1), FnType_to(t2));
+			Worklist_push(&pending, FnType_from(t1), FnType_from(t2));
+		} else if (t1->kind == VarType || t1->kind == NumericType) {
+			eq = VarType_value(t1) == VarType_value(t2);
+		} else if (t1->kind == ConType) {
+			eq = ConType_name(t1) == ConType_name(t2);
+			if (eq && ConType_arg(t1)) {
+				Worklist_push(&pending, ConType_arg(t1), ConType_arg(t2));
+			}
+		}
 	}
-	if (t1->kind == GenType) {
-		return Type_eq(GenType_inner(t1), GenType_inner(t2));
+	Worklist_destroy(&pending);
+	return eq;
+}
+
+// the constructors of the builtin types, see ConType
+static const char *constructors[] = {
+	"stream",
+	"list",
+	"array",
+	"map",
+	"vector",
+};
+
+static const char *constructor(const char *name, int length)
+{
+	for (size_t i = 0; i < sizeof(constructors)/sizeof(*constructors); i++) {
+		if (strlen(constructors[i]) == (size_t)length && !strncmp(constructors[i], name, length)) {
+			return constructors[i];
+		}
+	}
+	return NULL;
+}
+
+static int word(const char *s)
+{
+	int length = 0;
+	while (isalpha(s[length])) {
+		length += 1;
+	}
+	return length;
+}
+
+static void skip_spaces(const char **s)
+{
+	while (**s == ' ') {
+		*s += 1;
+	}
+}
+
+static Type *parse_arrow(const char **s, Arena *a);
+
+// every 'num' of a signature is a different variable,
+// numbered after the letters
+static int numerics = 0;
+
+// atom <- 'num' | 'int' | 'float' | letter | constructor | '(' arrow ')'
+static Type *parse_atom(const char **s, Arena *a)
+{
+	skip_spaces(s);
+	if (**s == '(') {
+		*s += 1;
+		Type *type = parse_arrow(s, a);
+		skip_spaces(s);
+		*s += 1;
+		return type;
+	}
+	int length = word(*s);
+	Type *type;
+	if (length == 1) {
+		type = VarType_new_from_value(a, VarType, **s - 'a');
+	} else if (length == 3 && !strncmp(*s, "num", 3)) {
+		type = VarType_new_from_value(a, NumericType, 'z' - 'a' + ++numerics);
+	} else if (length == 3 && !strncmp(*s, "int", 3)) {
+		type = IntType_get();
+	} else if (length == 5 && !strncmp(*s, "float", 5)) {
+		type = NumType_get();
+	} else {
+		type = ConType_new(a, constructor(*s, length), NULL);
 	}
-	if (t1->kind == FnType) {
-		return (
-			Type_eq(FnType_from(t1), FnType_from(t2)) &&
-			Type_eq(FnType_to(t1), FnType_to(t2))
-		);
+	*s += length;
+	return type;
+}
+
+// app <- atom constructor*
+static Type *parse_app(const char **s, Arena *a)
+{
+	Type *type = parse_atom(s, a);
+	for (;;) {
+		skip_spaces(s);
+		const char *name = constructor(*s, word(*s));
+		if (!name) {
+			return type;
+		}
+		*s += word(*s);
+		type = ConType_new(a, name, type);
 	}
-	if (t1->kind == VarType) {
-		return VarType_value(t1) == VarType_value(t2);
+}
+
+// arrow <- app ('->' arrow)?
+static Type *parse_arrow(const char **s, Arena *a)
+{
+	Type *from = parse_app(s, a);
+	skip_spaces(s);
+	if (strncmp(*s, "->", 2)) {
+		return from;
 	}
-	return 1;
+	*s += 2;
+	return FnType_new(a, from, parse_arrow(s, a));
 }
 
-void TypeEnv_push(TypeEnv **env, const char *name, const Type *type)
+// The polytype of a signature of a builtin (e.g. '(a -> b) -> a stream -> b stream'),
+// a letter is a type variable. NOTE: the signatures are assumed to be valid.
+Type *Type_parse(const char *sig, Arena *a)
+{
+	numerics = 0;
+	return GenType_new(a, parse_arrow(&sig, a));
+}
+
+void TypeEnv_push(TypeEnv **env, const char *name, const Type *type, int builtin)
 {
 	TypeEnv *new = malloc(sizeof(*new));
 	new->name = strdup(name);
-	new->type = Type_copy(type);
+	new->type = type ? Type_copy(type) : NULL;
+	new->builtin = builtin;
 	new->prev = *env;
 	*env = new;
 }
 
-Type *TypeEnv_lookup(const TypeEnv *env, const char *name)
+TypeEnv *TypeEnv_find(const TypeEnv *env, const char *name)
 {
 	while (env != TYPEENV_EMPTY) {
 		if (!strcmp(env->name, name)) {
-			return env->type;
+			return (TypeEnv *)env;
 		}
 		env = env->prev;
 	}
 	return NULL;
 }
 
+Type *TypeEnv_lookup(const TypeEnv *env, const char *name)
+{
+	TypeEnv *found = TypeEnv_find(env, name);
+	return found ? found->type : NULL;
+}
+
 void TypeEnv_drop(TypeEnv *env)
 {
 	while (env != TYPEENV_EMPTY) {
 		TypeEnv *prev = env->prev;
-		Type_drop(env->type);
+		if (env->type) {
+			Type_drop(env->type);
+		}
 		free(env->name);
 		free(env);
 		env = prev;
@@ -5,11 +5,16 @@
 
 typedef struct Type Type;
 
+// NOTE: NumType is the type of the doubles ('float'), IntType of the
+// integers and NumericType is a variable that stands for either ('num')
 typedef enum {
 	GenType,
 	VarType,
+	NumericType,
 	NumType,
+	IntType,
 	FnType,
+	ConType,
 } TypeKind;
 
 typedef struct {
@@ -20,10 +25,21 @@ typedef struct {
 #define FnType_from(typeptr) ((typeptr)->as.fn.from)
 #define FnType_to(typeptr) ((typeptr)->as.fn.to)
 
+// NOTE: the name is one of the constructors of the builtin types (see
+// types.c), so the names are compared as pointers
+typedef struct {
+	const char *name;
+	Type       *arg;
+} ConTypeValue;
+
+#define ConType_name(typeptr) ((typeptr)->as.con.name)
+#define ConType_arg(typeptr) ((typeptr)->as.con.arg)
+
 typedef union {
-	int         var;
-	FnTypeValue fn;
-	Type        *gen;
+	int          var;
+	FnTypeValue  fn;
+	ConTypeValue con;
+	Type         *gen;
 } TypeValue;
 
 #define VarType_value(typeptr) ((typeptr)->as.var)
@@ -38,10 +54,14 @@ void Type_print(const Type *type);
 void Type_println(const Type *type);
 
 Type *NumType_get(void);
+Type *IntType_get(void);
 Type *VarType_new(Arena *a);
+Type *NumericType_new(Arena *a);
 void VarType_reset(void);
 Type *FnType_new(Arena *a, Type *from, Type *to);
 Type *GenType_new(Arena *a, Type *inner);
+Type *ConType_new(Arena *a, const char *name, Type *arg);
+Type *Type_parse(const char *sig, Arena *a);
 
 Type *Type_copy(const Type *type); // NOTE: the return value is malloc'ed, must be Type_drop'ed
 void Type_drop(Type *type);
@@ -49,16 +69,20 @@ int  Type_eq(const Type *t1, const Type *t2);
 
 typedef struct TypeEnv TypeEnv;
 
+// NOTE: builtin is set for the types of the builtins, the type is NULL
+// for a builtin that the program failed to redefine (it's hidden)
 struct TypeEnv {
 	char    *name;
 	Type    *type;
+	int     builtin;
 	TypeEnv *prev;
 };
 
 #define TYPEENV_EMPTY (TypeEnv *)0
 
-void TypeEnv_push(TypeEnv **env, const char *name, const Type *type);
-Type *TypeEnv_lookup(const TypeEnv *env, const char *name);
+void    TypeEnv_push(TypeEnv **env, const char *name, const Type *type, int builtin);
+TypeEnv *TypeEnv_find(const TypeEnv *env, const char *name);
+Type    *TypeEnv_lookup(const TypeEnv *env, const char *name);
 void TypeEnv_drop(TypeEnv *env);
 
 #endif // TYPES_INCLUDED
@@ -3,27 +3,44 @@
 
 #include "object.h"
 #include "node.h"
+#include "number.h"
 
 typedef struct {
 	Object     *env;
-	const Node *body;
-	const char *arg;
+	const Node *node; // FnNode
 	Object     handle;
 } Fn;
 
 #define FnObj_env(objptr) (ObjToVal(objptr, Fn)->env)
-#define FnObj_body(objptr) (ObjToVal(objptr, Fn)->body)
-#define FnObj_arg(objptr) (ObjToVal(objptr, Fn)->arg)
+#define FnObj_node(objptr) (ObjToVal(objptr, Fn)->node)
+#define FnObj_body(objptr) (FnNode_body(FnObj_node(objptr)))
+#define FnObj_arg(objptr) (FnNode_param_value(FnObj_node(objptr)))
 
+// The static part of a compiled function, emitted by codegen.c
 typedef struct {
-	Object     *env;
-	const void *text;
-	Object     handle;
+	int        arity;     // the number of directly nested functions, this one included
+	int        lazy;      // the argument of a single application is passed by need
+	int        saturated; // bit i: the argument i of a call with all of them is passed by need
+	const void *body;     // the innermost body, the parameters are expected to be bound
+	const char **params;  // the parameters of the nested functions
+} CompFnDesc;
+
+typedef struct {
+	Object           *env;
+	const void       *text;
+	const CompFnDesc *desc;
+	Object           handle;
 } CompFn;
 
 #define CompFnObj_env(objptr) (ObjToVal(objptr, CompFn)->env)
 #define CompFnObj_text(objptr) (ObjToVal(objptr, CompFn)->text)
+#define CompFnObj_desc(objptr) (ObjToVal(objptr, CompFn)->desc)
 
+// A thunk is either unevaluated (env is set), evaluated (value is set)
+// or under evaluation (a blackhole: env and value are NULL, its Update
+// frame keeps the env, see eval_machine).
+// A thunk with no body is a suspended call of a builtin, env is the
+// builtin with all of its arguments (see GC_alloc_suspension).
 typedef struct {
 	Object     *env;
 	const Node *body;
@@ -34,11 +51,12 @@ typedef struct {
 #define ThunkObj_env(objptr) (ObjToVal(objptr, Thunk)->env)
 #define ThunkObj_body(objptr) (ObjToVal(objptr, Thunk)->body)
 #define ThunkObj_value(objptr) (ObjToVal(objptr, Thunk)->value)
-#define ThunkObj_set_value(objptr, value) ({\
+#define ThunkObj_set_value(objptr, v) ({\
 	ObjToVal(objptr, Thunk)->body = NULL;\
 	ObjToVal(objptr, Thunk)->env = NULL;\
-	ObjToVal(objptr, Thunk)->value = (value);\
+	ObjToVal(objptr, Thunk)->value = (v);\
 })
+#define ThunkObj_blackhole(objptr) (ObjToVal(objptr, Thunk)->env = NULL)
 
 typedef struct {
 	Object *env;
@@ -58,4 +76,153 @@ typedef struct {
 
 #define NumObj_num(objptr) (ObjToVal(objptr, Num)->num)
 
+// NOTE: the layout is the same as the one of Num, so
+// the compiled code tests both for zero the same way
+typedef struct {
+	long   num;
+	Object handle;
+} Int;
+
+#define IntObj_num(objptr) (ObjToVal(objptr, Int)->num)
+
+// The number in a Num or an Int, evaluates to 0 if it's neither
+#define Number_unbox(objptr, numptr) ({\
+	const Object *unboxed = (objptr);\
+	int number = 1;\
+	if (unboxed->type == IntObject) {\
+		*(numptr) = Number_int(IntObj_num(unboxed));\
+	} else if (unboxed->type == NumObject) {\
+		*(numptr) = Number_double(NumObj_num(unboxed));\
+	} else {\
+		number = 0;\
+	}\
+	number;\
+})
+
+// the most parameters of a builtin
+#define BUILTIN_MAX_ARGS 4
+
+typedef struct Context Context;
+
+// A function implemented in C (see builtin.c), the arguments are
+// not forced, fn returns NULL if the call fails
+typedef struct {
+	const char *name;
+	const char *type; // the signature, see Type_parse
+	int        arity;
+	Object     *(*fn)(Object **args, Context *ctx);
+} BuiltinDesc;
+
+// A builtin applied to the first count of its arguments
+typedef struct {
+	const BuiltinDesc *desc;
+	int               count;
+	Object            *args[BUILTIN_MAX_ARGS];
+	Object            handle;
+} Builtin;
+
+#define BuiltinObj_desc(objptr) (ObjToVal(objptr, Builtin)->desc)
+#define BuiltinObj_count(objptr) (ObjToVal(objptr, Builtin)->count)
+#define BuiltinObj_args(objptr) (ObjToVal(objptr, Builtin)->args)
+
+typedef enum {
+	FromStream,   // the numbers from num on
+	MapStream,    // fn applied to the elements of src
+	FilterStream, // the elements of src fn holds for
+	DropStream,   // the elements of src but the first num of them
+} StreamKind;
+
+// A stream is a description of a pipeline, the elements are pulled
+// through all of its stages at once (see stream.c), head is the first
+// element once it's known
+typedef struct {
+	StreamKind kind;
+	Object     *src;
+	Object     *fn;
+	Number     num;
+	Object     *head;
+	Object     handle;
+} Stream;
+
+#define StreamObj_kind(objptr) (ObjToVal(objptr, Stream)->kind)
+#define StreamObj_src(objptr) (ObjToVal(objptr, Stream)->src)
+#define StreamObj_fn(objptr) (ObjToVal(objptr, Stream)->fn)
+#define StreamObj_num(objptr) (ObjToVal(objptr, Stream)->num)
+#define StreamObj_head(objptr) (ObjToVal(objptr, Stream)->head)
+
+// A cell of a list, the empty list is a cell with no head and tail
+typedef struct {
+	Object *head;
+	Object *tail;
+	Object handle;
+} Cell;
+
+#define ListObj_head(objptr) (ObjToVal(objptr, Cell)->head)
+#define ListObj_tail(objptr) (ObjToVal(objptr, Cell)->tail)
+#define ListObj_empty(objptr) (!ListObj_head(objptr))
+
+// NOTE: the data is aligned for the vector kernels, see simd.h
+typedef struct {
+	long   length;
+	double *data;
+	Object handle;
+} Array;
+
+#define ARRAY_ALIGNMENT 64
+// so that the size in bytes can't overflow
+#define ARRAY_MAX_LENGTH (1L << 48)
+
+#define ArrayObj_length(objptr) (ObjToVal(objptr, Array)->length)
+#define ArrayObj_data(objptr) (ObjToVal(objptr, Array)->data)
+
+// A node of a hash array mapped trie (see map.c), a map is its root node.
+// The bitmap tells which of the 32 slots are set (the slots are stored
+// compactly), leaves tells which of them are pairs rather than subnodes.
+typedef struct {
+	Number key;
+	Object *value; // the subnode if the slot is not a leaf
+} Slot;
+
+typedef struct {
+	unsigned int bitmap;
+	unsigned int leaves;
+	long         size; // the number of pairs in the trie
+	Object       handle;
+	Slot         slots[];
+} MapNode;
+
+#define MapObj_bitmap(objptr) (ObjToVal(objptr, MapNode)->bitmap)
+#define MapObj_leaves(objptr) (ObjToVal(objptr, MapNode)->leaves)
+#define MapObj_size(objptr) (ObjToVal(objptr, MapNode)->size)
+#define MapObj_slots(objptr) (ObjToVal(objptr, MapNode)->slots)
+#define MapObj_count(objptr) (__builtin_popcount(MapObj_bitmap(objptr)))
+
+// A vector is a trie of the nodes of VECTOR_WIDTH slots (see vector.c),
+// the last elements are kept in the tail node rather than in the trie.
+// NOTE: edit is the transient that can update the node in place (0 if none).
+#define VECTOR_BITS 5
+#define VECTOR_WIDTH (1 << VECTOR_BITS)
+
+typedef struct {
+	unsigned long edit;
+	Object        *slots[VECTOR_WIDTH];
+	Object        handle;
+} Vecnode;
+
+#define VecnodeObj_edit(objptr) (ObjToVal(objptr, Vecnode)->edit)
+#define VecnodeObj_slots(objptr) (ObjToVal(objptr, Vecnode)->slots)
+
+typedef struct {
+	long   size;
+	int    shift; // of the index at the root
+	Object *root;
+	Object *tail;
+	Object handle;
+} Vector;
+
+#define VectorObj_size(objptr) (ObjToVal(objptr, Vector)->size)
+#define VectorObj_shift(objptr) (ObjToVal(objptr, Vector)->shift)
+#define VectorObj_root(objptr) (ObjToVal(objptr, Vector)->root)
+#define VectorObj_tail(objptr) (ObjToVal(objptr, Vector)->tail)
+
 #endif // VALUES_INCLUDED
@@ -0,0 +1,292 @@
+#include "vector.h"
+
+#include <string.h>
+
+#include "object.h"
+#include "values.h"
+#include "gc.h"
+#include "context.h"
+#include "builtin.h"
+#include "error.h"
+
+
+#define ERROR_PREFIX "evaluation error"
+
+// Persistent vectors: the elements are the leaves of a trie where every
+// level takes VECTOR_BITS of the index, so get and set take O(log32 n)
+// steps and set copies only the nodes on the path to the element. The
+// last (up to VECTOR_WIDTH) elements are kept in a separate tail node,
+// so push usually copies just the tail.
+//
+// The builtins that add many elements (concat, slice and building from
+// a list) use a transient: a new edit number marks the nodes they have
+// copied, and those nodes are updated in place by the next pushes rather
+// than copied again. The nodes of the original vectors have other edit
+// numbers, so they are never changed.
+
+#define MASK (VECTOR_WIDTH - 1)
+
+static unsigned long edits = 0;
+
+// The index of the first element of the tail
+static long Vector_tail_offset(long size)
+{
+	if (size < VECTOR_WIDTH) {
+		return 0;
+	}
+	return ((size - 1) >> VECTOR_BITS) << VECTOR_BITS;
+}
+
+// NOTE: a node of the transient is returned as it is
+static Object *Vector_editable(GC *gc, Object *node, unsigned long edit)
+{
+	if (edit && VecnodeObj_edit(node) == edit) {
+		return node;
+	}
+	Object *copy = GC_alloc_vecnode(gc, edit);
+	memcpy(VecnodeObj_slots(copy), VecnodeObj_slots(node), sizeof(VecnodeObj_slots(node)));
+	return copy;
+}
+
+// The chain of the nodes from the level down to the leaf
+static Object *Vector_path(GC *gc, int shift, Object *leaf, unsigned long edit)
+{
+	if (!shift) {
+		return leaf;
+	}
+	Object *node = GC_alloc_vecnode(gc, edit);
+	VecnodeObj_slots(node)[0] = Vector_path(gc, shift - VECTOR_BITS, leaf, edit);
+	return node;
+}
+
+// NOTE: size is the index of the first element of the leaf
+static Object *Vector_push_leaf(GC *gc, Object *node, int shift, long size, Object *leaf, unsigned long edit)
+{
+	node = Vector_editable(gc, node, edit);
+	int index = (size >> shift) & MASK;
+	Object **slot = &VecnodeObj_slots(node)[index];
+	if (shift == VECTOR_BITS) {
+		*slot = leaf;
+	} else if (*slot) {
+		*slot = Vector_push_leaf(gc, *slot, shift - VECTOR_BITS, size, leaf, edit);
+	} else {
+		*slot = Vector_path(gc, shift - VECTOR_BITS, leaf, edit);
+	}
+	return node;
+}
+
+// NOTE: the vector is updated in place, so it must be a new one
+static void Vector_append(GC *gc, Object *vec, Object *x, unsigned long edit)
+{
+	long size = VectorObj_size(vec);
+	long count = size - Vector_tail_offset(size);
+	if (count < VECTOR_WIDTH) {
+		Object *tail = Vector_editable(gc, VectorObj_tail(vec), edit);
+		VecnodeObj_slots(tail)[count] = x;
+		VectorObj_tail(vec) = tail;
+		VectorObj_size(vec) += 1;
+		return;
+	}
+	// the full tail goes to the trie
+	long offset = size - VECTOR_WIDTH;
+	int shift = VectorObj_shift(vec);
+	Object *root = VectorObj_root(vec);
+	if ((offset >> shift) >= VECTOR_WIDTH) {
+		// no room left at the root
+		Object *new = GC_alloc_vecnode(gc, edit);
+		VecnodeObj_slots(new)[0] = root;
+		VecnodeObj_slots(new)[1] = Vector_path(gc, shift, VectorObj_tail(vec), edit);
+		VectorObj_root(vec) = new;
+		VectorObj_shift(vec) = shift + VECTOR_BITS;
+	} else {
+		VectorObj_root(vec) = Vector_push_leaf(gc, root, shift, offset, VectorObj_tail(vec), edit);
+	}
+	Object *tail = GC_alloc_vecnode(gc, edit);
+	VecnodeObj_slots(tail)[0] = x;
+	VectorObj_tail(vec) = tail;
+	VectorObj_size(vec) += 1;
+}
+
+// The leaf with the element of the index
+static Object *Vector_leaf(const Object *vec, long index)
+{
+	if (index >= Vector_tail_offset(VectorObj_size(vec))) {
+		return VectorObj_tail(vec);
+	}
+	Object *node = VectorObj_root(vec);
+	for (int shift = VectorObj_shift(vec); shift > 0; shift -= VECTOR_BITS) {
+		node = VecnodeObj_slots(node)[(index >> shift) & MASK];
+	}
+	return node;
+}
+
+Object *Vector_element(const Object *vec, long index)
+{
+	return VecnodeObj_slots(Vector_leaf(vec, index))[index & MASK];
+}
+
+static Object *Vector_assoc(GC *gc, Object *node, int shift, long index, Object *x)
+{
+	node = Vector_editable(gc, node, 0);
+	Object **slot = &VecnodeObj_slots(node)[(index >> shift) & MASK];
+	if (shift) {
+		*slot = Vector_assoc(gc, *slot, shift - VECTOR_BITS, index, x);
+	} else {
+		*slot = x;
+	}
+	return node;
+}
+
+static Object *Vector_new(GC *gc)
+{
+	return GC_alloc_vector(gc, 0, VECTOR_BITS, GC_alloc_vecnode(gc, 0), GC_alloc_vecnode(gc, 0));
+}
+
+static Object *Vector_copy(GC *gc, Object *vec)
+{
+	return GC_alloc_vector(gc,
+		VectorObj_size(vec), VectorObj_shift(vec), VectorObj_root(vec), VectorObj_tail(vec)
+	);
+}
+
+// Append the elements of the range of the vector to the new vector
+static void Vector_append_range(GC *gc, Object *vec, Object *from, long start, long end, unsigned long edit)
+{
+	for (long i = start; i < end;) {
+		Object **slots = VecnodeObj_slots(Vector_leaf(from, i));
+		long last = (i | MASK) + 1 < end ? (i | MASK) + 1 : end;
+		for (; i < last; i++) {
+			Vector_append(gc, vec, slots[i & MASK], edit);
+		}
+	}
+}
+
+static Object *Vector_arg(Object *arg, Context *ctx)
+{
+	return Builtin_arg(arg, VectorObject, ctx);
+}
+
+// NOTE: the index is from 1
+static int Vector_index(Object *arg, long size, Context *ctx, long *index)
+{
+	Number num;
+	if (!Builtin_numeric(arg, ctx, &num)) {
+		return 0;
+	}
+	double n = Number_value(num);
+	if (n < 1 || n > size || n != (long)n) {
+		char text[NUMBER_TEXT_SIZE];
+		errorf("no element %s in a vector", Number_format(num, text));
+		return 0;
+	}
+	*index = (long)n - 1;
+	return 1;
+}
+
+Object *Vector_empty(Object **args, Context *ctx)
+{
+	(void)args;
+	return Vector_new(ctx->gc);
+}
+
+// NOTE: the element is not forced
+Object *Vector_push(Object **args, Context *ctx)
+{
+	Object *vec = Vector_arg(args[1], ctx);
+	if (!vec) {
+		return NULL;
+	}
+	vec = Vector_copy(ctx->gc, vec);
+	Vector_append(ctx->gc, vec, args[0], 0);
+	return vec;
+}
+
+Object *Vector_get(Object **args, Context *ctx)
+{
+	long index;
+	Object *vec = Vector_arg(args[1], ctx);
+	if (!vec || !Vector_index(args[0], VectorObj_size(vec), ctx, &index)) {
+		return NULL;
+	}
+	return Vector_element(vec, index);
+}
+
+Object *Vector_set(Object **args, Context *ctx)
+{
+	long index;
+	Object *vec = Vector_arg(args[2], ctx);
+	if (!vec || !Vector_index(args[0], VectorObj_size(vec), ctx, &index)) {
+		return NULL;
+	}
+	vec = Vector_copy(ctx->gc, vec);
+	if (index >= Vector_tail_offset(VectorObj_size(vec))) {
+		VectorObj_tail(vec) = Vector_editable(ctx->gc, VectorObj_tail(vec), 0);
+		VecnodeObj_slots(VectorObj_tail(vec))[index & MASK] = args[1];
+	} else {
+		VectorObj_root(vec) = Vector_assoc(ctx->gc, VectorObj_root(vec), VectorObj_shift(vec), index, args[1]);
+	}
+	return vec;
+}
+
+Object *Vector_length(Object **args, Context *ctx)
+{
+	Object *vec = Vector_arg(args[0], ctx);
+	if (!vec) {
+		return NULL;
+	}
+	return GC_alloc_int(ctx->gc, VectorObj_size(vec));
+}
+
+// NOTE: the trie of the first vector is shared, the elements
+// of the second one are pushed
+Object *Vector_concat(Object **args, Context *ctx)
+{
+	Object *left = Vector_arg(args[0], ctx);
+	Object *right = left ? Vector_arg(args[1], ctx) : NULL;
+	if (!right) {
+		return NULL;
+	}
+	Object *vec = Vector_copy(ctx->gc, left);
+	edits += 1;
+	Vector_append_range(ctx->gc, vec, right, 0, VectorObj_size(right), edits);
+	return vec;
+}
+
+// The elements from the first index up to the second one (not included)
+Object *Vector_slice(Object **args, Context *ctx)
+{
+	Number from, to;
+	if (!Builtin_numeric(args[0], ctx, &from) || !Builtin_numeric(args[1], ctx, &to)) {
+		return NULL;
+	}
+	double start = Number_value(from), end = Number_value(to);
+	Object *vec = Vector_arg(args[2], ctx);
+	if (!vec) {
+		return NULL;
+	}
+	long size = VectorObj_size(vec);
+	if (start < 1 || end > size + 1 || start > end || start != (long)start || end != (long)end) {
+		char text[NUMBER_TEXT_SIZE], text2[NUMBER_TEXT_SIZE];
+		errorf("no slice from %s to %s in a vector", Number_format(from, text), Number_format(to, text2));
+		return NULL;
+	}
+	Object *slice = Vector_new(ctx->gc);
+	edits += 1;
+	Vector_append_range(ctx->gc, slice, vec, (long)start - 1, (long)end - 1, edits);
+	return slice;
+}
+
+// NOTE: the vector is protected, since forcing the list may start a collection
+Object *Vector_from_list(Object **args, Context *ctx)
+{
+	Object *vec = Vector_new(ctx->gc);
+	GC_protect(ctx->gc, vec);
+	edits += 1;
+	unsigned long edit = edits;
+	Object *list = Builtin_arg(args[0], ListObject, ctx);
+	for (; list && !ListObj_empty(list); list = Builtin_arg(ListObj_tail(list), ListObject, ctx)) {
+		Vector_append(ctx->gc, vec, ListObj_head(list), edit);
+	}
+	GC_unprotect(ctx->gc, 1);
+	return list ? vec : NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef VECTOR_INCLUDED
+#define VECTOR_INCLUDED
+
+#include "object.h"
+#include "context.h"
+
+// NOTE: the index is from 0 and must be in the vector
+Object *Vector_element(const Object *vec, long index);
+
+// the builtins, see builtin.c
+Object *Vector_empty(Object **args, Context *ctx);
+Object *Vector_push(Object **args, Context *ctx);
+Object *Vector_get(Object **args, Context *ctx);
+Object *Vector_set(Object **args, Context *ctx);
+Object *Vector_length(Object **args, Context *ctx);
+Object *Vector_concat(Object **args, Context *ctx);
+Object *Vector_slice(Object **args, Context *ctx);
+Object *Vector_from_list(Object **args, Context *ctx);
+
+#endif // VECTOR_INCLUDED
@@ -0,0 +1,28 @@
+#ifndef WORKLIST_INCLUDED
+#define WORKLIST_INCLUDED
+
+#include <stdlib.h>
+
+// A growable array that the passes over the tree use as an explicit
+// stack, so arbitrarily deep trees don't overflow the C stack.
+// NOTE: the pointers into it are only valid until the next push
+#define Worklist(T) struct { T *items; int size; int capacity; }
+
+#define WORKLIST_EMPTY {NULL, 0, 0}
+#define WORKLIST_INITIAL_CAPACITY 64
+
+// NOTE: the arguments initialize the fields of the item in order
+#define Worklist_push(self, ...) ({\
+	if ((self)->size == (self)->capacity) {\
+		(self)->capacity = (self)->capacity ? (self)->capacity * 2 : WORKLIST_INITIAL_CAPACITY;\
+		(self)->items = reallocarray((self)->items, (self)->capacity, sizeof(*(self)->items));\
+	}\
+	(self)->items[(self)->size++] = (typeof(*(self)->items)){__VA_ARGS__};\
+})
+#define Worklist_pop(self) ((self)->items[--(self)->size])
+#define Worklist_drop(self) ((self)->size -= 1)
+#define Worklist_top(self) (&(self)->items[(self)->size - 1])
+#define Worklist_empty(self) ((self)->size == 0)
+#define Worklist_destroy(self) (free((self)->items))
+
+#endif // WORKLIST_INCLUDED